@@ -14,18 +14,42 @@
 //
 //You should have received a copy of the GNU General Public License
 //along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Uncompressed image. Pixel memory is 64 byte aligned and not initialized on
+//allocation: decompressors write every byte, zero filling would only add
+//page faults and memory traffic. Buffers can be backed by huge pages and
+//placed on a NUMA node through BufferOptions. Accessors never copy pixel
+//data; copy construction and assignment are deep copies.
+
+#include <cstring>
 #include <vector>
+#include "AlignedBuffer.h"
+#include "ImageView.h"
 #include "pixelformat.h"
 
 namespace tjpp {
 class Image {
 public:
-    Image() : width_(0), height_(0), pixelFormat_(PixelFormat()) {}
+    explicit Image(const BufferOptions& opts = BufferOptions())
+        : width_(0), height_(0), pixelFormat_(TJPF()), data_(opts) {}
     Image(const std::vector< unsigned char >& data,
           size_t width, size_t height, TJPF pf) :
-        data_(data), width_(width), height_(height), pixelFormat_(pf) {}
-    Image(const Image&) = default;
-    Image& operator=(const Image&) = default;
+        width_(width), height_(height), pixelFormat_(pf) {
+        Allocate(data.size());
+        std::memcpy(data_.Data(), data.data(), data.size());
+    }
+    Image(const Image& i) :
+        width_(i.width_), height_(i.height_), pixelFormat_(i.pixelFormat_),
+        data_(i.data_.Options()) {
+        Allocate(i.AllocatedSize());
+        if(i.AllocatedSize())
+            std::memcpy(data_.Data(), i.data_.Data(), i.AllocatedSize());
+    }
+    Image& operator=(const Image& i) {
+        if(&i == this) return *this;
+        Image tmp(i);
+        return *this = std::move(tmp);
+    }
     Image(Image&& i) {
         width_ = i.width_;
         height_ = i.height_;
@@ -46,14 +70,29 @@ public:
     size_t Width() const { return width_; }
     size_t Height() const { return height_; }
     TJPF PixelFormat() const { return pixelFormat_; }
-    std::vector< unsigned char > Data() const { return data_; }
-    const unsigned char* DataPtr() const { return data_.data(); }
-    unsigned char* DataPtr() { return data_.data(); }
+    const unsigned char* Data() const { return data_.Data(); }
+    unsigned char* Data() { return data_.Data(); }
+    const unsigned char* DataPtr() const { return data_.Data(); }
+    unsigned char* DataPtr() { return data_.Data(); }
     int NumPlanes() const { return NumComponents(pixelFormat_); }
     size_t Size() const { return width_ * height_ * NumPlanes(); }
-    size_t AllocatedSize() const { return data_.size(); }
+    size_t AllocatedSize() const { return data_.Size(); }
+    //uninitialized buffer of at least sz bytes; contents are not preserved
+    //when the current buffer is smaller than sz
     void Allocate(size_t sz) {
-        data_.resize(sz);
+        if(data_.Size() < sz) data_.Allocate(sz);
+    }
+    //memory options for next allocation
+    void SetBufferOptions(const BufferOptions& opts) {
+        data_.SetOptions(opts);
+    }
+    const BufferOptions& GetBufferOptions() const { return data_.Options(); }
+    ImageView View() const {
+        return ImageView(DataPtr(), int(width_), int(height_), pixelFormat_);
+    }
+    MutableImageView View() {
+        return MutableImageView(DataPtr(), int(width_), int(height_),
+                                pixelFormat_);
     }
     void SetParameters(size_t w, size_t h, TJPF pf) {
         width_ = w;
@@ -64,6 +103,6 @@ private:
     size_t width_;
     size_t height_;
     TJPF pixelFormat_;
-    std::vector< unsigned char > data_;
+    AlignedBuffer data_;
 };
 }
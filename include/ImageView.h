@@ -0,0 +1,79 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Non-owning view of pixel data: width, height, pixel format and pitch
+//(bytes between the beginning of two consecutive rows), used to pass
+//sub-rectangles of larger images or images with row padding without
+//copying them into a packed buffer
+
+#include <stdexcept>
+#include <string>
+#include <turbojpeg.h>
+
+#include "pixelformat.h"
+
+namespace tjpp {
+template < typename T >
+class ImageViewT {
+public:
+    ImageViewT() : data_(nullptr), width_(0), height_(0), pitch_(0),
+                   pixelFormat_(TJPF_RGB) {}
+    //pitch = 0: packed rows
+    ImageViewT(T* data, int width, int height, TJPF pf, int pitch = 0) :
+        data_(data), width_(width), height_(height),
+        pitch_(pitch ? pitch : width * NumComponents(pf)), pixelFormat_(pf) {
+        if(pitch_ < width_ * NumComponents(pf))
+            throw std::logic_error("Pitch smaller than row size: "
+                                   + std::to_string(pitch_));
+    }
+    //mutable to const view conversion
+    template < typename U >
+    ImageViewT(const ImageViewT< U >& v) :
+        data_(v.DataPtr()), width_(v.Width()), height_(v.Height()),
+        pitch_(v.Pitch()), pixelFormat_(v.PixelFormat()) {}
+    T* DataPtr() const { return data_; }
+    T* Row(int y) const { return data_ + size_t(y) * pitch_; }
+    int Width() const { return width_; }
+    int Height() const { return height_; }
+    int Pitch() const { return pitch_; }
+    TJPF PixelFormat() const { return pixelFormat_; }
+    int NumPlanes() const { return NumComponents(pixelFormat_); }
+    bool Packed() const { return pitch_ == width_ * NumPlanes(); }
+    bool Empty() const { return !data_ || !width_ || !height_; }
+    //w x h rectangle with top left corner at (x, y)
+    ImageViewT SubView(int x, int y, int w, int h) const {
+        if(x < 0 || y < 0 || w < 0 || h < 0
+           || x + w > width_ || y + h > height_)
+            throw std::out_of_range("Sub-view outside image");
+        return ImageViewT(Row(y) + x * NumPlanes(), w, h, pixelFormat_,
+                          pitch_);
+    }
+    //rows [y, y + h)
+    ImageViewT Rows(int y, int h) const {
+        return SubView(0, y, width_, h);
+    }
+private:
+    T* data_;
+    int width_;
+    int height_;
+    int pitch_;
+    TJPF pixelFormat_;
+};
+
+using ImageView = ImageViewT< const unsigned char >;
+using MutableImageView = ImageViewT< unsigned char >;
+}
@@ -0,0 +1,246 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Pool of JPEG output buffers bucketed by size class.
+//Buffer sizes are rounded up to a size class: four classes per power of two
+//starting at 64 KiB, each class has its own lock-free free list; once the
+//pool is warm Get and Put do not allocate memory.
+//The total size of the buffers held by the pool can be capped, buffers
+//returned when the cap is reached are released.
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <turbojpeg.h>
+
+#include "ImageView.h"
+#include "JPEGImage.h"
+#include "MPMCQueue.h"
+#include "TJApi.h"
+#include "TJHandlePool.h"
+#include "timing.h"
+
+namespace tjpp {
+
+struct JPEGBufferPoolCounters {
+    size_t hits;        //Get served from the pool
+    size_t misses;      //Get which allocated a new buffer
+    size_t returned;    //buffers put back into the pool
+    size_t released;    //buffers freed because of byte cap or full list
+    size_t pooledBytes; //size of buffers currently held by the pool
+};
+
+class JPEGBufferPool {
+public:
+    //maxBytes: cap on the total size of pooled buffers, 0 = no cap
+    //buffersPerClass: capacity of each size class free list
+    JPEGBufferPool(size_t maxBytes = 0, size_t buffersPerClass = 64)
+        : maxBytes_(maxBytes), buffersPerClass_(buffersPerClass),
+          hits_(0), misses_(0), returned_(0), released_(0), pooledBytes_(0) {
+        for(auto& c: classes_) c.store(nullptr);
+    }
+    JPEGBufferPool(const JPEGBufferPool&) = delete;
+    JPEGBufferPool& operator=(const JPEGBufferPool&) = delete;
+    //buffer large enough to hold a compressed w x h image
+    JPEGImage Get(int w, int h, TJPF pf, TJSAMP ss, int quality) {
+        JPEGImage i = GetBuffer(tjBufSize(w, h, ss));
+        i.SetParams(w, h, pf, ss, quality);
+        return i;
+    }
+    //buffer of at least size bytes, image parameters are not set
+    JPEGImage GetBuffer(size_t size) {
+        size_t classSize = 0;
+        const int c = ClassIndex(size, classSize);
+        JPEGImage i;
+        Queue* q = classes_[c].load(std::memory_order_acquire);
+        if(q && q->TryPop(i)) {
+            pooledBytes_ -= classSize;
+            ++hits_;
+#ifdef TIMING__
+            Metrics::Add(Metrics::POOL_HITS);
+#endif
+        } else {
+            i.Allocate(classSize);
+            ++misses_;
+#ifdef TIMING__
+            Metrics::Add(Metrics::POOL_MISSES);
+#endif
+        }
+        return i;
+    }
+    //buffers are filed under the largest class not exceeding their size
+    //caller provided buffers are not pooled
+    void Put(JPEGImage&& i) {
+        if(!i.OwnsBuffer()) {
+            i = JPEGImage();
+            return;
+        }
+        size_t classSize = 0;
+        int c = ClassIndex(i.BufferSize(), classSize);
+        if(classSize > i.BufferSize()) {
+            if(c == 0) {
+                Release(i);
+                return;
+            }
+            classSize = ClassSize(--c);
+        }
+        const size_t pooled = pooledBytes_.fetch_add(classSize) + classSize;
+        if(maxBytes_ > 0 && pooled > maxBytes_) {
+            pooledBytes_ -= classSize;
+            Release(i);
+            return;
+        }
+        if(!GetQueue(c)->TryPush(std::move(i))) {
+            pooledBytes_ -= classSize;
+            Release(i);
+            return;
+        }
+        ++returned_;
+    }
+    //pre-allocate n buffers for w x h images
+    void Reserve(int n, int w, int h, TJPF pf, TJSAMP ss, int quality) {
+        for(int k = 0; k != n; ++k) {
+            size_t classSize = 0;
+            ClassIndex(tjBufSize(w, h, ss), classSize);
+            JPEGImage i;
+            i.Allocate(classSize);
+            i.SetParams(w, h, pf, ss, quality);
+            Put(std::move(i));
+        }
+    }
+    JPEGBufferPoolCounters Counters() const {
+        return JPEGBufferPoolCounters{hits_, misses_, returned_, released_,
+                                      pooledBytes_};
+    }
+    ~JPEGBufferPool() {
+        for(auto& c: classes_) delete c.load();
+    }
+private:
+    using Queue = MPMCQueue< JPEGImage >;
+    enum {
+        MIN_CLASS_LOG2 = 16,
+        MAX_CLASS_LOG2 = 30, //tjAlloc takes an int
+        STEPS = 4,
+        NUM_CLASSES = 1 + (MAX_CLASS_LOG2 - MIN_CLASS_LOG2) * STEPS
+    };
+    //size class of sz: classSize is the smallest class size >= sz
+    static int ClassIndex(size_t sz, size_t& classSize) {
+        const size_t minClass = size_t(1) << MIN_CLASS_LOG2;
+        if(sz <= minClass) {
+            classSize = minClass;
+            return 0;
+        }
+        int k = 0;
+        while((sz - 1) >> (k + 1)) ++k;
+        if(k >= MAX_CLASS_LOG2)
+            throw std::length_error("JPEG buffer too large");
+        const size_t base = size_t(1) << k;
+        const size_t step = base / STEPS;
+        const size_t j = (sz - 1 - base) / step + 1;
+        classSize = base + j * step;
+        return 1 + (k - MIN_CLASS_LOG2) * STEPS + int(j) - 1;
+    }
+    static size_t ClassSize(int c) {
+        if(c == 0) return size_t(1) << MIN_CLASS_LOG2;
+        const int k = MIN_CLASS_LOG2 + (c - 1) / STEPS;
+        const size_t j = (c - 1) % STEPS + 1;
+        return (size_t(1) << k) + j * ((size_t(1) << k) / STEPS);
+    }
+    //free lists are created on first use
+    Queue* GetQueue(int c) {
+        Queue* q = classes_[c].load(std::memory_order_acquire);
+        if(q) return q;
+        Queue* n = new Queue(buffersPerClass_);
+        if(classes_[c].compare_exchange_strong(q, n,
+                                               std::memory_order_acq_rel))
+            return n;
+        delete n;
+        return q;
+    }
+    void Release(JPEGImage& i) {
+        i = JPEGImage();
+        ++released_;
+    }
+private:
+    const size_t maxBytes_;
+    const size_t buffersPerClass_;
+    std::atomic< Queue* > classes_[NUM_CLASSES];
+    std::atomic< size_t > hits_;
+    std::atomic< size_t > misses_;
+    std::atomic< size_t > returned_;
+    std::atomic< size_t > released_;
+    std::atomic< size_t > pooledBytes_;
+};
+
+//JPEG image which returns its buffer to the pool on destruction; move only
+class PooledJPEGImage {
+public:
+    PooledJPEGImage() {}
+    PooledJPEGImage(JPEGImage&& img, std::shared_ptr< JPEGBufferPool > pool)
+        : img_(std::move(img)), pool_(std::move(pool)) {}
+    PooledJPEGImage(PooledJPEGImage&& other)
+        : img_(std::move(other.img_)), pool_(std::move(other.pool_)) {}
+    PooledJPEGImage& operator=(PooledJPEGImage&& other) {
+        Flush();
+        img_ = std::move(other.img_);
+        pool_ = std::move(other.pool_);
+        return *this;
+    }
+    PooledJPEGImage(const PooledJPEGImage&) = delete;
+    PooledJPEGImage& operator=(const PooledJPEGImage&) = delete;
+    const JPEGImage& Image() const { return img_; }
+    operator const JPEGImage&() const { return Image(); }
+    //return buffer to pool
+    void Flush() {
+        if(pool_) pool_->Put(std::move(img_));
+        pool_.reset();
+    }
+    ~PooledJPEGImage() {
+        Flush();
+    }
+private:
+    JPEGImage img_;
+    std::shared_ptr< JPEGBufferPool > pool_;
+};
+
+//compress view with handle h into a buffer taken from pool
+inline PooledJPEGImage CompressPooled(
+    const std::shared_ptr< JPEGBufferPool >& pool,
+    TJHandle& h,
+    const ImageView& v,
+    TJSAMP ss,
+    int quality,
+    int flags) {
+    JPEGImage i = pool->Get(v.Width(), v.Height(), v.PixelFormat(), ss,
+                            quality);
+#ifdef TIMING__
+    const Time begin = Tick();
+#endif
+    //buffer size >= tjBufSize: libjpeg-turbo never needs to reallocate
+    const size_t jpegSize =
+        TJCompress(h, v.DataPtr(), v.Width(), v.Pitch(), v.Height(),
+                   v.PixelFormat(), i.DataPtr(), i.BufferSize(), ss, quality,
+                   flags);
+#ifdef TIMING__
+    Metrics::Record(Metrics::COMPRESS_NS, Tick() - begin);
+    Metrics::Add(Metrics::COMPRESS_BYTES_IN, uint64_t(v.Pitch()) * v.Height());
+    Metrics::Add(Metrics::COMPRESS_BYTES_OUT, jpegSize);
+#endif
+    i.SetCompressedSize(jpegSize);
+    return PooledJPEGImage(std::move(i), pool);
+}
+}
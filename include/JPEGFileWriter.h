@@ -0,0 +1,192 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Batched writer of compressed images: images are queued together with the
+//destination path and written on Flush, or when the number of queued files
+//reaches the batch size. All the buffers queued for the same file are
+//written with one vectored write: stripes or frames going into the same
+//file take a single syscall.
+//With direct I/O files are opened with O_DIRECT where supported: data is
+//staged into a block aligned buffer, written once and the file truncated to
+//its actual size; the page cache is bypassed which avoids evicting useful
+//pages when storing large numbers of files.
+//Buffers are not copied when queued, they must stay valid until written.
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "JPEGImage.h"
+
+namespace tjpp {
+//write all the buffers to fd with vectored writes, at most IOV_MAX buffers
+//per call; iov is modified when a write is partial. Returns false and
+//leaves errno set on error
+inline bool WriteAll(int fd, std::vector< iovec >& iov) {
+    size_t i = 0;
+    while(i != iov.size()) {
+        const int n = int(std::min(iov.size() - i, size_t(IOV_MAX)));
+        ssize_t written = writev(fd, &iov[i], n);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        //partial write: skip fully written buffers, advance into the
+        //first partially written one
+        while(i != iov.size() && size_t(written) >= iov[i].iov_len) {
+            written -= ssize_t(iov[i].iov_len);
+            ++i;
+        }
+        if(i != iov.size()) {
+            iov[i].iov_base = static_cast< char* >(iov[i].iov_base)
+                              + written;
+            iov[i].iov_len -= written;
+        }
+    }
+    return true;
+}
+
+class JPEGFileWriter {
+public:
+    //batchSize: number of queued files which triggers a flush
+    JPEGFileWriter(bool direct = false, size_t batchSize = 64)
+        : direct_(direct), batchSize_(std::max(size_t(1), batchSize)),
+          staging_(nullptr, std::free), stagingSize_(0) {}
+    JPEGFileWriter(const JPEGFileWriter&) = delete;
+    JPEGFileWriter& operator=(const JPEGFileWriter&) = delete;
+    //append buffer to file; consecutive calls with the same path write into
+    //the same file
+    void Add(const std::string& path, const unsigned char* data,
+             size_t size) {
+        if(files_.empty() || files_.back().path != path) {
+            if(files_.size() == batchSize_) Flush();
+            files_.push_back(File{path, std::vector< iovec >()});
+        }
+        files_.back().buffers.push_back(
+            iovec{const_cast< unsigned char* >(data), size});
+    }
+    void Add(const std::string& path, const JPEGImage& img) {
+        Add(path, img.DataPtr(), img.CompressedSize());
+    }
+    //write all queued files; on error the files written and the file which
+    //failed are removed from the queue, the files after it stay queued
+    void Flush() {
+        size_t i = 0;
+        try {
+            for(; i != files_.size(); ++i) Write(files_[i]);
+        } catch(...) {
+            files_.erase(files_.begin(), files_.begin() + i + 1);
+            throw;
+        }
+        files_.clear();
+    }
+    size_t Pending() const { return files_.size(); }
+    //queued files are written, errors are ignored: call Flush to check
+    ~JPEGFileWriter() {
+        try {
+            Flush();
+        } catch(...) {}
+    }
+private:
+    struct File {
+        std::string path;
+        std::vector< iovec > buffers;
+    };
+    enum { BLOCK_SIZE = 4096 };
+private:
+    void Write(File& f) {
+        int fd = -1;
+#ifdef O_DIRECT
+        if(direct_) {
+            fd = open(f.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT,
+                      0644);
+            //not supported by file system: buffered I/O
+            if(fd >= 0) {
+                WriteDirect(fd, f);
+                return;
+            }
+            if(errno != EINVAL) Error("Cannot open ", f.path);
+        }
+#endif
+        fd = open(f.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) Error("Cannot open ", f.path);
+        if(!WriteAll(fd, f.buffers)) {
+            const int e = errno;
+            close(fd);
+            errno = e;
+            Error("Cannot write ", f.path);
+        }
+        if(close(fd) != 0) Error("Cannot close ", f.path);
+    }
+    void WriteDirect(int fd, const File& f) {
+        size_t size = 0;
+        for(auto& b: f.buffers) size += b.iov_len;
+        const size_t padded = (size + BLOCK_SIZE - 1) / BLOCK_SIZE
+                              * BLOCK_SIZE;
+        if(stagingSize_ < padded) {
+            void* p = nullptr;
+            if(posix_memalign(&p, BLOCK_SIZE, padded) != 0) {
+                close(fd);
+                throw std::bad_alloc();
+            }
+            staging_.reset(static_cast< unsigned char* >(p));
+            stagingSize_ = padded;
+        }
+        unsigned char* o = staging_.get();
+        for(auto& b: f.buffers) {
+            std::memcpy(o, b.iov_base, b.iov_len);
+            o += b.iov_len;
+        }
+        std::memset(o, 0, padded - size);
+        size_t done = 0;
+        while(done != padded) {
+            const ssize_t w = write(fd, staging_.get() + done, padded - done);
+            if(w < 0 && errno == EINTR) continue;
+            if(w <= 0) {
+                close(fd);
+                Error("Cannot write ", f.path);
+            }
+            done += size_t(w);
+        }
+        if(ftruncate(fd, off_t(size)) != 0) {
+            close(fd);
+            Error("Cannot truncate ", f.path);
+        }
+        if(close(fd) != 0) Error("Cannot close ", f.path);
+    }
+    static void Error(const char* msg, const std::string& path) {
+        throw std::runtime_error(msg + path + ": " + std::strerror(errno));
+    }
+private:
+    bool direct_;
+    size_t batchSize_;
+    std::vector< File > files_;
+    std::unique_ptr< unsigned char, void (*)(void*) > staging_;
+    size_t stagingSize_;
+};
+}
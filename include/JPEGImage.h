@@ -17,7 +17,9 @@
 
 //Note: consider using X* or *X pixel format to speed up memory access
 #include <memory>
+#include <new>
 #include <stdexcept>
+#include <string>
 
 #include <turbojpeg.h>
 
@@ -31,18 +33,34 @@ inline void TJDeleter(unsigned char* ptr) {
     tjFree(ptr);
 }
 
+//buffer not owned by the image
+inline void NoDeleter(unsigned char*) {}
+
+//Compressed image. Move only: the buffer has a single owner, images returned
+//by the compressors never alias a buffer still used by the compressor.
+//Buffers are allocated with tjAlloc or provided by the caller: caller
+//provided buffers (e.g. network send buffers) are not freed by the image and
+//never replaced with a larger buffer.
 class JPEGImage {
 public:
     JPEGImage() : width_(0), height_(0), pixelFormat_(TJPF()),
                   subSampling_(TJSAMP()), quality_(50), pitch_(0),
-                  compressedSize_(0), bufferSize_(0) {}
-    JPEGImage(const JPEGImage&) = default;
-    JPEGImage(JPEGImage&& i) {
+                  compressedSize_(0), bufferSize_(0),
+                  data_(nullptr, TJDeleter) {}
+    JPEGImage(const JPEGImage&) = delete;
+    JPEGImage& operator=(const JPEGImage&) = delete;
+    JPEGImage(JPEGImage&& i) : data_(nullptr, TJDeleter) {
         Move(i);
     }
-    JPEGImage(int w, int h, TJPF pf, TJSAMP s, int q) :
-        width_(w), height_(h), pixelFormat_(pf), subSampling_(s), quality_(q),
-        data_(tjAlloc(w * h * NumComponents(pf)), TJDeleter) {} //
+    //buffer large enough to hold a compressed w x h image
+    JPEGImage(int w, int h, TJPF pf, TJSAMP s, int q) : JPEGImage() {
+        Reset(w, h, pf, s, q);
+    }
+    //caller provided buffer of size bytes
+    JPEGImage(unsigned char* buffer, size_t size) : JPEGImage() {
+        data_ = Buffer(buffer, NoDeleter);
+        bufferSize_ = size;
+    }
     JPEGImage& operator=(JPEGImage&& i) {
         Move(i);
         return *this;
@@ -53,7 +71,6 @@ public:
     TJPF PixelFormat() const { return pixelFormat_; }
     TJSAMP ChrominanceSubSampling() const { return subSampling_; }
     int Quality() const { return quality_; }
-    std::shared_ptr< unsigned char > Data() const { return data_; }
     unsigned char* DataPtr() {
         return data_.get();
     }
@@ -61,16 +78,33 @@ public:
         return data_.get();
     }
     bool Empty() const {
-        return bool(data_);
+        return !data_;
     }
+    //true if buffer is freed by the image
+    bool OwnsBuffer() const {
+        return data_ && data_.get_deleter() != NoDeleter;
+    }
+    //set parameters and make sure the buffer can hold a compressed w x h
+    //image (tjBufSize): existing buffers are reused when large enough
     void Reset(int w, int h, TJPF pf, TJSAMP s, int quality) {
         SetParams(w, h, pf, s, quality);
-        const size_t sz = std::max(tjBufSize(w, h, s),
-                                   static_cast< unsigned long >(
-                                       w * h * NumComponents(pf)));
-        data_.reset(tjAlloc(sz),
-                    TJDeleter);
-        compressedSize_ = sz;
+        Reserve(tjBufSize(w, h, s));
+    }
+    //make sure the buffer holds at least sz bytes, parameters are not
+    //modified
+    void Reserve(size_t sz) {
+        if(data_ && bufferSize_ >= sz) return;
+        if(data_ && !OwnsBuffer())
+            throw std::length_error("Caller provided JPEG buffer too small: "
+                                    + std::to_string(bufferSize_) + " < "
+                                    + std::to_string(sz));
+        Allocate(sz);
+    }
+    //allocate a buffer of sz bytes, parameters are not modified
+    void Allocate(size_t sz) {
+        data_ = Buffer(tjAlloc(int(sz)), TJDeleter);
+        if(!data_) throw std::bad_alloc();
+        compressedSize_ = 0;
         bufferSize_ = sz;
     }
     void SetParams(size_t w, size_t h, TJPF pf, TJSAMP ss, int q) {
@@ -82,12 +116,14 @@ public:
     }
     void SetCompressedSize(size_t s) { compressedSize_ = s; }
     size_t CompressedSize() const { return compressedSize_; }
-    // Size of buffer allocated by tjBuf
+    // Size of allocated buffer
     void SetBufferSize(size_t s) { bufferSize_ = s; }
     size_t BufferSize() const { return bufferSize_; }
     bool operator!() const { return Empty(); }
 private:
+    using Buffer = std::unique_ptr< unsigned char, void (*)(unsigned char*) >;
     void Move(JPEGImage& i) {
+        if(&i == this) return;
         width_ = i.width_;
         height_ = i.height_;
         pixelFormat_ = i.pixelFormat_;
@@ -97,9 +133,10 @@ private:
         compressedSize_ = i.compressedSize_;
         bufferSize_ = i.bufferSize_;
         data_ = std::move(i.data_);
-        i.data_.reset();
         i.width_ = 0;
         i.height_ = 0;
+        i.compressedSize_ = 0;
+        i.bufferSize_ = 0;
     }
 private:
     int width_;
@@ -110,7 +147,7 @@ private:
     int pitch_;
     size_t compressedSize_;
     size_t bufferSize_;
-    std::shared_ptr< unsigned char > data_;
+    Buffer data_;
 };
 
 inline size_t UncompressedSize(size_t width, size_t height, TJPF pf) {
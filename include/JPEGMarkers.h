@@ -0,0 +1,343 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Minimal JPEG marker parsing: header segments, frame geometry and location
+//of entropy coded data; enough to split and join baseline streams at
+//restart markers without decoding
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace tjpp {
+
+enum JPEGMarker {
+    JPEG_SOF0 = 0xC0,
+    JPEG_SOF1 = 0xC1,
+    JPEG_SOF2 = 0xC2,
+    JPEG_DHT  = 0xC4,
+    JPEG_RST0 = 0xD0,
+    JPEG_RST7 = 0xD7,
+    JPEG_SOI  = 0xD8,
+    JPEG_EOI  = 0xD9,
+    JPEG_SOS  = 0xDA,
+    JPEG_DQT  = 0xDB,
+    JPEG_DRI  = 0xDD
+};
+
+//header segment: offset of the 0xFF byte and size including the marker
+struct JPEGSegment {
+    int marker;
+    size_t offset;
+    size_t size;
+};
+
+struct JPEGComponent {
+    int id;
+    int h; //horizontal sampling factor
+    int v; //vertical sampling factor
+};
+
+struct JPEGLayout {
+    std::vector< JPEGSegment > segments; //SOI excluded, up to SOS included
+    int sofMarker = 0;
+    int width = 0;
+    int height = 0;
+    std::vector< JPEGComponent > components;
+    int restartInterval = 0; //MCUs, 0 = no restart markers
+    size_t scanBegin = 0;    //first byte of entropy coded data
+    size_t scanEnd = 0;      //first byte of the marker following the scan
+    //MCU size in pixels; non-interleaved (single component) scans use
+    //one 8x8 block per MCU
+    int MCUWidth() const {
+        if(components.size() == 1) return 8;
+        int m = 0;
+        for(auto& c: components) m = std::max(m, c.h);
+        return 8 * m;
+    }
+    int MCUHeight() const {
+        if(components.size() == 1) return 8;
+        int m = 0;
+        for(auto& c: components) m = std::max(m, c.v);
+        return 8 * m;
+    }
+    int MCUsPerRow() const {
+        return (width + MCUWidth() - 1) / MCUWidth();
+    }
+    int MCURows() const {
+        return (height + MCUHeight() - 1) / MCUHeight();
+    }
+    bool Baseline() const {
+        return sofMarker == JPEG_SOF0 || sofMarker == JPEG_SOF1;
+    }
+    const JPEGSegment* Find(int marker) const {
+        for(auto& s: segments)
+            if(s.marker == marker) return &s;
+        return nullptr;
+    }
+};
+
+inline int ReadU16(const unsigned char* p) {
+    return (int(p[0]) << 8) | int(p[1]);
+}
+
+inline void WriteU16(unsigned char* p, int v) {
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)(v & 0xFF);
+}
+
+//return offset of the first marker following entropy coded data starting
+//at begin; stuffed 0xFF00 bytes and, if skipRST is true, restart markers
+//are part of the entropy coded data
+inline size_t FindScanEnd(const unsigned char* data, size_t size,
+                          size_t begin, bool skipRST = true) {
+    for(size_t i = begin; i + 1 < size; ++i) {
+        if(data[i] != 0xFF) continue;
+        const int m = data[i + 1];
+        if(m == 0x00 || m == 0xFF) continue;
+        if(skipRST && m >= JPEG_RST0 && m <= JPEG_RST7) {
+            ++i;
+            continue;
+        }
+        return i;
+    }
+    throw std::runtime_error("Truncated JPEG entropy coded data");
+}
+
+//offsets of the restart markers inside entropy coded data [begin, end)
+inline std::vector< size_t > FindRestartMarkers(const unsigned char* data,
+                                                size_t begin, size_t end) {
+    std::vector< size_t > rst;
+    for(size_t i = begin; i + 1 < end; ++i) {
+        if(data[i] != 0xFF) continue;
+        const int m = data[i + 1];
+        if(m >= JPEG_RST0 && m <= JPEG_RST7) rst.push_back(i);
+        if(m != 0xFF) ++i;
+    }
+    return rst;
+}
+
+//parse headers up to and including the first SOS segment and locate the
+//entropy coded data of the first scan
+inline JPEGLayout ParseJPEG(const unsigned char* data, size_t size) {
+    if(size < 4 || data[0] != 0xFF || data[1] != JPEG_SOI)
+        throw std::runtime_error("Not a JPEG stream");
+    JPEGLayout l;
+    size_t i = 2;
+    while(true) {
+        while(i < size && data[i] == 0xFF && i + 1 < size
+              && data[i + 1] == 0xFF) ++i; //fill bytes
+        if(i + 4 > size || data[i] != 0xFF)
+            throw std::runtime_error("Invalid JPEG marker at offset "
+                                     + std::to_string(i));
+        const int marker = data[i + 1];
+        const size_t length = size_t(ReadU16(data + i + 2));
+        if(i + 2 + length > size)
+            throw std::runtime_error("Truncated JPEG segment");
+        const unsigned char* p = data + i + 4;
+        l.segments.push_back(JPEGSegment{marker, i, length + 2});
+        if(marker >= JPEG_SOF0 && marker <= 0xCF && marker != JPEG_DHT
+           && marker != 0xC8 && marker != 0xCC) {
+            if(length < 8 || length < 8 + 3 * size_t(p[5]))
+                throw std::runtime_error("Truncated JPEG frame header");
+            l.sofMarker = marker;
+            l.height = ReadU16(p + 1);
+            l.width = ReadU16(p + 3);
+            const int nc = p[5];
+            for(int c = 0; c != nc; ++c) {
+                l.components.push_back(
+                    JPEGComponent{p[6 + 3 * c],
+                                  p[7 + 3 * c] >> 4,
+                                  p[7 + 3 * c] & 0xF});
+            }
+        } else if(marker == JPEG_DRI) {
+            if(length != 4)
+                throw std::runtime_error("Invalid JPEG restart interval");
+            l.restartInterval = ReadU16(p);
+        } else if(marker == JPEG_SOS) {
+            l.scanBegin = i + 2 + length;
+            l.scanEnd = FindScanEnd(data, size, l.scanBegin);
+            return l;
+        }
+        i += 2 + length;
+    }
+}
+
+//true if the two streams use the same quantization and Huffman tables
+inline bool SameTables(const unsigned char* a, const JPEGLayout& la,
+                       const unsigned char* b, const JPEGLayout& lb) {
+    auto tables = [](const unsigned char* d, const JPEGLayout& l) {
+        std::string t;
+        for(auto& s: l.segments)
+            if(s.marker == JPEG_DQT || s.marker == JPEG_DHT)
+                t.append((const char*) d + s.offset, s.size);
+        return t;
+    };
+    return tables(a, la) == tables(b, lb);
+}
+
+//compressed stream of a single stripe
+struct StripeStream {
+    const unsigned char* data;
+    size_t size;
+};
+
+//parse stripe headers and return the size of the stream created by
+//JoinRestartStripes
+inline size_t JoinedSize(const std::vector< StripeStream >& stripes,
+                         std::vector< JPEGLayout >& layouts) {
+    layouts.clear();
+    size_t sz = 0;
+    for(auto& s: stripes) {
+        layouts.push_back(ParseJPEG(s.data, s.size));
+        //entropy coded data + RST or EOI marker
+        sz += layouts.back().scanEnd - layouts.back().scanBegin + 2;
+    }
+    //SOI and headers up to SOS + DRI segment
+    return sz + layouts.front().scanBegin + 6;
+}
+
+//Join independently compressed baseline stripes into a single stream:
+//headers of the first stripe with the frame height set to the total height
+//and a DRI segment, followed by the entropy coded data of each stripe
+//separated by restart markers.
+//All stripes but the last must contain exactly restartInterval MCUs and
+//all stripes must share the same tables.
+//out must be at least JoinedSize bytes; returns the number of bytes written
+inline size_t JoinRestartStripes(const std::vector< StripeStream >& stripes,
+                                 const std::vector< JPEGLayout >& layouts,
+                                 int totalHeight,
+                                 int restartInterval,
+                                 unsigned char* out) {
+    const JPEGLayout& first = layouts.front();
+    const unsigned char* header = stripes.front().data;
+    if(!first.Baseline())
+        throw std::logic_error("Only baseline JPEG stripes can be joined");
+    if(restartInterval <= 0 || restartInterval > 0xFFFF)
+        throw std::logic_error("Invalid restart interval "
+                               + std::to_string(restartInterval));
+    for(size_t i = 0; i != stripes.size(); ++i) {
+        if(layouts[i].restartInterval != 0)
+            throw std::logic_error("Stripes already contain restart markers");
+        if(i > 0 && !SameTables(header, first, stripes[i].data, layouts[i]))
+            throw std::runtime_error("Stripes use different tables");
+    }
+    unsigned char* o = out;
+    *o++ = 0xFF;
+    *o++ = JPEG_SOI;
+    for(auto& s: first.segments) {
+        if(s.marker == JPEG_SOS) {
+            *o++ = 0xFF;
+            *o++ = JPEG_DRI;
+            WriteU16(o, 4);
+            WriteU16(o + 2, restartInterval);
+            o += 4;
+        }
+        std::memcpy(o, header + s.offset, s.size);
+        if(s.marker == first.sofMarker) WriteU16(o + 5, totalHeight);
+        o += s.size;
+    }
+    for(size_t i = 0; i != stripes.size(); ++i) {
+        const JPEGLayout& l = layouts[i];
+        std::memcpy(o, stripes[i].data + l.scanBegin,
+                    l.scanEnd - l.scanBegin);
+        o += l.scanEnd - l.scanBegin;
+        *o++ = 0xFF;
+        *o++ = i == stripes.size() - 1 ? int(JPEG_EOI) : JPEG_RST0 + (i % 8);
+    }
+    return size_t(o - out);
+}
+
+//Abbreviated streams (JPEG Annex B.4, B.5): a tables-only stream made of
+//SOI, DQT and DHT segments and EOI carries the tables shared by a set of
+//abbreviated image streams, which carry no tables.
+
+//move the DQT and DHT segments preceding the first scan of the stream to
+//tables, the stream is compacted in place; returns the new stream size
+inline size_t RemoveTables(unsigned char* data, size_t size,
+                           const JPEGLayout& l,
+                           std::vector< unsigned char >& tables) {
+    tables.clear();
+    size_t o = 2; //after SOI
+    size_t i = 2;
+    for(auto& s: l.segments) {
+        if(s.marker != JPEG_DQT && s.marker != JPEG_DHT) continue;
+        std::memmove(data + o, data + i, s.offset - i);
+        o += s.offset - i;
+        tables.insert(tables.end(), data + s.offset,
+                      data + s.offset + s.size);
+        i = s.offset + s.size;
+    }
+    std::memmove(data + o, data + i, size - i);
+    return o + size - i;
+}
+
+//insert table segments after SOI in place, data must have room for
+//tables.size() more bytes; returns the new stream size
+inline size_t InsertTables(unsigned char* data, size_t size,
+                           const std::vector< unsigned char >& tables) {
+    std::memmove(data + 2 + tables.size(), data + 2, size - 2);
+    std::memcpy(data + 2, tables.data(), tables.size());
+    return size + tables.size();
+}
+
+//tables-only stream, out must hold tables.size() + 4 bytes; returns the
+//number of bytes written
+inline size_t WriteTablesOnly(const std::vector< unsigned char >& tables,
+                              unsigned char* out) {
+    out[0] = 0xFF;
+    out[1] = JPEG_SOI;
+    std::memcpy(out + 2, tables.data(), tables.size());
+    out[2 + tables.size()] = 0xFF;
+    out[3 + tables.size()] = JPEG_EOI;
+    return tables.size() + 4;
+}
+
+//check that the stream is a tables-only stream and return the offset of
+//its EOI marker
+inline size_t ParseTablesOnly(const unsigned char* data, size_t size) {
+    if(size < 4 || data[0] != 0xFF || data[1] != JPEG_SOI)
+        throw std::runtime_error("Not a JPEG stream");
+    size_t i = 2;
+    while(i + 1 < size && data[i] == 0xFF && data[i + 1] != JPEG_EOI) {
+        const int marker = data[i + 1];
+        if(marker != JPEG_DQT && marker != JPEG_DHT)
+            throw std::runtime_error("Not a tables-only JPEG stream");
+        if(i + 4 > size || i + 2 + size_t(ReadU16(data + i + 2)) > size)
+            throw std::runtime_error("Truncated JPEG segment");
+        i += 2 + ReadU16(data + i + 2);
+    }
+    if(i + 2 > size || data[i] != 0xFF || data[i + 1] != JPEG_EOI)
+        throw std::runtime_error("Invalid tables-only JPEG stream");
+    return i;
+}
+
+//complete stream: SOI and the tables of the tables-only stream, whose EOI
+//marker is at tablesEnd, followed by the abbreviated stream without SOI
+inline void SpliceTables(const unsigned char* tables, size_t tablesEnd,
+                         const unsigned char* data, size_t size,
+                         std::vector< unsigned char >& out) {
+    if(size < 4 || data[0] != 0xFF || data[1] != JPEG_SOI)
+        throw std::runtime_error("Not a JPEG stream");
+    out.resize(tablesEnd + size - 2);
+    std::memcpy(out.data(), tables, tablesEnd);
+    std::memcpy(out.data() + tablesEnd, data + 2, size - 2);
+}
+
+}
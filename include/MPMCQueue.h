@@ -0,0 +1,112 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Bounded lock-free multiple producer multiple consumer queue
+//(D. Vyukov's array based algorithm): each cell carries a sequence number
+//telling producers and consumers whether it is free or full for the
+//current lap, a push or pop is a single CAS on the enqueue or dequeue
+//position. No memory is allocated after construction.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace tjpp {
+template < typename T >
+class MPMCQueue {
+public:
+    //capacity is rounded up to a power of two
+    explicit MPMCQueue(size_t capacity)
+        : mask_(RoundUpPow2(capacity) - 1),
+          cells_(new Cell[mask_ + 1]),
+          enqueuePos_(0), dequeuePos_(0) {
+        for(size_t i = 0; i != mask_ + 1; ++i)
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    MPMCQueue(const MPMCQueue&) = delete;
+    MPMCQueue& operator=(const MPMCQueue&) = delete;
+    //false if queue is full, v is not moved from in this case
+    bool TryPush(T&& v) {
+        Cell* cell = nullptr;
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        while(true) {
+            cell = &cells_[pos & mask_];
+            const size_t seq = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t dif = intptr_t(seq) - intptr_t(pos);
+            if(dif == 0) {
+                if(enqueuePos_.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if(dif < 0) {
+                return false;
+            } else {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(v);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    //false if queue is empty
+    bool TryPop(T& v) {
+        Cell* cell = nullptr;
+        size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        while(true) {
+            cell = &cells_[pos & mask_];
+            const size_t seq = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t dif = intptr_t(seq) - intptr_t(pos + 1);
+            if(dif == 0) {
+                if(dequeuePos_.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if(dif < 0) {
+                return false;
+            } else {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        v = std::move(cell->data);
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+    size_t Capacity() const { return mask_ + 1; }
+private:
+    static size_t RoundUpPow2(size_t n) {
+        size_t p = 1;
+        while(p < n) p <<= 1;
+        return p;
+    }
+    struct Cell {
+        std::atomic< size_t > sequence;
+        T data;
+    };
+    enum { CACHE_LINE = 64 };
+    using Position = std::atomic< size_t >;
+private:
+    //positions are kept on separate cache lines through padding rather
+    //than alignas: operator new does not honour extended alignment before
+    //C++17
+    const size_t mask_;
+    std::unique_ptr< Cell[] > cells_;
+    char pad0_[CACHE_LINE];
+    Position enqueuePos_;
+    char pad1_[CACHE_LINE - sizeof(Position)];
+    Position dequeuePos_;
+    char pad2_[CACHE_LINE - sizeof(Position)];
+};
+}
@@ -0,0 +1,147 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Read-only memory mapped files: the mapping is passed straight to the
+//decompressors, no copy into a user buffer and no read syscalls.
+//MappedDirectory lists the JPEG files of a directory and maps them on
+//access.
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tjpp {
+class MappedFile {
+public:
+    MappedFile() : data_(nullptr), size_(0) {}
+    //sequential: tell the kernel the whole file is going to be read, pages
+    //are read ahead
+    explicit MappedFile(const std::string& path, bool sequential = true)
+        : path_(path), data_(nullptr), size_(0) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0) Error("Cannot open ");
+        struct stat st;
+        if(fstat(fd, &st) != 0) {
+            close(fd);
+            Error("Cannot stat ");
+        }
+        size_ = size_t(st.st_size);
+        if(size_ > 0) {
+            void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if(p == MAP_FAILED) Error("Cannot map ");
+            data_ = static_cast< unsigned char* >(p);
+            if(sequential) {
+                madvise(data_, size_, MADV_SEQUENTIAL);
+                madvise(data_, size_, MADV_WILLNEED);
+            }
+        } else {
+            close(fd);
+        }
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& f) : data_(nullptr), size_(0) {
+        Move(f);
+    }
+    MappedFile& operator=(MappedFile&& f) {
+        Unmap();
+        Move(f);
+        return *this;
+    }
+    const unsigned char* Data() const { return data_; }
+    size_t Size() const { return size_; }
+    bool Empty() const { return size_ == 0; }
+    const std::string& Path() const { return path_; }
+    ~MappedFile() {
+        Unmap();
+    }
+private:
+    void Error(const char* msg) const {
+        throw std::runtime_error(msg + path_ + ": " + std::strerror(errno));
+    }
+    void Unmap() {
+        if(data_) munmap(data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+    void Move(MappedFile& f) {
+        path_ = std::move(f.path_);
+        data_ = f.data_;
+        size_ = f.size_;
+        f.data_ = nullptr;
+        f.size_ = 0;
+    }
+private:
+    std::string path_;
+    unsigned char* data_;
+    size_t size_;
+};
+
+class MappedDirectory {
+public:
+    //regular files with one of the given extensions (case insensitive),
+    //sorted by name
+    explicit MappedDirectory(const std::string& dir,
+                             const std::vector< std::string >& extensions
+                                 = {".jpg", ".jpeg"}) {
+        DIR* d = opendir(dir.c_str());
+        if(!d)
+            throw std::runtime_error("Cannot open directory " + dir + ": "
+                                     + std::strerror(errno));
+        while(const dirent* e = readdir(d)) {
+            const std::string name = e->d_name;
+            if(!Matches(name, extensions)) continue;
+            const std::string path = dir + "/" + name;
+            struct stat st;
+            if(stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+                paths_.push_back(path);
+        }
+        closedir(d);
+        std::sort(paths_.begin(), paths_.end());
+    }
+    size_t Size() const { return paths_.size(); }
+    const std::string& Path(size_t i) const { return paths_[i]; }
+    MappedFile Map(size_t i, bool sequential = true) const {
+        return MappedFile(paths_[i], sequential);
+    }
+private:
+    static bool Matches(const std::string& name,
+                        const std::vector< std::string >& extensions) {
+        std::string n = name;
+        std::transform(n.begin(), n.end(), n.begin(), ::tolower);
+        for(auto& e: extensions) {
+            if(n.size() > e.size()
+               && n.compare(n.size() - e.size(), e.size(), e) == 0)
+                return true;
+        }
+        return false;
+    }
+private:
+    std::vector< std::string > paths_;
+};
+}
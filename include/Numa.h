@@ -0,0 +1,170 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+//NUMA topology and page placement without libnuma: nodes and their cpus
+//are read from sysfs, the node holding a page is queried through the
+//move_pages system call, which does not fault pages in. Machines without
+//NUMA information are reported as a single node holding all the cpus.
+//Node indices are in [0, NumNodes()) and do not need to match the kernel
+//node ids, which may have gaps.
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace tjpp {
+class NumaTopology {
+public:
+    static const NumaTopology& Get() {
+        static const NumaTopology topology;
+        return topology;
+    }
+    int NumNodes() const { return int(cpus_.size()); }
+    const std::vector< int >& Cpus(int node) const { return cpus_[node]; }
+    //node index of cpu, 0 if unknown
+    int NodeOfCpu(int cpu) const {
+        return cpu >= 0 && cpu < int(cpuNode_.size()) ? cpuNode_[cpu] : 0;
+    }
+    //node index of kernel node id, -1 if unknown
+    int NodeIndex(int id) const {
+        for(int n = 0; n != NumNodes(); ++n)
+            if(ids_[n] == id) return n;
+        return -1;
+    }
+    //cpus for n workers bound node by node: the first n / NumNodes()
+    //workers on node 0, the next ones on node 1...; consecutive workers
+    //share a node, so do the adjacent stripes they process
+    std::vector< int > WorkerCpus(int n) const {
+        std::vector< int > cpus;
+        const int nodes = NumNodes();
+        for(int node = 0; node != nodes; ++node) {
+            const int k = n / nodes + (node < n % nodes ? 1 : 0);
+            for(int i = 0; i != k; ++i)
+                cpus.push_back(cpus_[node][i % cpus_[node].size()]);
+        }
+        return cpus;
+    }
+private:
+    NumaTopology() {
+        for(int id = 0; ; ++id) {
+            std::ifstream is("/sys/devices/system/node/node"
+                             + std::to_string(id) + "/cpulist");
+            if(!is) {
+                //node ids may have gaps: stop after the last possible node
+                if(id >= MaxNodeId()) break;
+                continue;
+            }
+            std::string list;
+            std::getline(is, list);
+            const std::vector< int > cpus = ParseCpuList(list);
+            //memory only nodes have no cpus to bind workers to
+            if(cpus.empty()) continue;
+            ids_.push_back(id);
+            cpus_.push_back(cpus);
+        }
+        if(cpus_.empty()) {
+            ids_.assign(1, 0);
+            cpus_.resize(1);
+            const int n = std::max(1u, std::thread::hardware_concurrency());
+            for(int c = 0; c != n; ++c) cpus_[0].push_back(c);
+        }
+        for(int n = 0; n != NumNodes(); ++n) {
+            for(int c: cpus_[n]) {
+                if(c >= int(cpuNode_.size())) cpuNode_.resize(c + 1, 0);
+                cpuNode_[c] = n;
+            }
+        }
+    }
+    //highest node id from /sys/devices/system/node/possible, e.g. "0-3"
+    static int MaxNodeId() {
+        std::ifstream is("/sys/devices/system/node/possible");
+        std::string list;
+        if(!is || !std::getline(is, list)) return 0;
+        const std::vector< int > ids = ParseCpuList(list);
+        return ids.empty() ? 0 : ids.back();
+    }
+    //"0-3,8-11,16"
+    static std::vector< int > ParseCpuList(const std::string& list) {
+        std::vector< int > cpus;
+        std::istringstream is(list);
+        std::string range;
+        while(std::getline(is, range, ',')) {
+            if(range.empty()) continue;
+            const size_t dash = range.find('-');
+            const int first = std::stoi(range.substr(0, dash));
+            const int last = dash == std::string::npos
+                                 ? first : std::stoi(range.substr(dash + 1));
+            for(int c = first; c <= last; ++c) cpus.push_back(c);
+        }
+        return cpus;
+    }
+private:
+    std::vector< int > ids_;                //kernel node ids
+    std::vector< std::vector< int > > cpus_; //cpus of each node
+    std::vector< int > cpuNode_;            //node index of each cpu
+};
+
+//node index of the pages holding [p, p + size), one entry every stride
+//bytes; -1: page not present yet or placement unknown
+inline std::vector< int > PageNodes(const void* p, size_t size,
+                                    size_t stride = 4096) {
+    const size_t n = size ? (size - 1) / stride + 1 : 0;
+    std::vector< int > nodes(n, -1);
+#ifdef __linux__
+    enum { BATCH = 512 };
+    void* pages[BATCH];
+    int status[BATCH];
+    const NumaTopology& t = NumaTopology::Get();
+    for(size_t b = 0; b < n; b += BATCH) {
+        const size_t e = std::min(n, b + size_t(BATCH));
+        for(size_t i = b; i != e; ++i)
+            pages[i - b] = const_cast< char* >(
+                static_cast< const char* >(p) + i * stride);
+        //nodes = nullptr: report placement, do not move pages
+        if(syscall(SYS_move_pages, 0, e - b, pages, nullptr, status, 0) != 0)
+            break;
+        for(size_t i = b; i != e; ++i)
+            if(status[i - b] >= 0) nodes[i] = t.NodeIndex(status[i - b]);
+    }
+#else
+    (void) p;
+#endif
+    return nodes;
+}
+
+inline int PageNode(const void* p) {
+    return PageNodes(p, 1).front();
+}
+
+//node of the cpu running the calling thread
+inline int CurrentNode() {
+#ifdef __linux__
+    return NumaTopology::Get().NodeOfCpu(sched_getcpu());
+#else
+    return 0;
+#endif
+}
+}
@@ -0,0 +1,303 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Conversion between TurboJPEG pixel formats: channel reordering (RGB <-> BGR,
+//RGBX <-> XBGR...), adding and dropping the fourth channel, gray expansion
+//and gray conversion (libjpeg BT.601 weights).
+//Reordering kernels are byte shuffles: on x86 SSSE3 or AVX2, selected at run
+//time, on ARM NEON; scalar code handles the other cases and the row tails.
+//Padding channels (X) and alpha channels missing from the source are set to
+//255. CMYK can only be copied to CMYK.
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <turbojpeg.h>
+
+#include "ImageView.h"
+#include "Stripes.h"
+#include "WorkerPool.h"
+#include "pixelformat.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) \
+    && (defined(__GNUC__) || defined(__clang__))
+#define TJPP_X86_SIMD
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define TJPP_NEON
+#include <arm_neon.h>
+#endif
+
+namespace tjpp {
+
+class PixelConverter {
+public:
+    PixelConverter(TJPF from, TJPF to) : from_(from), to_(to) {
+        if(!Supported(from, to))
+            throw std::domain_error("Unsupported pixel format conversion "
+                                    + std::to_string(from) + " -> "
+                                    + std::to_string(to));
+        srcSize_ = NumComponents(from);
+        dstSize_ = NumComponents(to);
+        kind_ = from == to ? COPY : to == TJPF_GRAY ? LUMA : SHUFFLE;
+        //source channel copied into each destination channel, -1: 255
+        for(int c = 0; c != 4; ++c) channel_[c] = -1;
+        if(kind_ == SHUFFLE) {
+            const int* offsets[] = {tjRedOffset, tjGreenOffset, tjBlueOffset,
+                                    tjAlphaOffset};
+            for(int k = 0; k != 4; ++k) {
+                const int d = offsets[k][to];
+                if(d < 0) continue;
+                channel_[d] = from == TJPF_GRAY ? (k == 3 ? -1 : 0)
+                                                : offsets[k][from];
+            }
+        }
+        //shuffle masks for 16 byte vectors: pixels per vector limited by
+        //the larger of source and destination pixel size
+        pixelsPerVector_ = std::min(16 / srcSize_, 16 / dstSize_);
+        for(int j = 0; j != 16; ++j) {
+            const int p = j / dstSize_;
+            const int c = j % dstSize_;
+            mask_[j] = 0x80; //zero
+            fill_[j] = 0;
+            if(p >= pixelsPerVector_) continue;
+            if(channel_[c] < 0) fill_[j] = 0xFF;
+            else mask_[j] = (unsigned char)(p * srcSize_ + channel_[c]);
+        }
+    }
+    static bool Supported(TJPF from, TJPF to) {
+        if(from == to) return true;
+        return from != TJPF_CMYK && to != TJPF_CMYK;
+    }
+    TJPF From() const { return from_; }
+    TJPF To() const { return to_; }
+    //instruction set used for shuffles
+    static const char* Isa() {
+        switch(ShuffleIsa()) {
+        case AVX2: return "avx2";
+        case SSSE3: return "ssse3";
+        case NEON: return "neon";
+        default: return "scalar";
+        }
+    }
+    //width pixels; src and dst must not overlap
+    void ConvertRow(const unsigned char* src, unsigned char* dst,
+                    int width) const {
+        switch(kind_) {
+        case COPY:
+            std::memcpy(dst, src, size_t(width) * srcSize_);
+            break;
+        case LUMA:
+            LumaRow(src, dst, width);
+            break;
+        case SHUFFLE:
+            ShuffleRow(src, dst, width);
+            break;
+        }
+    }
+    //src and dst must have the same size and the converter formats
+    void Convert(const ImageView& src, const MutableImageView& dst) const {
+        Check(src, dst);
+        for(int y = 0; y != src.Height(); ++y)
+            ConvertRow(src.Row(y), dst.Row(y), src.Width());
+    }
+private:
+    enum Kind { COPY, LUMA, SHUFFLE };
+    enum Simd { SCALAR, SSSE3, AVX2, NEON };
+    void Check(const ImageView& src, const MutableImageView& dst) const {
+        if(src.PixelFormat() != from_ || dst.PixelFormat() != to_)
+            throw std::logic_error("Pixel format does not match converter");
+        if(src.Width() != dst.Width() || src.Height() != dst.Height())
+            throw std::logic_error("Source and destination size differ");
+    }
+    static Simd ShuffleIsa() {
+#if defined(TJPP_X86_SIMD)
+        static const Simd isa = __builtin_cpu_supports("avx2") ? AVX2
+                                : __builtin_cpu_supports("ssse3") ? SSSE3
+                                : SCALAR;
+        return isa;
+#elif defined(TJPP_NEON)
+        return NEON;
+#else
+        return SCALAR;
+#endif
+    }
+    void ShuffleRow(const unsigned char* src, unsigned char* dst,
+                    int width) const {
+        int i = 0;
+        switch(ShuffleIsa()) {
+#if defined(TJPP_X86_SIMD)
+        case AVX2:
+            i = ShuffleAVX2(src, dst, width);
+            break;
+        case SSSE3:
+            i = ShuffleSSSE3(src, dst, width, 0);
+            break;
+#endif
+#if defined(TJPP_NEON)
+        case NEON:
+            i = ShuffleNEON(src, dst, width);
+            break;
+#endif
+        default:
+            break;
+        }
+        ShuffleScalar(src, dst, width, i);
+    }
+    void ShuffleScalar(const unsigned char* src, unsigned char* dst,
+                       int width, int begin) const {
+        const unsigned char* s = src + size_t(begin) * srcSize_;
+        unsigned char* d = dst + size_t(begin) * dstSize_;
+        for(int i = begin; i != width; ++i) {
+            for(int c = 0; c != dstSize_; ++c)
+                d[c] = channel_[c] < 0 ? 0xFF : s[channel_[c]];
+            s += srcSize_;
+            d += dstSize_;
+        }
+    }
+    //Y = 0.299 R + 0.587 G + 0.114 B, 16 bit fixed point as in libjpeg
+    void LumaRow(const unsigned char* src, unsigned char* dst,
+                 int width) const {
+        const int r = tjRedOffset[from_];
+        const int g = tjGreenOffset[from_];
+        const int b = tjBlueOffset[from_];
+        for(int i = 0; i != width; ++i, src += srcSize_)
+            dst[i] = (unsigned char)((19595 * src[r] + 38470 * src[g]
+                                      + 7471 * src[b] + 32768) >> 16);
+    }
+#if defined(TJPP_X86_SIMD)
+    //returns number of converted pixels; loads and stores are 16 bytes
+    //wide, bytes past the converted pixels are rewritten by the next
+    //iteration or by the scalar tail
+    __attribute__((target("ssse3")))
+    int ShuffleSSSE3(const unsigned char* src, unsigned char* dst, int width,
+                     int begin) const {
+        const __m128i m = _mm_loadu_si128((const __m128i*) mask_);
+        const __m128i f = _mm_loadu_si128((const __m128i*) fill_);
+        const int p = pixelsPerVector_;
+        int i = begin;
+        while((width - i) * srcSize_ >= 16 && (width - i) * dstSize_ >= 16) {
+            const __m128i v =
+                _mm_loadu_si128((const __m128i*)(src + size_t(i) * srcSize_));
+            _mm_storeu_si128((__m128i*)(dst + size_t(i) * dstSize_),
+                             _mm_or_si128(_mm_shuffle_epi8(v, m), f));
+            i += p;
+        }
+        return i;
+    }
+    //two vectors per iteration, one per 128 bit lane
+    __attribute__((target("avx2")))
+    int ShuffleAVX2(const unsigned char* src, unsigned char* dst,
+                    int width) const {
+        const __m256i m = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i*) mask_));
+        const __m256i f = _mm256_broadcastsi128_si256(
+            _mm_loadu_si128((const __m128i*) fill_));
+        const int p = pixelsPerVector_;
+        int i = 0;
+        while((width - i - p) * srcSize_ >= 16
+              && (width - i - p) * dstSize_ >= 16) {
+            const unsigned char* s = src + size_t(i) * srcSize_;
+            unsigned char* d = dst + size_t(i) * dstSize_;
+            __m256i v = _mm256_castsi128_si256(
+                _mm_loadu_si128((const __m128i*) s));
+            v = _mm256_inserti128_si256(
+                v, _mm_loadu_si128((const __m128i*)(s + p * srcSize_)), 1);
+            v = _mm256_or_si256(_mm256_shuffle_epi8(v, m), f);
+            //low lane first: high lane overwrites the unused low lane bytes
+            _mm_storeu_si128((__m128i*) d, _mm256_castsi256_si128(v));
+            _mm_storeu_si128((__m128i*)(d + p * dstSize_),
+                             _mm256_extracti128_si256(v, 1));
+            i += 2 * p;
+        }
+        return ShuffleSSSE3(src, dst, width, i);
+    }
+#endif
+#if defined(TJPP_NEON)
+    //16 pixels per iteration, de-interleaving loads and interleaving stores
+    int ShuffleNEON(const unsigned char* src, unsigned char* dst,
+                    int width) const {
+        const uint8x16_t ff = vdupq_n_u8(0xFF);
+        int i = 0;
+        for(; i + 16 <= width; i += 16) {
+            const unsigned char* s = src + size_t(i) * srcSize_;
+            unsigned char* d = dst + size_t(i) * dstSize_;
+            uint8x16_t in[4];
+            if(srcSize_ == 1) {
+                in[0] = vld1q_u8(s);
+            } else if(srcSize_ == 3) {
+                const uint8x16x3_t v = vld3q_u8(s);
+                for(int c = 0; c != 3; ++c) in[c] = v.val[c];
+            } else {
+                const uint8x16x4_t v = vld4q_u8(s);
+                for(int c = 0; c != 4; ++c) in[c] = v.val[c];
+            }
+            if(dstSize_ == 3) {
+                uint8x16x3_t o;
+                for(int c = 0; c != 3; ++c)
+                    o.val[c] = channel_[c] < 0 ? ff : in[channel_[c]];
+                vst3q_u8(d, o);
+            } else {
+                uint8x16x4_t o;
+                for(int c = 0; c != 4; ++c)
+                    o.val[c] = channel_[c] < 0 ? ff : in[channel_[c]];
+                vst4q_u8(d, o);
+            }
+        }
+        return i;
+    }
+#endif
+private:
+    TJPF from_;
+    TJPF to_;
+    Kind kind_;
+    int srcSize_;
+    int dstSize_;
+    int channel_[4];
+    int pixelsPerVector_;
+    alignas(16) unsigned char mask_[16];
+    alignas(16) unsigned char fill_[16];
+};
+
+//convert src into dst, the two images must have the same size
+inline void ConvertPixels(const ImageView& src, const MutableImageView& dst) {
+    PixelConverter(src.PixelFormat(), dst.PixelFormat()).Convert(src, dst);
+}
+
+//parallel conversion: rows are split into stacks stripes, the same way
+//TJParallelCompressor splits images, each converted by a pool thread;
+//stacks <= 0: one stripe per thread
+inline void ConvertPixels(const ImageView& src, const MutableImageView& dst,
+                          WorkerPool& workers, int stacks = 0) {
+    const PixelConverter c(src.PixelFormat(), dst.PixelFormat());
+    if(src.Width() != dst.Width() || src.Height() != dst.Height())
+        throw std::logic_error("Source and destination size differ");
+    if(stacks <= 0) stacks = workers.NumThreads();
+    stacks = std::max(1, std::min(stacks, src.Height()));
+    const std::vector< int > heights = EvenStripes(src.Height(), stacks);
+    std::vector< int > rows(heights.size(), 0);
+    for(size_t i = 1; i < heights.size(); ++i)
+        rows[i] = rows[i - 1] + heights[i - 1];
+    workers.ParallelFor(heights.size(), 1, [&](size_t i, int) {
+        c.Convert(src.Rows(rows[i], heights[i]),
+                  dst.Rows(rows[i], heights[i]));
+    });
+}
+}
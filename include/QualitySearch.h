@@ -0,0 +1,102 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Search for the highest JPEG quality whose compressed size fits a byte
+//budget, assuming that the size grows with the quality.
+//The search keeps the interval (lo, hi) where lo is the highest quality
+//known to fit and hi the lowest quality known to exceed the budget; each
+//round proposes a number of qualities inside the interval, which can be
+//compressed in parallel, and shrinks it with the sizes reported.
+//The first round is a window around a starting guess, e.g. the quality
+//selected for the previous frame: when the content does not change much
+//the search ends after one round, or two when trying one quality per
+//round. While only one side of the guess is bounded the following rounds
+//move away from it with doubling steps, then the interval is bisected.
+
+#include <algorithm>
+#include <vector>
+
+namespace tjpp {
+class QualitySearch {
+public:
+    QualitySearch(size_t budget, int minQuality = 1, int maxQuality = 100)
+        : budget_(budget), minQuality_(minQuality), maxQuality_(maxQuality),
+          lo_(minQuality - 1), hi_(maxQuality + 1), rounds_(0), step_(1),
+          guided_(false) {}
+    //at most k qualities to try in the next round, empty when done;
+    //start: first guess, used in the first round only
+    const std::vector< int >& Candidates(int k, int start) {
+        candidates_.clear();
+        const int n = hi_ - lo_ - 1; //untested qualities left
+        k = std::max(1, std::min(k, n));
+        if(n <= 0) return candidates_;
+        if(rounds_ == 0 && start > lo_ && start < hi_) {
+            //consecutive qualities around start, start + 1 included when
+            //k > 1 to bracket the boundary in one round
+            const int b = std::max(lo_ + 1,
+                                   std::min(start - (k - 1) / 2, hi_ - k));
+            for(int i = 0; i != k; ++i) candidates_.push_back(b + i);
+            guided_ = true;
+        } else if(guided_ && (lo_ < minQuality_) != (hi_ > maxQuality_)) {
+            //moving away from the tested side
+            const bool up = lo_ >= minQuality_;
+            for(int i = 0; i != k; ++i) {
+                const int d = step_ * (i + 1);
+                const int q = std::max(lo_ + 1,
+                                       std::min(up ? lo_ + d : hi_ - d,
+                                                hi_ - 1));
+                if(candidates_.empty() || q != candidates_.back())
+                    candidates_.push_back(q);
+            }
+            step_ *= 2 * k;
+        } else {
+            //evenly spaced
+            for(int i = 0; i != k; ++i) {
+                const int q = lo_ + int((long(i) + 1) * (hi_ - lo_) / (k + 1));
+                if(candidates_.empty() || q != candidates_.back())
+                    candidates_.push_back(q);
+            }
+        }
+        ++rounds_;
+        return candidates_;
+    }
+    //size of the image compressed with quality q; returns true if it fits
+    bool Report(int q, size_t size) {
+        const bool fits = size <= budget_;
+        if(fits) lo_ = std::max(lo_, q);
+        else hi_ = std::min(hi_, q);
+        //non monotonic sizes: keep the interval consistent
+        if(hi_ <= lo_) hi_ = lo_ + 1;
+        return fits;
+    }
+    bool Done() const { return hi_ - lo_ <= 1; }
+    //highest fitting quality found, -1 if none
+    int Fitting() const { return lo_ >= minQuality_ ? lo_ : -1; }
+    int Rounds() const { return rounds_; }
+    size_t Budget() const { return budget_; }
+private:
+    size_t budget_;
+    int minQuality_;
+    int maxQuality_;
+    int lo_;
+    int hi_;
+    int rounds_;
+    int step_;    //distance of the next candidate from the tested side
+    bool guided_; //first round centered on the starting guess
+    std::vector< int > candidates_;
+};
+}
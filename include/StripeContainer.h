@@ -0,0 +1,259 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+//Container for the stripes of one image, e.g. a frame sent over the
+//network or stored in a single file:
+//  header   32 bytes: "TJPS", version, flags, number of stripes, width,
+//           height, pixel format, subsampling, quality, container size
+//  index    24 bytes per payload: offset from the beginning of the
+//           container, size, first row and number of rows of the stripe
+//  payloads contiguous; the tables-only stream of abbreviated stripes, if
+//           any, comes first
+//All integers are little endian. The writer builds the header and the
+//index and references the payloads in place: the container is written
+//with writev straight from the JPEGImage buffers. The reader validates
+//the header and index and wraps the payloads into non-owning JPEGImages,
+//which can be passed to TJParallelDeCompressor or decoded one at a time.
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <turbojpeg.h>
+
+#include <sys/uio.h>
+
+#include "JPEGFileWriter.h"
+#include "JPEGImage.h"
+
+namespace tjpp {
+
+struct StripeContainerFormat {
+    enum {
+        VERSION = 1,
+        HEADER_SIZE = 32,
+        ENTRY_SIZE = 24,
+        TABLES = 1 //flag: first payload is a tables-only stream
+    };
+    static const char* Magic() { return "TJPS"; }
+    static void Put(unsigned char* p, uint64_t v, int bytes) {
+        for(int i = 0; i != bytes; ++i) p[i] = (unsigned char)(v >> (8 * i));
+    }
+    static uint64_t Get(const unsigned char* p, int bytes) {
+        uint64_t v = 0;
+        for(int i = 0; i != bytes; ++i) v |= uint64_t(p[i]) << (8 * i);
+        return v;
+    }
+    //size of the container whose first HEADER_SIZE bytes are header,
+    //allows reading a container from a stream before parsing it
+    static size_t Size(const unsigned char* header) {
+        if(std::memcmp(header, Magic(), 4) != 0)
+            throw std::runtime_error("Not a stripe container");
+        return size_t(Get(header + 24, 8));
+    }
+};
+
+class StripeContainerWriter {
+public:
+    StripeContainerWriter() : size_(0) {}
+    //header, index and payload buffers in writing order; payloads are
+    //referenced, not copied, and must stay valid until written.
+    //Stripes are stacked top to bottom and have the same width;
+    //tables: tables-only stream of abbreviated stripes, nullptr if the
+    //stripes are complete streams
+    const std::vector< iovec >& Build(const std::vector< JPEGImage >& stripes,
+                                      const JPEGImage* tables = nullptr) {
+        using F = StripeContainerFormat;
+        if(stripes.empty()) throw std::logic_error("No stripes");
+        const size_t n = stripes.size() + (tables ? 1 : 0);
+        header_.resize(F::HEADER_SIZE + n * F::ENTRY_SIZE);
+        iov_.clear();
+        iov_.push_back(iovec{header_.data(), header_.size()});
+        unsigned char* e = header_.data() + F::HEADER_SIZE;
+        size_t offset = header_.size();
+        int height = 0;
+        auto add = [&](const JPEGImage& i, int y, int h) {
+            F::Put(e, offset, 8);
+            F::Put(e + 8, i.CompressedSize(), 8);
+            F::Put(e + 16, uint64_t(y), 4);
+            F::Put(e + 20, uint64_t(h), 4);
+            e += F::ENTRY_SIZE;
+            offset += i.CompressedSize();
+            iov_.push_back(iovec{const_cast< unsigned char* >(i.DataPtr()),
+                                 i.CompressedSize()});
+        };
+        if(tables) add(*tables, 0, 0);
+        for(auto& s: stripes) {
+            if(s.Width() != stripes.front().Width())
+                throw std::logic_error("Stripes have different widths");
+            add(s, height, s.Height());
+            height += s.Height();
+        }
+        const JPEGImage& first = stripes.front();
+        unsigned char* h = header_.data();
+        std::memcpy(h, F::Magic(), 4);
+        F::Put(h + 4, F::VERSION, 2);
+        F::Put(h + 6, tables ? F::TABLES : 0, 2);
+        F::Put(h + 8, stripes.size(), 4);
+        F::Put(h + 12, uint64_t(first.Width()), 4);
+        F::Put(h + 16, uint64_t(height), 4);
+        h[20] = (unsigned char)first.PixelFormat();
+        h[21] = (unsigned char)first.ChrominanceSubSampling();
+        h[22] = (unsigned char)first.Quality();
+        h[23] = 0;
+        F::Put(h + 24, offset, 8);
+        size_ = offset;
+        return iov_;
+    }
+    //size of the last built container
+    size_t Size() const { return size_; }
+    //build and write container to fd e.g. a socket, partial writes are
+    //resumed
+    void Write(int fd, const std::vector< JPEGImage >& stripes,
+               const JPEGImage* tables = nullptr) {
+        Build(stripes, tables);
+        if(!WriteAll(fd, iov_))
+            throw std::runtime_error(std::string("Cannot write stripe "
+                                                 "container: ")
+                                     + std::strerror(errno));
+    }
+private:
+    std::vector< unsigned char > header_;
+    std::vector< iovec > iov_;
+    size_t size_;
+};
+
+//read-only view of a container in memory, nothing is copied: the data
+//must outlive the view and the images returned by it
+class StripeContainerView {
+public:
+    StripeContainerView(const unsigned char* data, size_t size)
+        : data_(data), size_(size) {
+        using F = StripeContainerFormat;
+        if(size < F::HEADER_SIZE || F::Size(data) != size)
+            throw std::runtime_error("Truncated stripe container");
+        if(F::Get(data + 4, 2) != F::VERSION)
+            throw std::runtime_error("Unsupported stripe container version");
+        tables_ = (F::Get(data + 6, 2) & F::TABLES) != 0;
+        numStripes_ = int(F::Get(data + 8, 4));
+        const size_t n = size_t(numStripes_) + (tables_ ? 1 : 0);
+        if(numStripes_ < 1 || n > (size - F::HEADER_SIZE) / F::ENTRY_SIZE)
+            throw std::runtime_error("Invalid stripe container index");
+        //payloads must be inside the container and cover the image rows
+        int y = 0;
+        for(size_t i = 0; i != n; ++i) {
+            const unsigned char* e = Entry(i);
+            const uint64_t offset = F::Get(e, 8);
+            const uint64_t sz = F::Get(e + 8, 8);
+            if(offset < F::HEADER_SIZE + n * F::ENTRY_SIZE || offset > size
+               || sz > size - offset)
+                throw std::runtime_error("Invalid stripe container payload");
+            if(tables_ && i == 0) continue;
+            if(int(F::Get(e + 16, 4)) != y)
+                throw std::runtime_error("Invalid stripe container rows");
+            y += int(F::Get(e + 20, 4));
+        }
+        if(y != Height())
+            throw std::runtime_error("Invalid stripe container height");
+    }
+    int NumStripes() const { return numStripes_; }
+    int Width() const {
+        return int(StripeContainerFormat::Get(data_ + 12, 4));
+    }
+    int Height() const {
+        return int(StripeContainerFormat::Get(data_ + 16, 4));
+    }
+    TJPF PixelFormat() const { return TJPF(data_[20]); }
+    TJSAMP SubSampling() const { return TJSAMP(data_[21]); }
+    int Quality() const { return data_[22]; }
+    //stripes are abbreviated streams sharing the tables of Tables()
+    bool Abbreviated() const { return tables_; }
+    size_t Size() const { return size_; }
+    const unsigned char* StripeData(int i) const {
+        return data_ + StripeContainerFormat::Get(StripeEntry(i), 8);
+    }
+    size_t StripeSize(int i) const {
+        return size_t(StripeContainerFormat::Get(StripeEntry(i) + 8, 8));
+    }
+    int StripeY(int i) const {
+        return int(StripeContainerFormat::Get(StripeEntry(i) + 16, 4));
+    }
+    int StripeHeight(int i) const {
+        return int(StripeContainerFormat::Get(StripeEntry(i) + 20, 4));
+    }
+    //index of the stripe holding row y, binary search on the index
+    int StripeAt(int y) const {
+        if(y < 0 || y >= Height())
+            throw std::out_of_range("Row outside image");
+        int lo = 0;
+        int hi = numStripes_ - 1;
+        while(lo < hi) {
+            const int m = (lo + hi + 1) / 2;
+            if(StripeY(m) <= y) lo = m;
+            else hi = m - 1;
+        }
+        return lo;
+    }
+    //non-owning image referencing the payload of stripe i
+    JPEGImage Stripe(int i) const {
+        return Wrap(StripeData(i), StripeSize(i), StripeHeight(i));
+    }
+    //all the stripes, in the format expected by TJParallelDeCompressor;
+    //out is reused
+    void Stripes(std::vector< JPEGImage >& out) const {
+        out.resize(numStripes_);
+        for(int i = 0; i != numStripes_; ++i) out[i] = Stripe(i);
+    }
+    std::vector< JPEGImage > Stripes() const {
+        std::vector< JPEGImage > s;
+        Stripes(s);
+        return s;
+    }
+    //tables-only stream, empty image if the stripes are not abbreviated
+    JPEGImage Tables() const {
+        if(!tables_) return JPEGImage();
+        const unsigned char* e = Entry(0);
+        return Wrap(data_ + StripeContainerFormat::Get(e, 8),
+                    size_t(StripeContainerFormat::Get(e + 8, 8)), 0);
+    }
+private:
+    const unsigned char* Entry(size_t i) const {
+        return data_ + StripeContainerFormat::HEADER_SIZE
+               + i * StripeContainerFormat::ENTRY_SIZE;
+    }
+    const unsigned char* StripeEntry(int i) const {
+        if(i < 0 || i >= numStripes_)
+            throw std::out_of_range("Invalid stripe index "
+                                    + std::to_string(i));
+        return Entry(size_t(i) + (tables_ ? 1 : 0));
+    }
+    //decoders never write to the buffer of the images they read
+    JPEGImage Wrap(const unsigned char* p, size_t size, int height) const {
+        JPEGImage i(const_cast< unsigned char* >(p), size);
+        i.SetParams(Width(), height, PixelFormat(), SubSampling(),
+                    Quality());
+        i.SetCompressedSize(size);
+        return i;
+    }
+private:
+    const unsigned char* data_;
+    size_t size_;
+    bool tables_;
+    int numStripes_;
+};
+}
@@ -0,0 +1,205 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Partitioning of images into horizontal stripes
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <map>
+#include <tuple>
+#include <vector>
+#include <turbojpeg.h>
+
+#include "timing.h"
+
+namespace tjpp {
+
+//height / stacks rows per stripe, remainder added to the last stripe
+inline std::vector< int > EvenStripes(int height, int stacks) {
+    std::vector< int > heights(stacks, height / stacks);
+    heights.back() = height - (stacks - 1) * (height / stacks);
+    return heights;
+}
+
+//stripes with a height multiple of the MCU height for the given subsampling
+//except for the last one which receives the remainder; all the stripes but
+//the last have the same height. maxRows limits the number of MCU rows in
+//each stripe. The number of returned stripes can be less than stacks
+inline std::vector< int > MCUAlignedStripes(int height, int stacks, TJSAMP ss,
+                                            int maxRows = 0) {
+    const int mcuHeight = tjMCUHeight[ss];
+    const int mcuRows = (height + mcuHeight - 1) / mcuHeight;
+    int rows = (mcuRows + stacks - 1) / stacks;
+    if(maxRows > 0) rows = std::min(rows, maxRows);
+    rows = std::max(rows, 1);
+    const int h = rows * mcuHeight;
+    std::vector< int > heights;
+    for(int y = 0; y < height; y += h) heights.push_back(std::min(h, height - y));
+    return heights;
+}
+
+//stacks stripes cut on MCU row boundaries, MCU rows are distributed as
+//evenly as possible: stripe heights differ by at most one MCU row. The
+//number of returned stripes can be less than stacks for short images
+inline std::vector< int > BalancedMCUStripes(int height, int stacks,
+                                             TJSAMP ss) {
+    const int mcuHeight = tjMCUHeight[ss];
+    const int mcuRows = (height + mcuHeight - 1) / mcuHeight;
+    stacks = std::max(1, std::min(stacks, mcuRows));
+    std::vector< int > heights;
+    int y = 0;
+    for(int s = 0; s != stacks; ++s) {
+        const int rows = mcuRows / stacks + (s < mcuRows % stacks ? 1 : 0);
+        const int h = std::min(rows * mcuHeight, height - y);
+        heights.push_back(h);
+        y += h;
+    }
+    return heights;
+}
+
+//Selects the number of stripes for each image geometry.
+//The first guess comes from a cost model: each stripe should have at
+//least minStripePixels pixels, enough to amortize task dispatch and
+//per-stripe JPEG headers, and there is no point in having more stripes
+//than worker threads. The guess is then refined with the measured frame
+//times: once the current count has been timed, the neighbouring counts
+//are tried and the fastest one is kept; neighbours are timed again every
+//reprobeFrames frames to follow changes in load.
+class StripeTuner {
+public:
+    enum {
+        DEFAULT_MIN_STRIPE_PIXELS = 1 << 18,
+        SAMPLES = 3,          //frames timed for each candidate count
+        REPROBE_FRAMES = 256,
+        MAX_ENTRIES = 64      //geometries remembered
+    };
+    StripeTuner(int maxStripes,
+                int minStripePixels = DEFAULT_MIN_STRIPE_PIXELS,
+                int reprobeFrames = REPROBE_FRAMES)
+        : maxStripes_(std::max(1, maxStripes)),
+          minStripePixels_(std::max(1, minStripePixels)),
+          reprobeFrames_(reprobeFrames) {}
+    //stripe count for the next frame
+    int Stripes(int width, int height, TJSAMP ss) {
+        Entry& e = Get(width, height, ss);
+        return e.probe ? e.probe : e.best;
+    }
+    //report time taken to compress a frame with the given stripe count
+    void Update(int width, int height, TJSAMP ss, int stripes,
+                Duration elapsed) {
+        Entry& e = Get(width, height, ss);
+        if(stripes < 1 || stripes > e.maxStripes) return;
+        //the probed count could not be used, e.g. too few MCU rows for
+        //equal stripes: rule it out instead of waiting for its samples
+        if(e.probe && stripes != e.probe) {
+            e.samples[e.probe].count = SAMPLES;
+            e.samples[e.probe].time = std::numeric_limits< double >::max();
+        }
+        const double t = std::chrono::duration< double >(elapsed).count();
+        Sample& s = e.samples[stripes];
+        //exponential moving average, first sample taken as is
+        s.time = s.count ? 0.75 * s.time + 0.25 * t : t;
+        ++s.count;
+        ++e.frames;
+        if(e.probe) {
+            if(e.samples[e.probe].count < SAMPLES) return;
+            e.probe = NextProbe(e);
+            if(!e.probe) e.best = Fastest(e);
+        } else if(reprobeFrames_ > 0 && e.frames % reprobeFrames_ == 0) {
+            for(int n: Neighbours(e, e.best)) e.samples[n].count = 0;
+            e.probe = NextProbe(e);
+        }
+    }
+    //cost model estimate
+    int Model(int width, int height, TJSAMP ss) const {
+        const double pixels = double(width) * height;
+        const int mcuRows = (height + tjMCUHeight[ss] - 1) / tjMCUHeight[ss];
+        const int n = int(pixels / minStripePixels_);
+        return std::max(1, std::min(std::min(n, maxStripes_), mcuRows));
+    }
+    int MaxStripes() const { return maxStripes_; }
+private:
+    struct Sample {
+        Sample() : time(0), count(0) {}
+        double time; //seconds
+        int count;
+    };
+    struct Entry {
+        int best;
+        int probe; //stripe count being timed, 0: none
+        int maxStripes;
+        size_t frames;
+        std::vector< Sample > samples; //indexed by stripe count
+    };
+    using Key = std::tuple< int, int, int >;
+private:
+    Entry& Get(int width, int height, TJSAMP ss) {
+        const Key k(width, height, int(ss));
+        auto i = entries_.find(k);
+        if(i != entries_.end()) return i->second;
+        if(entries_.size() >= MAX_ENTRIES) entries_.clear();
+        Entry& e = entries_[k];
+        e.best = Model(width, height, ss);
+        e.probe = e.best;
+        e.maxStripes = std::min(maxStripes_,
+            (height + tjMCUHeight[ss] - 1) / tjMCUHeight[ss]);
+        e.frames = 0;
+        e.samples.resize(e.maxStripes + 1);
+        return e;
+    }
+    //counts around n: steps of about a quarter of n, at least one
+    std::vector< int > Neighbours(const Entry& e, int n) const {
+        const int step = std::max(1, n / 4);
+        std::vector< int > v;
+        if(n - step >= 1) v.push_back(n - step);
+        if(n + step <= e.maxStripes) v.push_back(n + step);
+        return v;
+    }
+    //untimed candidate among the current best and its neighbours, 0 if all
+    //have been timed
+    int NextProbe(Entry& e) const {
+        const int best = Fastest(e);
+        if(e.samples[best].count < SAMPLES) return best;
+        for(int n: Neighbours(e, best))
+            if(e.samples[n].count < SAMPLES) return n;
+        //moved to a neighbour: time its own neighbours
+        if(best != e.best) {
+            e.best = best;
+            return NextProbe(e);
+        }
+        return 0;
+    }
+    static int Fastest(const Entry& e) {
+        int best = e.best;
+        for(int n = 1; n <= e.maxStripes; ++n) {
+            const Sample& s = e.samples[n];
+            if(s.count >= SAMPLES
+               && (e.samples[best].count < SAMPLES
+                   || s.time < e.samples[best].time))
+                best = n;
+        }
+        return best;
+    }
+private:
+    int maxStripes_;
+    int minStripePixels_;
+    int reprobeFrames_;
+    std::map< Key, Entry > entries_;
+};
+
+}
@@ -0,0 +1,370 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Thin layer over the TurboJPEG API used by all the (de)compressors: built on
+//the TurboJPEG 3 functions (tj3*) when TJPP_TJ3 is defined, on the legacy
+//functions otherwise. The build defines TJPP_TJ3 when tj3Init is found in
+//the installed library.
+//Legacy TJFLAG_* flags are accepted by both versions and mapped to handle
+//parameters with TurboJPEG 3; parameters are set through TJHandle::Set, a
+//handle used with the same parameters for a whole session sets them once.
+//TurboJPEG 3 only: optimized Huffman tables and arithmetic coding
+//(TJPP_FLAG_*), 12-bit lossy and 16-bit lossless sample data.
+
+#include <cstddef>
+#include <stdexcept>
+#include <turbojpeg.h>
+
+#include "TJHandlePool.h"
+#include "pixelformat.h"
+
+namespace tjpp {
+
+enum {
+    //optimized Huffman tables: smaller images, slower compression
+    TJPP_FLAG_OPTIMIZE = 1 << 24,
+    //arithmetic entropy coding
+    TJPP_FLAG_ARITHMETIC = 1 << 25,
+    TJPP_TJ3_FLAGS = TJPP_FLAG_OPTIMIZE | TJPP_FLAG_ARITHMETIC
+};
+
+#ifdef TJPP_TJ3
+const bool TJPP_HAVE_TJ3 = true;
+#else
+const bool TJPP_HAVE_TJ3 = false;
+#endif
+
+struct TJHeader {
+    int width;
+    int height;
+    TJSAMP subSampling;
+    int colorSpace;
+    int precision; //bits per sample: 8, 12 or 16 (lossless)
+    bool lossless;
+};
+
+const tjscalingfactor TJ_UNSCALED = {1, 1};
+
+inline std::runtime_error TJError(const TJHandle& h) {
+    return std::runtime_error(TJHandlePool::ErrorStr(h.Get()));
+}
+
+#ifdef TJPP_TJ3
+//parameters applicable to all handle types
+inline void SetCommonParams(TJHandle& h, int flags) {
+    h.Set(TJPARAM_STOPONWARNING, (flags & TJFLAG_STOPONWARNING) != 0);
+    h.Set(TJPARAM_BOTTOMUP, (flags & TJFLAG_BOTTOMUP) != 0);
+    h.Set(TJPARAM_FASTDCT, (flags & TJFLAG_FASTDCT) != 0);
+}
+//entropy coding of compressed and transformed images; output buffers are
+//always large enough
+inline void SetEncodingParams(TJHandle& h, int flags) {
+    h.Set(TJPARAM_NOREALLOC, 1);
+    h.Set(TJPARAM_PROGRESSIVE, (flags & TJFLAG_PROGRESSIVE) != 0);
+    h.Set(TJPARAM_OPTIMIZE, (flags & TJPP_FLAG_OPTIMIZE) != 0);
+    h.Set(TJPARAM_ARITHMETIC, (flags & TJPP_FLAG_ARITHMETIC) != 0);
+}
+inline void SetCompressParams(TJHandle& h, TJSAMP ss, int quality,
+                              int flags) {
+    SetCommonParams(h, flags);
+    SetEncodingParams(h, flags);
+    h.Set(TJPARAM_LOSSLESS, 0);
+    h.Set(TJPARAM_QUALITY, quality);
+    h.Set(TJPARAM_SUBSAMP, ss);
+}
+inline void SetDecompressParams(TJHandle& h, int flags,
+                                const tjscalingfactor& sf) {
+    SetCommonParams(h, flags);
+    h.Set(TJPARAM_FASTUPSAMPLE, (flags & TJFLAG_FASTUPSAMPLE) != 0);
+    h.Set(TJPARAM_SCANLIMIT, flags & TJFLAG_LIMITSCANS ? 500 : 0);
+    if(tj3SetScalingFactor(h.Get(), sf)) throw TJError(h);
+}
+//tj3 functions write an image of the size in the header: check that the
+//image scaled by sf fits into the width x height output, whose size comes
+//from metadata which may not match the stream
+inline void CheckOutputSize(TJHandle& h,
+                            const unsigned char* jpgImg,
+                            size_t size,
+                            int width,
+                            int height,
+                            const tjscalingfactor& sf) {
+    if(tj3DecompressHeader(h.Get(), jpgImg, size)) throw TJError(h);
+    if(TJSCALED(tj3Get(h.Get(), TJPARAM_JPEGWIDTH), sf) > width
+       || TJSCALED(tj3Get(h.Get(), TJPARAM_JPEGHEIGHT), sf) > height)
+        throw std::logic_error("Output smaller than image");
+}
+#else
+//legacy flags, TurboJPEG 3 only flags are rejected
+inline int LegacyFlags(int flags) {
+    if(flags & TJPP_TJ3_FLAGS)
+        throw std::logic_error("Optimized Huffman tables and arithmetic "
+                               "coding require TurboJPEG 3");
+    return flags;
+}
+#endif
+
+//compress into dst, returns the compressed size; bufferSize must be at
+//least tjBufSize
+inline size_t TJCompress(TJHandle& h,
+                         const unsigned char* src,
+                         int width,
+                         int pitch,
+                         int height,
+                         TJPF pf,
+                         unsigned char* dst,
+                         size_t bufferSize,
+                         TJSAMP ss,
+                         int quality,
+                         int flags) {
+#ifdef TJPP_TJ3
+    SetCompressParams(h, ss, quality, flags);
+    size_t jpegSize = bufferSize;
+    if(tj3Compress8(h.Get(), src, width, pitch, height, pf, &dst, &jpegSize))
+        throw TJError(h);
+#else
+    unsigned long jpegSize = bufferSize;
+    if(tjCompress2(h.Get(), src, width, pitch, height, pf, &dst, &jpegSize,
+                   ss, quality, LegacyFlags(flags) | TJFLAG_NOREALLOC))
+        throw TJError(h);
+#endif
+    return jpegSize;
+}
+
+//compress planar YUV, no color conversion
+inline size_t TJCompressFromYUV(TJHandle& h,
+                                const unsigned char** planes,
+                                int width,
+                                const int* strides,
+                                int height,
+                                TJSAMP ss,
+                                unsigned char* dst,
+                                size_t bufferSize,
+                                int quality,
+                                int flags) {
+#ifdef TJPP_TJ3
+    SetCompressParams(h, ss, quality, flags);
+    size_t jpegSize = bufferSize;
+    if(tj3CompressFromYUVPlanes8(h.Get(), planes, width, strides, height,
+                                 &dst, &jpegSize))
+        throw TJError(h);
+#else
+    unsigned long jpegSize = bufferSize;
+    if(tjCompressFromYUVPlanes(h.Get(), planes, width, strides, height, ss,
+                               &dst, &jpegSize, quality,
+                               LegacyFlags(flags) | TJFLAG_NOREALLOC))
+        throw TJError(h);
+#endif
+    return jpegSize;
+}
+
+inline TJHeader TJDecompressHeader(TJHandle& h,
+                                   const unsigned char* jpgImg,
+                                   size_t size) {
+    TJHeader hd;
+#ifdef TJPP_TJ3
+    if(tj3DecompressHeader(h.Get(), jpgImg, size)) throw TJError(h);
+    hd.width = tj3Get(h.Get(), TJPARAM_JPEGWIDTH);
+    hd.height = tj3Get(h.Get(), TJPARAM_JPEGHEIGHT);
+    hd.subSampling = TJSAMP(tj3Get(h.Get(), TJPARAM_SUBSAMP));
+    hd.colorSpace = tj3Get(h.Get(), TJPARAM_COLORSPACE);
+    hd.precision = tj3Get(h.Get(), TJPARAM_PRECISION);
+    hd.lossless = tj3Get(h.Get(), TJPARAM_LOSSLESS) == 1;
+#else
+    int ss = -1;
+    hd.width = -1;
+    hd.height = -1;
+    hd.colorSpace = -1;
+    if(tjDecompressHeader3(h.Get(), jpgImg, size, &hd.width, &hd.height, &ss,
+                           &hd.colorSpace))
+        throw TJError(h);
+    hd.subSampling = TJSAMP(ss);
+    hd.precision = 8;
+    hd.lossless = false;
+#endif
+    return hd;
+}
+
+//decompress into dst; width x height: size of the output image, scaled by
+//sf, which must be one of the library scaling factors; throws if the image
+//in the stream does not fit
+inline void TJDecompress(TJHandle& h,
+                         const unsigned char* jpgImg,
+                         size_t size,
+                         unsigned char* dst,
+                         int width,
+                         int pitch,
+                         int height,
+                         TJPF pf,
+                         int flags,
+                         const tjscalingfactor& sf = TJ_UNSCALED) {
+#ifdef TJPP_TJ3
+    SetDecompressParams(h, flags, sf);
+    CheckOutputSize(h, jpgImg, size, width, height, sf);
+    if(tj3Decompress8(h.Get(), jpgImg, size, dst, pitch, pf))
+        throw TJError(h);
+#else
+    //scaling factor is selected from the requested size
+    (void) sf;
+    if(tjDecompress2(h.Get(), jpgImg, size, dst, width, pitch, height, pf,
+                     LegacyFlags(flags)))
+        throw TJError(h);
+#endif
+}
+
+//scaling factors supported by the library
+inline const tjscalingfactor* TJScalingFactors(int& n) {
+#ifdef TJPP_TJ3
+    const tjscalingfactor* sf = tj3GetScalingFactors(&n);
+#else
+    const tjscalingfactor* sf = tjGetScalingFactors(&n);
+#endif
+    if(!sf) throw std::runtime_error(TJHandlePool::ErrorStr(nullptr));
+    return sf;
+}
+
+//planar YUV output, planes must match image size and subsampling; throws
+//if the image in the stream is larger than width x height
+inline void TJDecompressToYUV(TJHandle& h,
+                              const unsigned char* jpgImg,
+                              size_t size,
+                              unsigned char** planes,
+                              int width,
+                              int* strides,
+                              int height,
+                              int flags) {
+#ifdef TJPP_TJ3
+    SetDecompressParams(h, flags, TJ_UNSCALED);
+    CheckOutputSize(h, jpgImg, size, width, height, TJ_UNSCALED);
+    if(tj3DecompressToYUVPlanes8(h.Get(), jpgImg, size, planes, strides))
+        throw TJError(h);
+#else
+    if(tjDecompressToYUVPlanes(h.Get(), jpgImg, size, planes, width, strides,
+                               height, LegacyFlags(flags)))
+        throw TJError(h);
+#endif
+}
+
+//lossless transform into dst, returns the transformed size
+inline size_t TJTransform(TJHandle& h,
+                          const unsigned char* jpgImg,
+                          size_t size,
+                          unsigned char* dst,
+                          size_t bufferSize,
+                          const tjtransform& t,
+                          int flags) {
+    tjtransform tr = t;
+#ifdef TJPP_TJ3
+    SetCommonParams(h, flags);
+    SetEncodingParams(h, flags);
+    h.Set(TJPARAM_SCANLIMIT, flags & TJFLAG_LIMITSCANS ? 500 : 0);
+    size_t jpegSize = bufferSize;
+    if(tj3Transform(h.Get(), jpgImg, size, 1, &dst, &jpegSize, &tr))
+        throw TJError(h);
+#else
+    unsigned long jpegSize = bufferSize;
+    if(tjTransform(h.Get(), jpgImg, size, 1, &dst, &jpegSize, &tr,
+                   LegacyFlags(flags) | TJFLAG_NOREALLOC))
+        throw TJError(h);
+#endif
+    return jpegSize;
+}
+
+//worst case size of a compressed image with precision bits per sample:
+//twice tjBufSize for 12-bit lossy images; in lossless images a Huffman code
+//and its additional bits take at most 32 bits per sample
+inline size_t TJBufSize(int width, int height, TJSAMP ss, TJPF pf,
+                        int precision = 8, bool lossless = false) {
+    const size_t headers = 2048;
+    if(lossless)
+        return 4 * size_t(width) * height * NumComponents(pf) + headers;
+    const size_t s = tjBufSize(width, height, ss);
+    return precision > 8 ? 2 * s : s;
+}
+
+#ifdef TJPP_TJ3
+//12-bit lossy compression, samples in [0, 4095]; pitch in samples
+inline size_t TJCompress12(TJHandle& h,
+                           const short* src,
+                           int width,
+                           int pitch,
+                           int height,
+                           TJPF pf,
+                           unsigned char* dst,
+                           size_t bufferSize,
+                           TJSAMP ss,
+                           int quality,
+                           int flags) {
+    SetCompressParams(h, ss, quality, flags);
+    size_t jpegSize = bufferSize;
+    if(tj3Compress12(h.Get(), src, width, pitch, height, pf, &dst,
+                     &jpegSize))
+        throw TJError(h);
+    return jpegSize;
+}
+//16-bit lossless compression; psv: predictor (1-7), pt: point transform,
+//number of low order bits discarded; pitch in samples
+inline size_t TJCompress16(TJHandle& h,
+                           const unsigned short* src,
+                           int width,
+                           int pitch,
+                           int height,
+                           TJPF pf,
+                           unsigned char* dst,
+                           size_t bufferSize,
+                           TJSAMP ss,
+                           int psv,
+                           int pt,
+                           int flags) {
+    SetCommonParams(h, flags);
+    SetEncodingParams(h, flags);
+    //not used in lossless mode but persistent: do not keep the subsampling
+    //of a previous compression
+    h.Set(TJPARAM_SUBSAMP, ss);
+    h.Set(TJPARAM_LOSSLESS, 1);
+    h.Set(TJPARAM_LOSSLESSPSV, psv);
+    h.Set(TJPARAM_LOSSLESSPT, pt);
+    size_t jpegSize = bufferSize;
+    if(tj3Compress16(h.Get(), src, width, pitch, height, pf, &dst,
+                     &jpegSize))
+        throw TJError(h);
+    return jpegSize;
+}
+//pitch in samples
+inline void TJDecompress12(TJHandle& h,
+                           const unsigned char* jpgImg,
+                           size_t size,
+                           short* dst,
+                           int pitch,
+                           TJPF pf,
+                           int flags) {
+    SetDecompressParams(h, flags, TJ_UNSCALED);
+    if(tj3Decompress12(h.Get(), jpgImg, size, dst, pitch, pf))
+        throw TJError(h);
+}
+inline void TJDecompress16(TJHandle& h,
+                           const unsigned char* jpgImg,
+                           size_t size,
+                           unsigned short* dst,
+                           int pitch,
+                           TJPF pf,
+                           int flags) {
+    SetDecompressParams(h, flags, TJ_UNSCALED);
+    if(tj3Decompress16(h.Get(), jpgImg, size, dst, pitch, pf))
+        throw TJError(h);
+}
+#endif
+}
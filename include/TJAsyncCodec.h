@@ -0,0 +1,241 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Asynchronous compression and decompression: calls return immediately and
+//the work runs on a WorkerPool which can be shared with other objects, a
+//single thread can keep any number of operations in flight.
+//Completion is delivered in one of three ways, selected by the last
+//argument:
+//  - none: a std::future is returned
+//  - a Completion callback: called on the worker thread with the result or
+//    the exception thrown by the operation
+//  - UseAwaitable(): an object which can be co_await'ed (C++20), the
+//    coroutine is resumed on the worker thread
+//Input data (pixels or JPEG bytes) is not copied and must stay valid until
+//the operation completes. Callbacks and resumed coroutines run on the
+//workers: they should not block.
+//The destructor waits for the operations in flight. An operation is in
+//flight until its callback returns or its coroutine suspends again, so the
+//codec must not be destroyed from a callback or a resumed coroutine: the
+//destructor would wait for itself and deadlock.
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <turbojpeg.h>
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __cpp_impl_coroutine >= 201902L && __has_include(<coroutine>)
+#include <coroutine>
+#define TJPP_COROUTINES
+#endif
+#endif
+
+#include "Image.h"
+#include "ImageView.h"
+#include "JPEGImage.h"
+#include "TJCompressor.h"
+#include "TJDeCompressor.h"
+#include "WorkerPool.h"
+
+namespace tjpp {
+
+template < typename T >
+using Completion = std::function< void (T&&, std::exception_ptr) >;
+
+//selects the awaitable overloads
+struct UseAwaitable {};
+
+#ifdef TJPP_COROUTINES
+//starts the operation when awaited, the result is moved out on resumption
+//and exceptions are rethrown
+template < typename T >
+class Awaitable {
+public:
+    using Start = std::function< void (Completion< T >) >;
+    explicit Awaitable(Start start) : start_(std::move(start)) {}
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+        //the coroutine, and this object with it, can be resumed and
+        //destroyed before start returns: nothing is accessed afterwards
+        Start start = std::move(start_);
+        start([this, h](T&& r, std::exception_ptr e) {
+            result_ = std::move(r);
+            error_ = e;
+            h.resume();
+        });
+    }
+    T await_resume() {
+        if(error_) std::rethrow_exception(error_);
+        return std::move(result_);
+    }
+private:
+    Start start_;
+    T result_;
+    std::exception_ptr error_;
+};
+#endif
+
+class TJAsyncCodec {
+public:
+    //private executor; numThreads <= 0: one thread per hardware thread
+    TJAsyncCodec(int numThreads = 0, bool pinThreads = false)
+        : TJAsyncCodec(std::make_shared< WorkerPool >(numThreads,
+                                                      pinThreads)) {}
+    //shared executor
+    explicit TJAsyncCodec(std::shared_ptr< WorkerPool > executor)
+        : executor_(std::move(executor)),
+          compressors_(executor_->NumThreads()),
+          decompressors_(executor_->NumThreads()), pending_(0) {}
+    TJAsyncCodec(const TJAsyncCodec&) = delete;
+    TJAsyncCodec& operator=(const TJAsyncCodec&) = delete;
+
+    std::future< JPEGImage > CompressAsync(const ImageView& view,
+                                           TJSAMP ss,
+                                           int quality,
+                                           int flags = TJFLAG_FASTDCT) {
+        return Future< JPEGImage >(CompressWork(view, ss, quality, flags));
+    }
+    void CompressAsync(const ImageView& view,
+                       TJSAMP ss,
+                       int quality,
+                       int flags,
+                       Completion< JPEGImage > done) {
+        Run< JPEGImage >(CompressWork(view, ss, quality, flags),
+                         std::move(done));
+    }
+    std::future< Image > DeCompressAsync(const unsigned char* jpgImg,
+                                         size_t size,
+                                         TJPF pf,
+                                         int flags = TJFLAG_FASTDCT) {
+        return Future< Image >(DeCompressWork(jpgImg, size, pf, flags));
+    }
+    void DeCompressAsync(const unsigned char* jpgImg,
+                         size_t size,
+                         TJPF pf,
+                         int flags,
+                         Completion< Image > done) {
+        Run< Image >(DeCompressWork(jpgImg, size, pf, flags),
+                     std::move(done));
+    }
+#ifdef TJPP_COROUTINES
+    Awaitable< JPEGImage > CompressAsync(const ImageView& view,
+                                         TJSAMP ss,
+                                         int quality,
+                                         int flags,
+                                         UseAwaitable) {
+        return Await< JPEGImage >(CompressWork(view, ss, quality, flags));
+    }
+    Awaitable< Image > DeCompressAsync(const unsigned char* jpgImg,
+                                       size_t size,
+                                       TJPF pf,
+                                       int flags,
+                                       UseAwaitable) {
+        return Await< Image >(DeCompressWork(jpgImg, size, pf, flags));
+    }
+#endif
+    //operations submitted and not yet completed
+    size_t Pending() const {
+        std::lock_guard< std::mutex > guard(mutex_);
+        return pending_;
+    }
+    std::shared_ptr< WorkerPool > Executor() const { return executor_; }
+    ~TJAsyncCodec() {
+        std::unique_lock< std::mutex > lock(mutex_);
+        idle_.wait(lock, [this]{ return pending_ == 0; });
+    }
+private:
+    //operation run by worker w
+    template < typename T >
+    using Work = std::function< T (int w) >;
+    //decrements the pending count once the completion has been delivered,
+    //even if the callback throws
+    struct Done {
+        TJAsyncCodec* codec;
+        ~Done() {
+            std::lock_guard< std::mutex > guard(codec->mutex_);
+            if(--codec->pending_ == 0) codec->idle_.notify_all();
+        }
+    };
+private:
+    Work< JPEGImage > CompressWork(const ImageView& view,
+                                   TJSAMP ss,
+                                   int quality,
+                                   int flags) {
+        return [this, view, ss, quality, flags](int w) {
+            return compressors_[w].Compress(view, ss, quality, flags);
+        };
+    }
+    Work< Image > DeCompressWork(const unsigned char* jpgImg,
+                                 size_t size,
+                                 TJPF pf,
+                                 int flags) {
+        return [this, jpgImg, size, pf, flags](int w) {
+            return decompressors_[w].DeCompress(jpgImg, size, pf, flags);
+        };
+    }
+    template < typename T >
+    void Run(Work< T > work, Completion< T > done) {
+        {
+            std::lock_guard< std::mutex > guard(mutex_);
+            ++pending_;
+        }
+        executor_->Submit([this, work, done]() {
+            Done d = {this};
+            T result;
+            std::exception_ptr error;
+            try {
+                result = work(executor_->CurrentWorker());
+            } catch(...) {
+                error = std::current_exception();
+            }
+            done(std::move(result), error);
+        });
+    }
+    template < typename T >
+    std::future< T > Future(Work< T > work) {
+        auto p = std::make_shared< std::promise< T > >();
+        std::future< T > f = p->get_future();
+        Run< T >(std::move(work), [p](T&& r, std::exception_ptr e) {
+            if(e) p->set_exception(e);
+            else p->set_value(std::move(r));
+        });
+        return f;
+    }
+#ifdef TJPP_COROUTINES
+    template < typename T >
+    Awaitable< T > Await(Work< T > work) {
+        return Awaitable< T >([this, work](Completion< T > done) {
+            Run< T >(work, std::move(done));
+        });
+    }
+#endif
+private:
+    std::shared_ptr< WorkerPool > executor_;
+    //one per worker thread, indexed by worker id
+    std::vector< TJCompressor > compressors_;
+    std::vector< TJDeCompressor > decompressors_;
+    mutable std::mutex mutex_;
+    std::condition_variable idle_;
+    size_t pending_;
+};
+}
@@ -0,0 +1,83 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Compression of many independent images: whole images are spread across a
+//fixed set of compressor handles, one per worker thread, idle workers steal
+//images from busy ones. Meant for large numbers of small images (thumbnails,
+//dataset conversion) where splitting each image into stripes is too fine
+//grained.
+//Compressed images are written into buffers taken from a JPEGBufferPool.
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <turbojpeg.h>
+
+#include "ImageView.h"
+#include "JPEGBufferPool.h"
+#include "JPEGImage.h"
+#include "TJHandlePool.h"
+#include "WorkerPool.h"
+#include "timing.h"
+
+namespace tjpp {
+class TJBatchCompressor {
+public:
+    //numThreads <= 0: one thread per hardware thread
+    TJBatchCompressor(int numThreads = 0,
+                      bool pinThreads = false,
+                      std::shared_ptr< JPEGBufferPool > pool
+                          = std::shared_ptr< JPEGBufferPool >())
+        : pool_(pool ? pool : std::make_shared< JPEGBufferPool >()),
+          workers_(numThreads, pinThreads) {
+        handles_.resize(workers_.NumThreads());
+        for(auto& h: handles_) h = TJHandle(TJ_COMPRESS);
+    }
+    TJBatchCompressor(const TJBatchCompressor&) = delete;
+    TJBatchCompressor& operator=(const TJBatchCompressor&) = delete;
+    //compress n images, output i is the compressed version of views[i];
+    //grain: images per task, 0 = automatic
+    std::vector< PooledJPEGImage > CompressBatch(const ImageView* views,
+                                                 size_t n,
+                                                 TJSAMP ss,
+                                                 int quality,
+                                                 int flags = TJFLAG_FASTDCT,
+                                                 size_t grain = 0) {
+        std::vector< PooledJPEGImage > out(n);
+        workers_.ParallelFor(n, grain, [&](size_t i, int w) {
+            out[i] = CompressPooled(pool_, handles_[w], views[i], ss, quality,
+                                    flags);
+        });
+        return out;
+    }
+    std::vector< PooledJPEGImage > CompressBatch(
+        const std::vector< ImageView >& views,
+        TJSAMP ss,
+        int quality,
+        int flags = TJFLAG_FASTDCT,
+        size_t grain = 0) {
+        return CompressBatch(views.data(), views.size(), ss, quality, flags,
+                             grain);
+    }
+    int NumThreads() const { return workers_.NumThreads(); }
+    std::shared_ptr< JPEGBufferPool > Pool() const { return pool_; }
+private:
+    std::shared_ptr< JPEGBufferPool > pool_;
+    std::vector< TJHandle > handles_;
+    WorkerPool workers_; //destroyed first: no task uses handles afterwards
+};
+}
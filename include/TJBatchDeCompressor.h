@@ -0,0 +1,109 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Decompression of many independent images: whole images are spread across
+//a fixed set of decompressor handles, one per worker thread, idle workers
+//steal images from busy ones.
+
+#include <stdexcept>
+#include <vector>
+#include <turbojpeg.h>
+
+#include "Image.h"
+#include "JPEGImage.h"
+#include "TJApi.h"
+#include "TJHandlePool.h"
+#include "WorkerPool.h"
+#include "timing.h"
+
+namespace tjpp {
+class TJBatchDeCompressor {
+public:
+    //numThreads <= 0: one thread per hardware thread
+    TJBatchDeCompressor(int numThreads = 0, bool pinThreads = false)
+        : workers_(numThreads, pinThreads) {
+        handles_.resize(workers_.NumThreads());
+        for(auto& h: handles_) h = TJHandle(TJ_DECOMPRESS);
+    }
+    TJBatchDeCompressor(const TJBatchDeCompressor&) = delete;
+    TJBatchDeCompressor& operator=(const TJBatchDeCompressor&) = delete;
+    //decompress n images, output i is the decompressed version of
+    //jpgImgs[i]; JPEGImageT is JPEGImage or PooledJPEGImage
+    //grain: images per task, 0 = automatic
+    template < typename JPEGImageT >
+    std::vector< Image > DeCompressBatch(const JPEGImageT* jpgImgs,
+                                         size_t n,
+                                         TJPF pf,
+                                         int flags = TJFLAG_FASTDCT,
+                                         size_t grain = 0) {
+        return DeCompressBatch(std::vector< Image >(), jpgImgs, n, pf, flags,
+                               grain);
+    }
+    template < typename JPEGImageT >
+    std::vector< Image > DeCompressBatch(
+        const std::vector< JPEGImageT >& jpgImgs,
+        TJPF pf,
+        int flags = TJFLAG_FASTDCT,
+        size_t grain = 0) {
+        return DeCompressBatch(jpgImgs.data(), jpgImgs.size(), pf, flags,
+                               grain);
+    }
+    //reuse images: buffers of recycled images are only reallocated when
+    //smaller than the decompressed image
+    template < typename JPEGImageT >
+    std::vector< Image > DeCompressBatch(std::vector< Image >&& recycled,
+                                         const JPEGImageT* jpgImgs,
+                                         size_t n,
+                                         TJPF pf,
+                                         int flags = TJFLAG_FASTDCT,
+                                         size_t grain = 0) {
+        std::vector< Image > out(std::move(recycled));
+        out.resize(n);
+        workers_.ParallelFor(n, grain, [&](size_t i, int w) {
+            const JPEGImage& j = jpgImgs[i];
+            DeCompress(handles_[w], j.DataPtr(), j.CompressedSize(), pf,
+                       flags, out[i]);
+        });
+        return out;
+    }
+    int NumThreads() const { return workers_.NumThreads(); }
+private:
+    static void DeCompress(TJHandle& h,
+                           const unsigned char* jpgImg,
+                           size_t size,
+                           TJPF pf,
+                           int flags,
+                           Image& out) {
+        const TJHeader hd = TJDecompressHeader(h, jpgImg, size);
+        out.SetParameters(hd.width, hd.height, pf);
+        if(out.AllocatedSize() < out.Size()) out.Allocate(out.Size());
+#ifdef TIMING__
+        const Time begin = Tick();
+#endif
+        TJDecompress(h, jpgImg, size, out.DataPtr(), hd.width, 0, hd.height,
+                     pf, flags);
+#ifdef TIMING__
+        Metrics::Record(Metrics::DECOMPRESS_NS, Tick() - begin);
+        Metrics::Add(Metrics::DECOMPRESS_BYTES_IN, size);
+        Metrics::Add(Metrics::DECOMPRESS_BYTES_OUT, out.Size());
+#endif
+    }
+private:
+    std::vector< TJHandle > handles_;
+    WorkerPool workers_; //destroyed first: no task uses handles afterwards
+};
+}
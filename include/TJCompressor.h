@@ -17,18 +17,39 @@
 
 //ADD:
 // flag support
-// pitch: useful to e.g. split and compress in parallel 4k images
 
+#include <utility>
 #include <turbojpeg.h>
 
+#include "Image.h"
+#include "ImageView.h"
 #include "JPEGImage.h"
+#include "PixelConversion.h"
+#include "TJApi.h"
+#include "TJHandlePool.h"
+#include "YUVImage.h"
 #include "timing.h"
 
 namespace tjpp {
+//Compressed images are returned by move and owned by the caller, they are
+//written into a buffer sized with tjBufSize using TJFLAG_NOREALLOC. To avoid
+//allocations pass back a previously returned image or a JPEGImage wrapping
+//a caller provided buffer to the recycling overloads
 class TJCompressor {
 public:
     TJCompressor() :
-        tjCompressor_(tjInitCompress()) {}
+        tjCompressor_(TJ_COMPRESS) {}
+    TJCompressor(const TJCompressor&) = delete;
+    TJCompressor& operator=(const TJCompressor&) = delete;
+    TJCompressor(TJCompressor&& c) :
+        img_(std::move(c.img_)), converted_(std::move(c.converted_)),
+        tjCompressor_(std::move(c.tjCompressor_)) {}
+    TJCompressor& operator=(TJCompressor&& c) {
+        std::swap(img_, c.img_);
+        std::swap(converted_, c.converted_);
+        std::swap(tjCompressor_, c.tjCompressor_);
+        return *this;
+    }
     JPEGImage Compress(const unsigned char* img,
                        int width,
                        int height,
@@ -38,28 +59,23 @@ public:
                        int offset = 0,
                        int flags = TJFLAG_FASTDCT,
                        int pitch = 0) {
-        if(img_.Empty()
-            || tjBufSize(width, height, ss) > img_.BufferSize()) {
-            img_.Reset(width, height, pf, ss, quality);
-        }
-        img_.SetParams(width, height, pf, ss, quality);
-        size_t jpegSize = int(UncompressedSize(img_));
-        unsigned char* ptr = img_.DataPtr();
+        img_.Reset(width, height, pf, ss, quality);
 #ifdef TIMING__
-        Time begin = Tick();
+        const Time begin = Tick();
 #endif
-        if(tjCompress2(tjCompressor_, img + offset, width, 0, height, pf,
-                       &ptr, &jpegSize, ss, quality,
-                       flags))
-            throw std::runtime_error(tjGetErrorStr());
+        //buffer size >= tjBufSize: libjpeg-turbo never needs to reallocate
+        const size_t jpegSize =
+            TJCompress(tjCompressor_, img + offset, width, pitch, height, pf,
+                       img_.DataPtr(), img_.BufferSize(), ss, quality, flags);
 #ifdef TIMING__
-        Time end = Tick();
-        std::cout << "tjCompress2: "
-                  << toms(end - begin).count()
-                  << " ms\n";
+        Metrics::Record(Metrics::COMPRESS_NS, Tick() - begin);
+        Metrics::Add(Metrics::COMPRESS_BYTES_IN,
+                     uint64_t(pitch ? pitch : width * NumComponents(pf))
+                     * height);
+        Metrics::Add(Metrics::COMPRESS_BYTES_OUT, jpegSize);
 #endif
         img_.SetCompressedSize(jpegSize);
-        return img_;
+        return std::move(img_);
     }
     //reuse image
     JPEGImage Compress(JPEGImage&& recycled,
@@ -77,11 +93,149 @@ public:
                         quality, offset, flags, pitch);
 
     }
-    ~TJCompressor() {
-        tjDestroy(tjCompressor_);
+    //strided view: sub-rectangles and padded rows are read in place
+    JPEGImage Compress(const ImageView& view,
+                       TJSAMP ss,
+                       int quality,
+                       int flags = TJFLAG_FASTDCT) {
+        return Compress(view.DataPtr(), view.Width(), view.Height(),
+                        view.PixelFormat(), ss, quality, 0, flags,
+                        view.Pitch());
+    }
+    //reuse image
+    JPEGImage Compress(JPEGImage&& recycled,
+                       const ImageView& view,
+                       TJSAMP ss,
+                       int quality,
+                       int flags = TJFLAG_FASTDCT) {
+        img_ = std::move(recycled);
+        return Compress(view, ss, quality, flags);
+    }
+    //fused pixel format conversion: view is converted to pf into a buffer
+    //owned by the compressor, then compressed; e.g. RGB input compressed
+    //from RGBX
+    JPEGImage Compress(const ImageView& view,
+                       TJPF pf,
+                       TJSAMP ss,
+                       int quality,
+                       int flags = TJFLAG_FASTDCT) {
+        if(view.PixelFormat() == pf) return Compress(view, ss, quality, flags);
+        converted_.SetParameters(view.Width(), view.Height(), pf);
+        converted_.Allocate(converted_.Size());
+        PixelConverter(view.PixelFormat(), pf).Convert(view,
+                                                       converted_.View());
+        const Image& c = converted_;
+        return Compress(c.View(), ss, quality, flags);
+    }
+    //reuse image
+    JPEGImage Compress(JPEGImage&& recycled,
+                       const ImageView& view,
+                       TJPF pf,
+                       TJSAMP ss,
+                       int quality,
+                       int flags = TJFLAG_FASTDCT) {
+        img_ = std::move(recycled);
+        return Compress(view, pf, ss, quality, flags);
     }
+    //planar YUV input: no color conversion
+    JPEGImage Compress(const YUVImage& yuv,
+                       int quality,
+                       int flags = TJFLAG_FASTDCT) {
+        const int width = yuv.Width();
+        const int height = yuv.Height();
+        const TJSAMP ss = yuv.SubSampling();
+        const TJPF pf = ss == TJSAMP_GRAY ? TJPF_GRAY : TJPF_RGB;
+        img_.Reset(width, height, pf, ss, quality);
+#ifdef TIMING__
+        const Time begin = Tick();
+#endif
+        //buffer size >= tjBufSize: libjpeg-turbo never needs to reallocate
+        const size_t jpegSize =
+            TJCompressFromYUV(tjCompressor_, yuv.Planes(), width,
+                              yuv.Strides(), height, ss, img_.DataPtr(),
+                              img_.BufferSize(), quality, flags);
+#ifdef TIMING__
+        Metrics::Record(Metrics::COMPRESS_NS, Tick() - begin);
+        Metrics::Add(Metrics::COMPRESS_BYTES_IN, yuv.Size());
+        Metrics::Add(Metrics::COMPRESS_BYTES_OUT, jpegSize);
+#endif
+        img_.SetCompressedSize(jpegSize);
+        return std::move(img_);
+    }
+    //reuse image
+    JPEGImage Compress(JPEGImage&& recycled,
+                       const YUVImage& yuv,
+                       int quality,
+                       int flags = TJFLAG_FASTDCT) {
+        img_ = std::move(recycled);
+        return Compress(yuv, quality, flags);
+    }
+#ifdef TJPP_TJ3
+    //12-bit samples in [0, 4095], lossy; pitch in samples, 0 = width x
+    //components. Image parameters are those of the source: the pixel format
+    //refers to 12-bit samples
+    JPEGImage Compress12(const short* img,
+                         int width,
+                         int height,
+                         TJPF pf,
+                         TJSAMP ss,
+                         int quality,
+                         int flags = TJFLAG_FASTDCT,
+                         int pitch = 0) {
+        img_.SetParams(width, height, pf, ss, quality);
+        img_.Reserve(TJBufSize(width, height, ss, pf, 12));
+#ifdef TIMING__
+        const Time begin = Tick();
+#endif
+        const size_t jpegSize =
+            TJCompress12(tjCompressor_, img, width, pitch, height, pf,
+                         img_.DataPtr(), img_.BufferSize(), ss, quality,
+                         flags);
+#ifdef TIMING__
+        Metrics::Record(Metrics::COMPRESS_NS, Tick() - begin);
+        Metrics::Add(Metrics::COMPRESS_BYTES_IN,
+                     uint64_t(pitch ? pitch : width * NumComponents(pf))
+                     * height * sizeof(short));
+        Metrics::Add(Metrics::COMPRESS_BYTES_OUT, jpegSize);
+#endif
+        img_.SetCompressedSize(jpegSize);
+        return std::move(img_);
+    }
+    //16-bit samples, lossless; psv: predictor selection value (1-7), pt:
+    //point transform, low order bits discarded before compression;
+    //pitch in samples. No chrominance subsampling, quality is 100
+    JPEGImage Compress16(const unsigned short* img,
+                         int width,
+                         int height,
+                         TJPF pf,
+                         int psv = 1,
+                         int pt = 0,
+                         int flags = 0,
+                         int pitch = 0) {
+        const TJSAMP ss = pf == TJPF_GRAY ? TJSAMP_GRAY : TJSAMP_444;
+        img_.SetParams(width, height, pf, ss, 100);
+        img_.Reserve(TJBufSize(width, height, ss, pf, 16, true));
+#ifdef TIMING__
+        const Time begin = Tick();
+#endif
+        const size_t jpegSize =
+            TJCompress16(tjCompressor_, img, width, pitch, height, pf,
+                         img_.DataPtr(), img_.BufferSize(), ss, psv, pt,
+                         flags);
+#ifdef TIMING__
+        Metrics::Record(Metrics::COMPRESS_NS, Tick() - begin);
+        Metrics::Add(Metrics::COMPRESS_BYTES_IN,
+                     uint64_t(pitch ? pitch : width * NumComponents(pf))
+                     * height * sizeof(unsigned short));
+        Metrics::Add(Metrics::COMPRESS_BYTES_OUT, jpegSize);
+#endif
+        img_.SetCompressedSize(jpegSize);
+        return std::move(img_);
+    }
+#endif
 private:
     JPEGImage img_;
-    tjhandle tjCompressor_;
+    Image converted_;
+    TJHandle tjCompressor_;
 };
 }
\ No newline at end of file
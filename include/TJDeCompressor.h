@@ -16,72 +16,251 @@
 //along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdexcept>
+#include <vector>
 #include <turbojpeg.h>
 
 #include "Image.h"
+#include "ImageView.h"
+#include "TJApi.h"
+#include "TJHandlePool.h"
+#include "YUVImage.h"
 #include "timing.h"
 
 namespace tjpp {
 class TJDeCompressor {
 public:
-    TJDeCompressor(size_t preAllocatedSize = 0) :
-        tjDeCompressor_(tjInitDecompress()) {
+    //opts: memory options of decompressed images e.g. huge pages
+    TJDeCompressor(size_t preAllocatedSize = 0,
+                   const BufferOptions& opts = BufferOptions()) :
+        img_(opts), tjDeCompressor_(TJ_DECOMPRESS) {
         if(preAllocatedSize > 0) {
             img_.Allocate(preAllocatedSize);
         }
     }
     //read data from header case
-    Image DeCompress(unsigned char* jpgImg,
+    //jpgImg can point to read-only memory e.g. a MappedFile
+    Image DeCompress(const unsigned char* jpgImg,
                      size_t size,
                      int pf,
                      int flags = TJFLAG_FASTDCT,
                      int pitch = 0) {
-        int width = -1;
-        int height = -1;
-        int jpegSubsamp = -1;
-        if(tjDecompressHeader2(tjDeCompressor_,
-                               jpgImg,
-                               size,
-                               &width,
-                               &height,
-                               &jpegSubsamp))
-            throw std::runtime_error(tjGetErrorStr());
-        const size_t uncompressedSize =
-            width * height * NumComponents(TJPF(pf));
+        const TJHeader hd = TJDecompressHeader(tjDeCompressor_, jpgImg, size);
+        const int width = hd.width;
+        const int height = hd.height;
+        const size_t uncompressedSize = pitch > 0 ? size_t(pitch) * height
+            : width * height * NumComponents(TJPF(pf));
 
         img_.SetParameters(width, height, TJPF(pf));
         if(img_.AllocatedSize() < uncompressedSize) 
             img_.Allocate(uncompressedSize);
         
 #ifdef TIMING__
-        Time begin = Tick();
+        const Time begin = Tick();
 #endif
-        if(tjDecompress2(tjDeCompressor_, jpgImg, size, img_.DataPtr(),
-                         width, pitch, height, pf, flags))
-            throw std::runtime_error(tjGetErrorStr());
+        TJDecompress(tjDeCompressor_, jpgImg, size, img_.DataPtr(), width,
+                     pitch, height, TJPF(pf), flags);
 #ifdef TIMING__
-        Time end = Tick();
-        std::cout << "tjDecompress2: "
-                  << toms(end - begin).count()
-                  << " ms\n";
+        Metrics::Record(Metrics::DECOMPRESS_NS, Tick() - begin);
+        Metrics::Add(Metrics::DECOMPRESS_BYTES_IN, size);
+        Metrics::Add(Metrics::DECOMPRESS_BYTES_OUT, uncompressedSize);
 #endif
         return std::move(img_);
     }
     //reuse image
     Image DeCompress(Image&& recycled,
-                     unsigned char* jpgImg,
+                     const unsigned char* jpgImg,
                      size_t size,
                      int pf,
                      int flags = TJFLAG_FASTDCT,
                      int pitch = 0) {
         img_ = std::move(recycled);
-        return DeCompress(jpgImg, size, flags, pf, pitch);
+        return DeCompress(jpgImg, size, pf, flags, pitch);
     }
-    ~TJDeCompressor() {
-        tjDestroy(tjDeCompressor_);
+    //decompress into strided view e.g. a region of a larger framebuffer;
+    //view must be at least as large as the image
+    void DeCompress(const unsigned char* jpgImg,
+                    size_t size,
+                    const MutableImageView& out,
+                    int flags = TJFLAG_FASTDCT) {
+        const TJHeader hd = TJDecompressHeader(tjDeCompressor_, jpgImg, size);
+        const int width = hd.width;
+        const int height = hd.height;
+        if(width > out.Width() || height > out.Height())
+            throw std::logic_error("Output view smaller than image");
+#ifdef TIMING__
+        const Time begin = Tick();
+#endif
+        TJDecompress(tjDeCompressor_, jpgImg, size, out.DataPtr(), width,
+                     out.Pitch(), height, out.PixelFormat(), flags);
+#ifdef TIMING__
+        Metrics::Record(Metrics::DECOMPRESS_NS, Tick() - begin);
+        Metrics::Add(Metrics::DECOMPRESS_BYTES_IN, size);
+        Metrics::Add(Metrics::DECOMPRESS_BYTES_OUT,
+                     uint64_t(out.Pitch()) * height);
+#endif
+    }
+    //DCT-domain downscaling: the inverse DCT outputs the scaled image
+    //directly, no full size image is decoded; sf must be one of
+    //ScalingFactors()
+    Image DeCompress(const unsigned char* jpgImg,
+                     size_t size,
+                     int pf,
+                     const tjscalingfactor& sf,
+                     int flags = TJFLAG_FASTDCT) {
+        if(!Supported(sf))
+            throw std::logic_error("Unsupported scaling factor "
+                                   + std::to_string(sf.num) + "/"
+                                   + std::to_string(sf.denom));
+        const TJHeader hd = TJDecompressHeader(tjDeCompressor_, jpgImg, size);
+        const int width = hd.width;
+        const int height = hd.height;
+        const int w = TJSCALED(width, sf);
+        const int h = TJSCALED(height, sf);
+        img_.SetParameters(w, h, TJPF(pf));
+        if(img_.AllocatedSize() < img_.Size())
+            img_.Allocate(img_.Size());
+#ifdef TIMING__
+        const Time begin = Tick();
+#endif
+        TJDecompress(tjDeCompressor_, jpgImg, size, img_.DataPtr(), w, 0, h,
+                     TJPF(pf), flags, sf);
+#ifdef TIMING__
+        Metrics::Record(Metrics::DECOMPRESS_NS, Tick() - begin);
+        Metrics::Add(Metrics::DECOMPRESS_BYTES_IN, size);
+        Metrics::Add(Metrics::DECOMPRESS_BYTES_OUT, img_.Size());
+#endif
+        return std::move(img_);
+    }
+    //reuse image
+    Image DeCompress(Image&& recycled,
+                     const unsigned char* jpgImg,
+                     size_t size,
+                     int pf,
+                     const tjscalingfactor& sf,
+                     int flags = TJFLAG_FASTDCT) {
+        img_ = std::move(recycled);
+        return DeCompress(jpgImg, size, pf, sf, flags);
+    }
+    //scaling factors supported by the library, largest first
+    static std::vector< tjscalingfactor > ScalingFactors() {
+        int n = 0;
+        const tjscalingfactor* sf = Factors(n);
+        return std::vector< tjscalingfactor >(sf, sf + n);
+    }
+    static bool Supported(const tjscalingfactor& sf) {
+        int n = 0;
+        const tjscalingfactor* sfs = Factors(n);
+        for(const tjscalingfactor* f = sfs; f != sfs + n; ++f)
+            if(f->num * sf.denom == sf.num * f->denom) return true;
+        return false;
+    }
+    //largest scaling factor not greater than one which makes a
+    //width x height image fit into maxWidth x maxHeight, smallest available
+    //factor if none does
+    static tjscalingfactor ScalingFactorToFit(int width, int height,
+                                              int maxWidth, int maxHeight) {
+        tjscalingfactor best = {0, 1};
+        tjscalingfactor smallest = {1, 1};
+        int n = 0;
+        const tjscalingfactor* sfs = Factors(n);
+        for(int i = 0; i != n; ++i) {
+            const tjscalingfactor& f = sfs[i];
+            if(f.num > f.denom) continue;
+            if(f.num * smallest.denom < smallest.num * f.denom) smallest = f;
+            if(TJSCALED(width, f) > maxWidth
+               || TJSCALED(height, f) > maxHeight) continue;
+            if(f.num * best.denom > best.num * f.denom) best = f;
+        }
+        return best.num ? best : smallest;
+    }
+    //planar YUV output: no color conversion
+    YUVImage DeCompressToYUV(const unsigned char* jpgImg,
+                             size_t size,
+                             int flags = TJFLAG_FASTDCT) {
+        const TJHeader hd = TJDecompressHeader(tjDeCompressor_, jpgImg, size);
+        yuv_.Allocate(hd.width, hd.height, hd.subSampling);
+        DeCompressToYUV(jpgImg, size, yuv_, flags);
+        return std::move(yuv_);
+    }
+    //reuse image
+    YUVImage DeCompressToYUV(YUVImage&& recycled,
+                             const unsigned char* jpgImg,
+                             size_t size,
+                             int flags = TJFLAG_FASTDCT) {
+        yuv_ = std::move(recycled);
+        return DeCompressToYUV(jpgImg, size, flags);
+    }
+    //decompress into existing planes e.g. wrapped device buffers; planes
+    //must match image size and subsampling
+    void DeCompressToYUV(const unsigned char* jpgImg,
+                         size_t size,
+                         YUVImage& out,
+                         int flags = TJFLAG_FASTDCT) {
+#ifdef TIMING__
+        const Time begin = Tick();
+#endif
+        TJDecompressToYUV(tjDeCompressor_, jpgImg, size, out.Planes(),
+                          out.Width(), out.Strides(), out.Height(), flags);
+#ifdef TIMING__
+        Metrics::Record(Metrics::DECOMPRESS_NS, Tick() - begin);
+        Metrics::Add(Metrics::DECOMPRESS_BYTES_IN, size);
+        Metrics::Add(Metrics::DECOMPRESS_BYTES_OUT, out.Size());
+#endif
+    }
+    //size, subsampling and precision read from the header
+    TJHeader Header(const unsigned char* jpgImg, size_t size) {
+        return TJDecompressHeader(tjDeCompressor_, jpgImg, size);
+    }
+#ifdef TJPP_TJ3
+    //12-bit samples, from 12-bit lossy or lossless images; out must hold
+    //Header().height rows of pitch samples, pitch = 0: width x components
+    void DeCompress12(const unsigned char* jpgImg,
+                      size_t size,
+                      short* out,
+                      TJPF pf,
+                      int flags = TJFLAG_FASTDCT,
+                      int pitch = 0) {
+#ifdef TIMING__
+        const Time begin = Tick();
+#endif
+        TJDecompress12(tjDeCompressor_, jpgImg, size, out, pitch, pf, flags);
+#ifdef TIMING__
+        Metrics::Record(Metrics::DECOMPRESS_NS, Tick() - begin);
+        const TJHeader hd = TJDecompressHeader(tjDeCompressor_, jpgImg, size);
+        Metrics::Add(Metrics::DECOMPRESS_BYTES_IN, size);
+        Metrics::Add(Metrics::DECOMPRESS_BYTES_OUT,
+                     uint64_t(pitch ? pitch : hd.width * NumComponents(pf))
+                     * hd.height * sizeof(short));
+#endif
+    }
+    //16-bit samples, from lossless images
+    void DeCompress16(const unsigned char* jpgImg,
+                      size_t size,
+                      unsigned short* out,
+                      TJPF pf,
+                      int flags = 0,
+                      int pitch = 0) {
+#ifdef TIMING__
+        const Time begin = Tick();
+#endif
+        TJDecompress16(tjDeCompressor_, jpgImg, size, out, pitch, pf, flags);
+#ifdef TIMING__
+        Metrics::Record(Metrics::DECOMPRESS_NS, Tick() - begin);
+        const TJHeader hd = TJDecompressHeader(tjDeCompressor_, jpgImg, size);
+        Metrics::Add(Metrics::DECOMPRESS_BYTES_IN, size);
+        Metrics::Add(Metrics::DECOMPRESS_BYTES_OUT,
+                     uint64_t(pitch ? pitch : hd.width * NumComponents(pf))
+                     * hd.height * sizeof(unsigned short));
+#endif
+    }
+#endif
+private:
+    static const tjscalingfactor* Factors(int& n) {
+        return TJScalingFactors(n);
     }
 private:
     Image img_;
-    tjhandle tjDeCompressor_;
+    YUVImage yuv_;
+    TJHandle tjDeCompressor_;
 };
 }
\ No newline at end of file
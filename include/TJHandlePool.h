@@ -0,0 +1,269 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+//Process-wide pool of TurboJPEG compress, decompress and transform handles
+//shared by all the (de)compressors: short-lived objects lease a handle
+//instead of creating and destroying one.
+//Each thread keeps a few released handles of each type in a thread-local
+//cache, acquired and released without synchronization; the cache spills
+//into and refills from a lock-free shared pool, handles beyond its size
+//limit are destroyed. Handles cached by a thread go back to the shared
+//pool when the thread exits.
+//With the legacy API handles carry no state between calls: all parameters
+//are passed to each call. With the TurboJPEG 3 API (TJPP_TJ3, see TJApi.h)
+//parameters are stored in the handle: a lease caches the values it has set
+//and only calls tj3Set when a value changes, a new lease assumes nothing
+//about the state left by the previous one.
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <turbojpeg.h>
+
+#include "MPMCQueue.h"
+
+namespace tjpp {
+
+enum TJHandleType {
+    TJ_COMPRESS = 0,
+    TJ_DECOMPRESS,
+    TJ_TRANSFORM,
+    TJ_NUM_HANDLE_TYPES
+};
+
+struct TJHandlePoolCounters {
+    size_t created;    //handles created by tjInit* or tj3Init
+    size_t destroyed;  //handles destroyed because pools were full
+    size_t sharedHits; //acquired from the shared pool
+    size_t pooled;     //handles in the shared pool
+};
+
+class TJHandlePool {
+public:
+    enum {
+        SHARED_CAPACITY = 1024, //hard limit of the shared pool, per type
+        MAX_THREAD_CACHE = 8,   //hard limit of thread caches, per type
+        DEFAULT_MAX_POOLED = 64,
+        DEFAULT_THREAD_CACHE = 2
+    };
+    //never destroyed: threads may release handles after static destructors
+    //have run
+    static TJHandlePool& Instance() {
+        static TJHandlePool* p = new TJHandlePool;
+        return *p;
+    }
+    TJHandlePool(const TJHandlePool&) = delete;
+    TJHandlePool& operator=(const TJHandlePool&) = delete;
+    tjhandle Acquire(TJHandleType t) {
+        ThreadCache& c = Local();
+        if(c.size[t] > 0) return c.handles[t][--c.size[t]];
+        tjhandle h = nullptr;
+        if(shared_[t]->TryPop(h)) {
+            --pooled_[t];
+            sharedHits_.fetch_add(1, std::memory_order_relaxed);
+            return h;
+        }
+        h = Create(t);
+        if(!h) throw std::runtime_error(ErrorStr(nullptr));
+        created_.fetch_add(1, std::memory_order_relaxed);
+        return h;
+    }
+    void Release(TJHandleType t, tjhandle h) {
+        if(!h) return;
+        ThreadCache& c = Local();
+        if(c.size[t] < int(threadCacheSize_.load(std::memory_order_relaxed))) {
+            c.handles[t][c.size[t]++] = h;
+            return;
+        }
+        Share(t, h);
+    }
+    //maximum number of handles of each type in the shared pool, at most
+    //SHARED_CAPACITY; excess handles are destroyed when released
+    void SetMaxPooled(size_t n) {
+        maxPooled_ = std::min(n, size_t(SHARED_CAPACITY));
+    }
+    //handles of each type cached by each thread, at most MAX_THREAD_CACHE;
+    //applies to handles released from now on
+    void SetThreadCacheSize(size_t n) {
+        threadCacheSize_ = std::min(n, size_t(MAX_THREAD_CACHE));
+    }
+    //destroy the handles in the shared pool
+    void Trim() {
+        for(int t = 0; t != TJ_NUM_HANDLE_TYPES; ++t) {
+            tjhandle h = nullptr;
+            while(shared_[t]->TryPop(h)) {
+                --pooled_[t];
+                Destroy(h);
+            }
+        }
+    }
+    TJHandlePoolCounters Counters() const {
+        size_t pooled = 0;
+        for(auto& p: pooled_) pooled += p;
+        return TJHandlePoolCounters{created_, destroyed_, sharedHits_, pooled};
+    }
+private:
+    //released handles of the current thread
+    struct ThreadCache {
+        ThreadCache() {
+            for(auto& s: size) s = 0;
+        }
+        ~ThreadCache() {
+            TJHandlePool& p = Instance();
+            for(int t = 0; t != TJ_NUM_HANDLE_TYPES; ++t)
+                while(size[t] > 0)
+                    p.Share(TJHandleType(t), handles[t][--size[t]]);
+        }
+        tjhandle handles[TJ_NUM_HANDLE_TYPES][MAX_THREAD_CACHE];
+        int size[TJ_NUM_HANDLE_TYPES];
+    };
+private:
+    TJHandlePool() : maxPooled_(DEFAULT_MAX_POOLED),
+                     threadCacheSize_(DEFAULT_THREAD_CACHE), created_(0),
+                     destroyed_(0), sharedHits_(0) {
+        for(auto& p: pooled_) p = 0;
+        for(auto& q: shared_)
+            q.reset(new MPMCQueue< tjhandle >(SHARED_CAPACITY));
+    }
+    static ThreadCache& Local() {
+        static thread_local ThreadCache cache;
+        return cache;
+    }
+    static tjhandle Create(TJHandleType t) {
+#ifdef TJPP_TJ3
+        switch(t) {
+        case TJ_COMPRESS: return tj3Init(TJINIT_COMPRESS);
+        case TJ_DECOMPRESS: return tj3Init(TJINIT_DECOMPRESS);
+        default: return tj3Init(TJINIT_TRANSFORM);
+        }
+#else
+        switch(t) {
+        case TJ_COMPRESS: return tjInitCompress();
+        case TJ_DECOMPRESS: return tjInitDecompress();
+        default: return tjInitTransform();
+        }
+#endif
+    }
+    void Destroy(tjhandle h) {
+#ifdef TJPP_TJ3
+        tj3Destroy(h);
+#else
+        tjDestroy(h);
+#endif
+        destroyed_.fetch_add(1, std::memory_order_relaxed);
+    }
+    //to shared pool, destroyed if full
+    void Share(TJHandleType t, tjhandle h) {
+        const size_t pooled = pooled_[t].fetch_add(1) + 1;
+        if(pooled > maxPooled_ || !shared_[t]->TryPush(std::move(h))) {
+            --pooled_[t];
+            Destroy(h);
+        }
+    }
+public:
+    //last error of handle h, of the calling thread if h is null
+    static const char* ErrorStr(tjhandle h) {
+#ifdef TJPP_TJ3
+        return tj3GetErrorStr(h);
+#else
+        (void) h;
+        return tjGetErrorStr();
+#endif
+    }
+private:
+    std::unique_ptr< MPMCQueue< tjhandle > > shared_[TJ_NUM_HANDLE_TYPES];
+    std::atomic< size_t > pooled_[TJ_NUM_HANDLE_TYPES];
+    std::atomic< size_t > maxPooled_;
+    std::atomic< size_t > threadCacheSize_;
+    std::atomic< size_t > created_;
+    std::atomic< size_t > destroyed_;
+    std::atomic< size_t > sharedHits_;
+};
+
+//lease of a pooled handle, returned to the pool on destruction; move only
+class TJHandle {
+public:
+    TJHandle() : type_(TJ_COMPRESS), handle_(nullptr) {
+        ClearParams();
+    }
+    explicit TJHandle(TJHandleType t)
+        : type_(t), handle_(TJHandlePool::Instance().Acquire(t)) {
+        ClearParams();
+    }
+    TJHandle(TJHandle&& h) : type_(h.type_), handle_(h.handle_) {
+        MoveParams(h);
+        h.handle_ = nullptr;
+    }
+    TJHandle& operator=(TJHandle&& h) {
+        if(&h == this) return *this;
+        Release();
+        type_ = h.type_;
+        handle_ = h.handle_;
+        MoveParams(h);
+        h.handle_ = nullptr;
+        return *this;
+    }
+    TJHandle(const TJHandle&) = delete;
+    TJHandle& operator=(const TJHandle&) = delete;
+    tjhandle Get() const { return handle_; }
+    operator tjhandle() const { return handle_; }
+    TJHandleType Type() const { return type_; }
+#ifdef TJPP_TJ3
+    //set handle parameter, tj3Set is called only if value differs from the
+    //value last set through this lease
+    void Set(int param, int value) {
+        const bool cached = param >= 0 && param < MAX_CACHED_PARAMS;
+        if(cached && params_[param] == value) return;
+        if(tj3Set(handle_, param, value))
+            throw std::runtime_error(TJHandlePool::ErrorStr(handle_));
+        if(cached) params_[param] = value;
+    }
+#endif
+    //give handle back to the pool
+    void Release() {
+        TJHandlePool::Instance().Release(type_, handle_);
+        handle_ = nullptr;
+        ClearParams();
+    }
+    ~TJHandle() {
+        Release();
+    }
+private:
+#ifdef TJPP_TJ3
+    enum {MAX_CACHED_PARAMS = 32, UNKNOWN = INT_MIN};
+    void ClearParams() {
+        for(auto& p: params_) p = UNKNOWN;
+    }
+    void MoveParams(TJHandle& h) {
+        std::copy(h.params_, h.params_ + MAX_CACHED_PARAMS, params_);
+        h.ClearParams();
+    }
+#else
+    void ClearParams() {}
+    void MoveParams(TJHandle&) {}
+#endif
+private:
+    TJHandleType type_;
+    tjhandle handle_;
+#ifdef TJPP_TJ3
+    int params_[MAX_CACHED_PARAMS]; //last values set, UNKNOWN if not set
+#endif
+};
+}
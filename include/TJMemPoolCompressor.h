@@ -17,49 +17,47 @@
 
 //ADD:
 // flag support
-// pitch: useful to e.g. split and compress in parallel 4k images
 
+#include <memory>
 #include <stdexcept>
 #include <turbojpeg.h>
 
-#include "SyncQueue.h"
+#include "ImageView.h"
+#include "JPEGBufferPool.h"
 #include "JPEGImage.h"
+#include "TJHandlePool.h"
 #include "timing.h"
 
 namespace tjpp {
+//Compressed images are written into buffers taken from a JPEGBufferPool and
+//returned as PooledJPEGImage objects which put the buffer back into the pool
+//on destruction
 class TJMemPoolCompressor {
 public:
-    class JPEGImageWrapper {
-    public:
-        JPEGImageWrapper(JPEGImage img,
-                         std::shared_ptr< SyncQueue< JPEGImage > > sq)
-            : img_(img), queue_(sq) {}
-        const JPEGImage& Image() const { return img_; }
-        operator const JPEGImage&() { return Image(); }
-        void Flush() {
-            queue_->Push(std::move(img_));
-        }
-        ~JPEGImageWrapper() {
-            Flush();
-        }
-    private:
-        JPEGImage img_;
-        std::shared_ptr< SyncQueue< JPEGImage > > queue_;
-    };
+    using JPEGImageWrapper = PooledJPEGImage;
+    //Compress flags argument: use the flags passed to the constructor
+    enum { DEFAULT_FLAGS = -1 };
 public:
+    //numBuffers: number of buffers pre-allocated for w x h images
+    //flags: default compression flags
+    //maxPoolBytes: cap on the total size of pooled buffers, 0 = no cap
     TJMemPoolCompressor(int numBuffers = 0,
                         size_t w = 0,
                         size_t h = 0,
                         TJPF pf = TJPF_RGB,
                         TJSAMP ss = TJSAMP_420,
                         int q = 75,
-                        int flags = TJFLAG_FASTDCT) :
-        memoryPool_(new SyncQueue< JPEGImage >()),
-        tjCompressor_(tjInitCompress()) {
-        for(int i = 0; i != numBuffers; ++i) {
-            memoryPool_->Push(JPEGImage(w, h, pf, ss, q));
-        }
+                        int flags = TJFLAG_FASTDCT,
+                        size_t maxPoolBytes = 0) :
+        memoryPool_(new JPEGBufferPool(maxPoolBytes)),
+        tjCompressor_(TJ_COMPRESS), flags_(flags) {
+        memoryPool_->Reserve(numBuffers, int(w), int(h), pf, ss, q);
     }
+    //share pool with other compressors
+    TJMemPoolCompressor(std::shared_ptr< JPEGBufferPool > pool,
+                        int flags = TJFLAG_FASTDCT) :
+        memoryPool_(pool),
+        tjCompressor_(TJ_COMPRESS), flags_(flags) {}
     JPEGImageWrapper Compress(const unsigned char* img,
                               int width,
                               int height,
@@ -67,46 +65,33 @@ public:
                               TJSAMP ss,
                               int quality,
                               int offset = 0,
-                              int flags = TJFLAG_FASTDCT,
+                              int flags = DEFAULT_FLAGS,
                               int pitch = 0) {
-
-        JPEGImage i;/*(memoryPool_->Pop(
-            JPEGImage(width, height, pf, ss, quality)));*/
-
-        if(i.Empty()
-            || tjBufSize(width, height, ss) > i.BufferSize()) {
-            i.Reset(width, height, pf, ss, quality);
-        }
-        i.SetParams(width, height, pf, ss, quality);
-        size_t jpegSize = int(UncompressedSize(i));
-        unsigned char* ptr = i.DataPtr();
-#ifdef TIMING__
-        Time begin = Tick();
-#endif
-        if(tjCompress2(tjCompressor_, img + offset, width, pitch, height, pf,
-                       &ptr, &jpegSize, ss, quality,
-                       flags))
-            throw std::runtime_error(tjGetErrorStr());
-#ifdef TIMING__
-        Time end = Tick();
-        std::cout << "tjCompress2: "
-                  << toms(end - begin).count()
-                  << std::endl;
-#endif
-        i.SetCompressedSize(jpegSize);
-        return JPEGImageWrapper(i, memoryPool_);
+        return Compress(ImageView(img + offset, width, height, pf, pitch), ss,
+                        quality, flags);
+    }
+    //strided view: sub-rectangles and padded rows are read in place
+    JPEGImageWrapper Compress(const ImageView& view,
+                              TJSAMP ss,
+                              int quality,
+                              int flags = DEFAULT_FLAGS) {
+        if(flags == DEFAULT_FLAGS) flags = flags_;
+        return CompressPooled(memoryPool_, tjCompressor_, view, ss, quality,
+                              flags);
     }
     void PutBack(JPEGImage&& im) {
-        memoryPool_->Push(std::move(im));
+        memoryPool_->Put(std::move(im));
     }
     void PutBack(JPEGImage& im) {
-        memoryPool_->Push(std::move(im));
+        memoryPool_->Put(std::move(im));
     }
-    ~TJMemPoolCompressor() {
-        tjDestroy(tjCompressor_);
+    JPEGBufferPoolCounters Counters() const {
+        return memoryPool_->Counters();
     }
+    std::shared_ptr< JPEGBufferPool > Pool() const { return memoryPool_; }
 private:
-    std::shared_ptr< SyncQueue< JPEGImage > > memoryPool_;
-    tjhandle tjCompressor_;
+    std::shared_ptr< JPEGBufferPool > memoryPool_;
+    TJHandle tjCompressor_;
+    int flags_;
 };
 }
\ No newline at end of file
@@ -17,24 +17,43 @@
 
 //ADD:
 // flag support
-// pitch: useful to e.g. split and compress in parallel 4k images
 
-#include <thread>
+#include <algorithm>
+#include <exception>
 #include <future>
+#include <stdexcept>
+#include <thread>
+#include <utility>
 #include <turbojpeg.h>
 
+#include "ImageView.h"
 #include "JPEGImage.h"
+#include "JPEGMarkers.h"
+#include "QualitySearch.h"
+#include "Stripes.h"
+#include "WorkerPool.h"
+#include "YUVImage.h"
 #include "timing.h"
 
 namespace tjpp {
+//stacks = AUTO_STACKS: the number of stripes is selected by a StripeTuner
+//from the image size and the timing of previous frames with the same size,
+//stripes are cut on MCU row boundaries. Small images are compressed as a
+//single stripe, large images use all the worker threads
 template < typename C >
 class TJParallelCompressor {
 public:
-    TJParallelCompressor(int numCompressors)
-        : compressors_(numCompressors), images_(numCompressors) {}
-    //UV note: current implementation spawns threads at each call, however after
-    //testing with other solutions like creating threads and wait on a condition
-    //variable in a loop, there does not seem to be any real gain in doing so.
+    enum { AUTO_STACKS = 0 };
+    //numCompressors <= 0: one per hardware thread
+    //pinThreads: bind each worker thread to a cpu
+    TJParallelCompressor(int numCompressors, bool pinThreads = false)
+        : compressors_(Threads(numCompressors)),
+          images_(Threads(numCompressors)),
+          tuner_(Threads(numCompressors)),
+          workers_(Threads(numCompressors), pinThreads) {}
+    //stripes are compressed by the worker pool owned by this object: threads
+    //are created once in the constructor instead of at each call, which
+    //removes thread creation from the per-frame latency
     std::vector< JPEGImage > Compress(const unsigned char* img,
                                       int stacks,
                                       int width,
@@ -45,49 +64,268 @@ public:
                                       int offset = 0,
                                       int flags = TJFLAG_FASTDCT,
                                       int pitch = 0) {
-        //won't move/reallocate if size > stacks anyway
-        if(pitch != 0)
-            throw std::logic_error("Only 0 pitch supported for now");
-        compressors_.resize(stacks);
-        images_.resize(stacks);
-        auto compress = [](C* compressor,
-                           const unsigned char* img,
-                           int width,
-                           int height,
-                           TJPF pf,
-                           TJSAMP ss,
-                           int quality,
-                           int offset,
-                           int flags,
-                           int pitch,
-                           JPEGImage* out ) {
-            *out = compressor->Compress(img, width, height, pf, ss,
-                                        quality, offset, flags, pitch);
-        };
-        std::vector< std::future< void > > tasks_;
-        const int h = height / stacks;
-        const int nc = NumComponents(pf);
-        for(int s = 0; s != stacks - 1; ++s) {
-            const int off = s * h * width * nc;
-            tasks_.push_back(std::async(std::launch::async, compress,
-                                        &compressors_[s], img,
-                                        width, h, pf, ss, quality, off, flags,
-                                        pitch, &images_[s]));
-
-
+        const Time begin = Tick();
+        const std::vector< int > heights = Stripes(width, height, ss, stacks);
+        CompressStripes(img, heights, width, pf, ss, quality, offset, flags,
+                        pitch);
+        if(stacks == AUTO_STACKS)
+            tuner_.Update(width, height, ss, int(heights.size()),
+                          Tick() - begin);
+        return std::move(images_);
+    }
+    //compress stripes in parallel and join them into a single standard
+    //JPEG stream: stripes are cut on MCU row boundaries and separated by
+    //restart markers, restart interval = number of MCUs in one stripe.
+    //Progressive encoding is not supported
+    JPEGImage CompressSingleStream(const unsigned char* img,
+                                   int stacks,
+                                   int width,
+                                   int height,
+                                   TJPF pf,
+                                   TJSAMP ss,
+                                   int quality,
+                                   int offset = 0,
+                                   int flags = TJFLAG_FASTDCT,
+                                   int pitch = 0) {
+        if(flags & TJFLAG_PROGRESSIVE)
+            throw std::logic_error("Progressive encoding not supported with "
+                                   "restart markers");
+        const Time begin = Tick();
+        const int n = stacks == AUTO_STACKS ? tuner_.Stripes(width, height, ss)
+                                            : stacks;
+        const int mcusPerRow = (width + tjMCUWidth[ss] - 1) / tjMCUWidth[ss];
+        //restart interval: all stripes but the last have the same height
+        const std::vector< int > heights =
+            MCUAlignedStripes(height, n, ss, 0xFFFF / mcusPerRow);
+        CompressStripes(img, heights, width, pf, ss, quality, offset, flags,
+                        pitch);
+        if(heights.size() == 1) {
+            if(stacks == AUTO_STACKS)
+                tuner_.Update(width, height, ss, 1, Tick() - begin);
+            return std::move(images_.front());
+        }
+        std::vector< StripeStream > streams;
+        for(auto& i: images_)
+            streams.push_back(StripeStream{i.DataPtr(), i.CompressedSize()});
+        const size_t size = JoinedSize(streams, layouts_);
+        if(stream_.Empty() || stream_.BufferSize() < size) {
+            if(!stream_.Empty() && !stream_.OwnsBuffer())
+                throw std::length_error("Caller provided JPEG buffer too "
+                                        "small");
+            stream_.Allocate(size);
+        }
+        stream_.SetParams(width, height, pf, ss, quality);
+        const int restartInterval =
+            mcusPerRow * (heights.front() / tjMCUHeight[ss]);
+        stream_.SetCompressedSize(
+            JoinRestartStripes(streams, layouts_, height, restartInterval,
+                               stream_.DataPtr()));
+        if(stacks == AUTO_STACKS)
+            tuner_.Update(width, height, ss, int(heights.size()),
+                          Tick() - begin);
+        return std::move(stream_);
+    }
+    //reuse data: recycled holds the joined stream, stripes are kept by this
+    //object between calls
+    JPEGImage CompressSingleStream(JPEGImage&& recycled,
+                                   const unsigned char* img,
+                                   int stacks,
+                                   int width,
+                                   int height,
+                                   TJPF pf,
+                                   TJSAMP ss,
+                                   int quality,
+                                   int offset = 0,
+                                   int flags = TJFLAG_FASTDCT,
+                                   int pitch = 0) {
+        stream_ = std::move(recycled);
+        return CompressSingleStream(img, stacks, width, height, pf, ss,
+                                    quality, offset, flags, pitch);
+    }
+    //strided view: sub-rectangles and padded rows are read in place
+    std::vector< JPEGImage > Compress(const ImageView& view,
+                                      int stacks,
+                                      TJSAMP ss,
+                                      int quality,
+                                      int flags = TJFLAG_FASTDCT) {
+        return Compress(view.DataPtr(), stacks, view.Width(), view.Height(),
+                        view.PixelFormat(), ss, quality, 0, flags,
+                        view.Pitch());
+    }
+    JPEGImage CompressSingleStream(const ImageView& view,
+                                   int stacks,
+                                   TJSAMP ss,
+                                   int quality,
+                                   int flags = TJFLAG_FASTDCT) {
+        return CompressSingleStream(view.DataPtr(), stacks, view.Width(),
+                                    view.Height(), view.PixelFormat(), ss,
+                                    quality, 0, flags, view.Pitch());
+    }
+    //fused pixel format conversion: each stripe is converted to pf by the
+    //thread which compresses it, there is no separate pass over the image
+    std::vector< JPEGImage > Compress(const ImageView& view,
+                                      TJPF pf,
+                                      int stacks,
+                                      TJSAMP ss,
+                                      int quality,
+                                      int flags = TJFLAG_FASTDCT) {
+        const Time begin = Tick();
+        const std::vector< int > heights =
+            Stripes(view.Width(), view.Height(), ss, stacks);
+        const int n = int(heights.size());
+        compressors_.resize(n);
+        images_.resize(n);
+        std::vector< ImageView > stripes;
+        int y = 0;
+        for(int s = 0; s != n; ++s) {
+            stripes.push_back(view.Rows(y, heights[s]));
+            y += heights[s];
         }
-        const size_t last = compressors_.size() - 1;
-        const int lastOffset = nc * width * (stacks - 1) * h;
-        const int lastHeight = height - (stacks - 1) * h;
-        tasks_.push_back(
-            std::async(std::launch::async, compress,
-                       &compressors_[last], img,
-                       width,
-                       lastHeight,
-                       pf, ss, quality, lastOffset, flags, pitch,
-                       &(images_.back())));
-        for(auto& f: tasks_) f.get();
-        return images_;
+        Dispatch(n, [&](int s) {
+            images_[s] = compressors_[s].Compress(std::move(images_[s]),
+                                                  stripes[s], pf, ss, quality,
+                                                  flags);
+        });
+        if(stacks == AUTO_STACKS)
+            tuner_.Update(view.Width(), view.Height(), ss, n, Tick() - begin);
+        return std::move(images_);
+    }
+    //abbreviated stripes: tables receives a tables-only stream with the
+    //quantization and Huffman tables, which the stripes do not carry;
+    //decode with TJParallelDeCompressor::DeCompress(tables, stripes).
+    //Stripes whose tables differ from the first stripe's, e.g. progressive
+    //stripes with optimized Huffman tables, keep their own tables
+    std::vector< JPEGImage > CompressAbbreviated(const ImageView& view,
+                                                 int stacks,
+                                                 TJSAMP ss,
+                                                 int quality,
+                                                 JPEGImage& tables,
+                                                 int flags = TJFLAG_FASTDCT) {
+        const Time begin = Tick();
+        const std::vector< int > heights =
+            Stripes(view.Width(), view.Height(), ss, stacks);
+        const int n = int(heights.size());
+        compressors_.resize(n);
+        images_.resize(n);
+        stripeTables_.resize(n);
+        std::vector< ImageView > stripes;
+        int y = 0;
+        for(int s = 0; s != n; ++s) {
+            stripes.push_back(view.Rows(y, heights[s]));
+            y += heights[s];
+        }
+        Dispatch(n, [&](int s) {
+            JPEGImage& i = images_[s];
+            i = compressors_[s].Compress(std::move(i), stripes[s], ss,
+                                         quality, flags);
+            const JPEGLayout l = ParseJPEG(i.DataPtr(), i.CompressedSize());
+            i.SetCompressedSize(RemoveTables(i.DataPtr(), i.CompressedSize(),
+                                             l, stripeTables_[s]));
+        });
+        //removing the tables made room to put them back
+        for(int s = 1; s != n; ++s) {
+            if(stripeTables_[s] == stripeTables_[0]) continue;
+            images_[s].SetCompressedSize(
+                InsertTables(images_[s].DataPtr(), images_[s].CompressedSize(),
+                             stripeTables_[s]));
+        }
+        const size_t size = stripeTables_[0].size() + 4;
+        if(tables.BufferSize() < size) {
+            if(!tables.Empty() && !tables.OwnsBuffer())
+                throw std::length_error("Caller provided JPEG buffer too "
+                                        "small for tables");
+            tables.Allocate(size);
+        }
+        tables.SetParams(view.Width(), view.Height(), view.PixelFormat(), ss,
+                         quality);
+        tables.SetCompressedSize(WriteTablesOnly(stripeTables_[0],
+                                                 tables.DataPtr()));
+        if(stacks == AUTO_STACKS)
+            tuner_.Update(view.Width(), view.Height(), ss, n, Tick() - begin);
+        return std::move(images_);
+    }
+    //rate control: stripe s is compressed with the highest quality which
+    //fits budget * height(s) / height bytes, the stripes' sizes add up to
+    //at most budget. Each stripe starts the search from the quality it
+    //was compressed with in the previous frame, stripes are searched in
+    //parallel. When the minimum quality does not fit the stripe is
+    //compressed at the minimum quality
+    std::vector< JPEGImage > CompressToSize(const ImageView& view,
+                                            int stacks,
+                                            TJSAMP ss,
+                                            size_t budget,
+                                            int flags = TJFLAG_FASTDCT,
+                                            int minQuality = 1,
+                                            int maxQuality = 100) {
+        const std::vector< int > heights =
+            Stripes(view.Width(), view.Height(), ss, stacks);
+        const int n = int(heights.size());
+        compressors_.resize(n);
+        images_.resize(n);
+        scratch_.resize(n);
+        if(int(stripeQuality_.size()) != n)
+            stripeQuality_.assign(n, (minQuality + maxQuality) / 2);
+        std::vector< ImageView > stripes;
+        int y = 0;
+        for(int s = 0; s != n; ++s) {
+            stripes.push_back(view.Rows(y, heights[s]));
+            y += heights[s];
+        }
+        Dispatch(n, [&](int s) {
+            QualitySearch search(budget * heights[s] / view.Height(),
+                                 minQuality, maxQuality);
+            //images_[s]: best fitting image or, until one is found, the
+            //lowest quality image exceeding the budget
+            bool fits = false;
+            int exceeding = maxQuality + 1;
+            while(!search.Done()) {
+                const int q = search.Candidates(1, stripeQuality_[s])[0];
+                scratch_[s] = compressors_[s].Compress(std::move(scratch_[s]),
+                                                       stripes[s], ss, q,
+                                                       flags);
+                if(search.Report(q, scratch_[s].CompressedSize())) {
+                    if(search.Fitting() == q) {
+                        std::swap(images_[s], scratch_[s]);
+                        fits = true;
+                    }
+                } else if(!fits && q < exceeding) {
+                    exceeding = q;
+                    std::swap(images_[s], scratch_[s]);
+                }
+            }
+            stripeQuality_[s] = fits ? search.Fitting() : minQuality;
+        });
+        return std::move(images_);
+    }
+    //planar YUV input: stripes are cut on MCU row boundaries
+    std::vector< JPEGImage > Compress(const YUVImage& yuv,
+                                      int stacks,
+                                      int quality,
+                                      int flags = TJFLAG_FASTDCT) {
+        const Time begin = Tick();
+        const int w = yuv.Width();
+        const int h = yuv.Height();
+        const TJSAMP ss = yuv.SubSampling();
+        const std::vector< int > heights = stacks == AUTO_STACKS
+            ? BalancedMCUStripes(h, tuner_.Stripes(w, h, ss), ss)
+            : MCUAlignedStripes(h, stacks, ss);
+        const int n = int(heights.size());
+        compressors_.resize(n);
+        images_.resize(n);
+        std::vector< YUVImage > stripes;
+        stripes.reserve(n);
+        int y = 0;
+        for(int s = 0; s != n; ++s) {
+            stripes.push_back(yuv.Rows(y, heights[s]));
+            y += heights[s];
+        }
+        Dispatch(n, [&](int s) {
+            images_[s] = compressors_[s].Compress(std::move(images_[s]),
+                                                  stripes[s], quality, flags);
+        });
+        if(stacks == AUTO_STACKS)
+            tuner_.Update(w, h, ss, n, Tick() - begin);
+        return std::move(images_);
     }
     //reuse data
     std::vector< JPEGImage > Compress(std::vector< JPEGImage >&& recycled,
@@ -105,9 +343,75 @@ public:
         return Compress(img, stacks, width, height, pf, ss,
                         quality, offset, flags, pitch);
     }
-
+    //stripe count selection for stacks = AUTO_STACKS
+    const StripeTuner& Tuner() const { return tuner_; }
+private:
+    void CompressStripes(const unsigned char* img,
+                         const std::vector< int >& heights,
+                         int width,
+                         TJPF pf,
+                         TJSAMP ss,
+                         int quality,
+                         int offset,
+                         int flags,
+                         int pitch) {
+        const int stacks = int(heights.size());
+        compressors_.resize(stacks);
+        images_.resize(stacks);
+        const int rowSize = pitch ? pitch : width * NumComponents(pf);
+        std::vector< int > offsets(stacks, offset);
+        for(int s = 1; s != stacks; ++s)
+            offsets[s] = offsets[s - 1] + heights[s - 1] * rowSize;
+        Dispatch(stacks, [&](int s) {
+            images_[s] = compressors_[s].Compress(std::move(images_[s]), img,
+                                                  width, heights[s], pf, ss,
+                                                  quality, offsets[s], flags,
+                                                  pitch);
+        });
+    }
+    //stripe heights: stacks > 0 as requested, AUTO_STACKS: MCU aligned,
+    //count selected by the tuner
+    std::vector< int > Stripes(int width, int height, TJSAMP ss, int stacks) {
+        if(stacks != AUTO_STACKS) return EvenStripes(height, stacks);
+        return BalancedMCUStripes(height, tuner_.Stripes(width, height, ss),
+                                  ss);
+    }
+    //f(s) for each stripe s in [0, n); a single stripe is compressed by the
+    //calling thread, there is nothing to overlap with the dispatch cost
+    template < typename F >
+    void Dispatch(int n, const F& f) {
+        if(n == 1) {
+            f(0);
+            return;
+        }
+        tasks_.clear();
+        for(int s = 0; s != n; ++s)
+            tasks_.push_back(workers_.Submit([&f, s]() { f(s); }));
+        //wait for all the tasks before rethrowing: they reference f
+        std::exception_ptr error;
+        for(auto& t: tasks_) {
+            try {
+                t.get();
+            } catch(...) {
+                if(!error) error = std::current_exception();
+            }
+        }
+        if(error) std::rethrow_exception(error);
+    }
+    static int Threads(int n) {
+        return n > 0 ? n
+                     : int(std::max(1u, std::thread::hardware_concurrency()));
+    }
 private:
     std::vector< C > compressors_;
     std::vector< JPEGImage > images_;
+    std::vector< JPEGImage > scratch_;  //rate control candidates
+    std::vector< int > stripeQuality_; //rate control, previous frame
+    std::vector< std::vector< unsigned char > > stripeTables_;
+    JPEGImage stream_;
+    std::vector< JPEGLayout > layouts_;
+    std::vector< std::future< void > > tasks_;
+    StripeTuner tuner_;
+    WorkerPool workers_;
 };
 }
\ No newline at end of file
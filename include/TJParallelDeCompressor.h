@@ -15,31 +15,223 @@
 //You should have received a copy of the GNU General Public License
 //along with tjpp. If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
+#include <cstring>
+#include <exception>
 #include <stdexcept>
 #include <turbojpeg.h>
 
 #include "Image.h"
+#include "ImageView.h"
 #include "JPEGImage.h"
+#include "JPEGMarkers.h"
+#include "Numa.h"
+#include "StripeContainer.h"
+#include "TJApi.h"
+#include "TJHandlePool.h"
+#include "WorkerPool.h"
+#include "YUVImage.h"
 #include "timing.h"
+#include <functional>
 #include <numeric>
 
 namespace tjpp {
 
+//NUMA_PLACEMENT: workers are bound node by node and each stripe is
+//decoded on the node which holds its output rows or, if the output pages
+//have not been touched yet, its compressed data; untouched output pages
+//are first touched, and therefore placed, by the worker decoding them.
+//Stripe tasks are only stolen by workers of the same node
 class TJParallelDeCompressor {
 public:
-    TJParallelDeCompressor(int numStacks, size_t preAllocatedSize = 0) :
-        handles_(numStacks), tasks_(numStacks) {
-        if(preAllocatedSize > 0) {
-            img_.Allocate(preAllocatedSize);
-        }
-        for(int i = 0; i != numStacks; ++i) {
-            handles_[i] = tjInitDecompress();
-        }
+    enum Placement { DEFAULT_PLACEMENT, NUMA_PLACEMENT };
+    //pinThreads: bind each worker thread to a cpu
+    //opts: memory options of decompressed images e.g. huge pages
+    TJParallelDeCompressor(int numStacks, size_t preAllocatedSize = 0,
+                           bool pinThreads = false,
+                           const BufferOptions& opts = BufferOptions()) :
+        img_(opts), handles_(numStacks),
+        placement_(DEFAULT_PLACEMENT), workers_(numStacks, pinThreads) {
+        Init(preAllocatedSize);
+    }
+    //preallocated memory is not touched: with NUMA_PLACEMENT its pages are
+    //placed by the first decode
+    TJParallelDeCompressor(int numStacks, Placement placement,
+                           size_t preAllocatedSize = 0,
+                           const BufferOptions& opts = BufferOptions()) :
+        img_(opts), handles_(numStacks),
+        placement_(placement),
+        workers_(placement == NUMA_PLACEMENT
+                     ? NumaTopology::Get().WorkerCpus(numStacks)
+                     : std::vector< int >(numStacks, -1)) {
+        Init(preAllocatedSize);
     }
     //read data from header case
     Image DeCompress(const std::vector< JPEGImage >& jpgImgs,
                      int flags = TJFLAG_FASTDCT) {
-        assert(jpgImgs.size() == handles_.size());
+        AllocateStripes(jpgImgs);
+        DeCompress(jpgImgs, img_.View(), flags);
+        return std::move(img_);
+    }
+    //reuse data
+    Image DeCompress(Image&& recycled,
+                     const std::vector< JPEGImage >& jpgImgs,
+                     int flags = TJFLAG_FASTDCT) {
+        img_ = std::move(recycled);
+        return DeCompress(jpgImgs, flags);
+    }
+    //decompress stripes into strided view, stripes are stacked top to bottom;
+    //any number of stripes, queued to the numStacks worker threads
+    void DeCompress(const std::vector< JPEGImage >& jpgImgs,
+                    const MutableImageView& out,
+                    int flags = TJFLAG_FASTDCT) {
+        DeCompressStripes(nullptr, jpgImgs, out, flags);
+    }
+    //abbreviated stripes sharing the tables of a tables-only stream, see
+    //TJParallelCompressor::CompressAbbreviated; each stripe is completed
+    //with the tables by the thread which decodes it
+    Image DeCompress(const JPEGImage& tables,
+                     const std::vector< JPEGImage >& jpgImgs,
+                     int flags = TJFLAG_FASTDCT) {
+        AllocateStripes(jpgImgs);
+        DeCompress(tables, jpgImgs, img_.View(), flags);
+        return std::move(img_);
+    }
+    //reuse data
+    Image DeCompress(Image&& recycled,
+                     const JPEGImage& tables,
+                     const std::vector< JPEGImage >& jpgImgs,
+                     int flags = TJFLAG_FASTDCT) {
+        img_ = std::move(recycled);
+        return DeCompress(tables, jpgImgs, flags);
+    }
+    //abbreviated stripes into strided view
+    void DeCompress(const JPEGImage& tables,
+                    const std::vector< JPEGImage >& jpgImgs,
+                    const MutableImageView& out,
+                    int flags = TJFLAG_FASTDCT) {
+        DeCompressStripes(&tables, jpgImgs, out, flags);
+    }
+    //stripes of a container, read in place
+    Image DeCompress(const StripeContainerView& c,
+                     int flags = TJFLAG_FASTDCT) {
+        c.Stripes(containerStripes_);
+        if(!c.Abbreviated()) return DeCompress(containerStripes_, flags);
+        const JPEGImage tables = c.Tables();
+        return DeCompress(tables, containerStripes_, flags);
+    }
+    //reuse data
+    Image DeCompress(Image&& recycled,
+                     const StripeContainerView& c,
+                     int flags = TJFLAG_FASTDCT) {
+        img_ = std::move(recycled);
+        return DeCompress(c, flags);
+    }
+    //single JPEG stream with restart markers: the entropy coded data is
+    //split at restart markers aligned with MCU rows into horizontal bands,
+    //each band is decoded by a separate thread directly into the output
+    //image. With vertically subsampled chroma each band also decodes the
+    //MCU row above and below it as context, so upsampling at band edges
+    //matches a serial decode; bands then only begin where restart markers
+    //allow one row of context on each side.
+    //Falls back to serial decoding if the stream has no restart markers or
+    //is not a single scan baseline stream
+    Image DeCompress(const unsigned char* jpgImg,
+                     size_t size,
+                     int pf,
+                     int flags = TJFLAG_FASTDCT) {
+        const JPEGLayout l = ParseJPEG(jpgImg, size);
+        const size_t uncompressedSize =
+            size_t(l.width) * l.height * NumComponents(TJPF(pf));
+        img_.SetParameters(l.width, l.height, TJPF(pf));
+        if(img_.AllocatedSize() < uncompressedSize)
+            img_.Allocate(uncompressedSize);
+        DeCompressBands(jpgImg, size, l, img_.View(), flags);
+        return std::move(img_);
+    }
+    //reuse data
+    Image DeCompress(Image&& recycled,
+                     const unsigned char* jpgImg,
+                     size_t size,
+                     int pf,
+                     int flags = TJFLAG_FASTDCT) {
+        img_ = std::move(recycled);
+        return DeCompress(jpgImg, size, pf, flags);
+    }
+    //single JPEG stream with restart markers into strided view
+    void DeCompress(const unsigned char* jpgImg,
+                    size_t size,
+                    const MutableImageView& out,
+                    int flags = TJFLAG_FASTDCT) {
+        DeCompressBands(jpgImg, size, ParseJPEG(jpgImg, size), out, flags);
+    }
+    //planar YUV output: no color conversion; all stripes but the last must
+    //have a height multiple of the MCU height, any number of stripes
+    YUVImage DeCompressToYUV(const std::vector< JPEGImage >& jpgImgs,
+                             int flags = TJFLAG_FASTDCT) {
+        int height = 0;
+        for(auto& i: jpgImgs) height += i.Height();
+        yuv_.Allocate(jpgImgs.front().Width(), height,
+                      jpgImgs.front().ChrominanceSubSampling());
+        DeCompressToYUV(jpgImgs, yuv_, flags);
+        return std::move(yuv_);
+    }
+    //reuse data
+    YUVImage DeCompressToYUV(YUVImage&& recycled,
+                             const std::vector< JPEGImage >& jpgImgs,
+                             int flags = TJFLAG_FASTDCT) {
+        yuv_ = std::move(recycled);
+        return DeCompressToYUV(jpgImgs, flags);
+    }
+    //decompress into existing planes
+    void DeCompressToYUV(const std::vector< JPEGImage >& jpgImgs,
+                         YUVImage& out,
+                         int flags = TJFLAG_FASTDCT) {
+        auto decompress = [](TJHandle* handle,
+                             const unsigned char* jpgImg,
+                             size_t size,
+                             YUVImage* out,
+                             int flags) {
+#ifdef TIMING__
+            const Time begin = Tick();
+#endif
+            TJDecompressToYUV(*handle, jpgImg, size, out->Planes(),
+                              out->Width(), out->Strides(), out->Height(),
+                              flags);
+#ifdef TIMING__
+            Metrics::Record(Metrics::DECOMPRESS_NS, Tick() - begin);
+            Metrics::Add(Metrics::DECOMPRESS_BYTES_IN, size);
+            Metrics::Add(Metrics::DECOMPRESS_BYTES_OUT, out->Size());
+#endif
+        };
+        yuvStripes_.clear();
+        outPtrs_.clear();
+        inPtrs_.clear();
+        int y = 0;
+        for(auto& i: jpgImgs) {
+            yuvStripes_.push_back(out.Rows(y, i.Height()));
+            outPtrs_.push_back(yuvStripes_.back().Plane(0));
+            inPtrs_.push_back(i.DataPtr());
+            y += i.Height();
+        }
+        Schedule();
+        for(size_t i = 0; i != jpgImgs.size(); ++i) {
+            Launch(i, std::bind(decompress,
+                                std::placeholders::_1,
+                                jpgImgs[i].DataPtr(),
+                                jpgImgs[i].CompressedSize(),
+                                &yuvStripes_[i],
+                                flags));
+        }
+        Wait(jpgImgs.size());
+    }
+    Placement GetPlacement() const { return placement_; }
+    //node of the cpu which decoded each stripe or band in the last call, a
+    //single entry for a serial decode on the calling thread
+    const std::vector< int >& StripeNodes() const { return stripeNodes_; }
+private:
+    //img_ large enough for the stripes stacked top to bottom
+    void AllocateStripes(const std::vector< JPEGImage >& jpgImgs) {
         const size_t globalWidth = jpgImgs.front().Width();
         const size_t globalHeight
             = std::accumulate(begin(jpgImgs),
@@ -58,49 +250,327 @@ public:
             img_.Allocate(uncompressedSize);
         }
         img_.SetParameters(globalWidth, globalHeight, TJPF(pixelFormat));
-
-        auto decompress = [](tjhandle handle,
-                             const unsigned char* jpgImg,
-                             size_t size,
-                             unsigned char* out,
-                             int w, int h, TJPF cs, int flags) {
-            if(tjDecompress2(handle, jpgImg, size, out,
-                             w, 0, h, cs, flags))
-                throw std::runtime_error(tjGetErrorStr());
+    }
+    //tables: tables-only stream of abbreviated stripes, nullptr if the
+    //stripes are complete streams
+    void DeCompressStripes(const JPEGImage* tables,
+                           const std::vector< JPEGImage >& jpgImgs,
+                           const MutableImageView& out,
+                           int flags) {
+        const size_t tablesEnd = tables ? ParseTablesOnly(tables->DataPtr(),
+                                                   tables->CompressedSize())
+                                        : 0;
+        int y = 0;
+        outPtrs_.clear();
+        inPtrs_.clear();
+        for(size_t i = 0; i != jpgImgs.size(); ++i) {
+            if(jpgImgs[i].Width() > out.Width()
+               || y + jpgImgs[i].Height() > out.Height())
+                throw std::logic_error("Output view smaller than image");
+            outPtrs_.push_back(out.Row(y));
+            inPtrs_.push_back(jpgImgs[i].DataPtr());
+            y += jpgImgs[i].Height();
+        }
+        Schedule();
+        if(tables) spliced_.resize(jpgImgs.size());
+        y = 0;
+        for(size_t i = 0; i != jpgImgs.size(); ++i) {
+            if(!tables) {
+                Launch(i, std::bind(DeCompressStripe,
+                                    std::placeholders::_1,
+                                    jpgImgs[i].DataPtr(),
+                                    jpgImgs[i].CompressedSize(),
+                                    out.Row(y),
+                                    jpgImgs[i].Width(),
+                                    jpgImgs[i].Height(),
+                                    out.Pitch(),
+                                    out.PixelFormat(),
+                                    flags));
+            } else {
+                const JPEGImage* t = tables;
+                const JPEGImage* j = &jpgImgs[i];
+                std::vector< unsigned char >* s = &spliced_[i];
+                unsigned char* o = out.Row(y);
+                const int pitch = out.Pitch();
+                const TJPF pf = out.PixelFormat();
+                Launch(i, [t, tablesEnd, j, s, o, pitch, pf, flags](
+                              TJHandle* h) {
+                    SpliceTables(t->DataPtr(), tablesEnd, j->DataPtr(),
+                                 j->CompressedSize(), *s);
+                    DeCompressStripe(h, s->data(), s->size(), o,
+                                     j->Width(), j->Height(), pitch, pf,
+                                     flags);
+                });
+            }
+            y += jpgImgs[i].Height();
+        }
+        Wait(jpgImgs.size());
+    }
+    void Init(size_t preAllocatedSize) {
+        if(preAllocatedSize > 0) {
+            img_.Allocate(preAllocatedSize);
+        }
+        for(auto& h: handles_) h = TJHandle(TJ_DECOMPRESS);
+    }
+    //worker of each stripe from outPtrs_ and inPtrs_, -1: any worker
+    void Schedule() {
+        const size_t n = outPtrs_.size();
+        stripeNodes_.assign(n, -1);
+        tasks_.resize(n);
+        if(placement_ != NUMA_PLACEMENT) {
+            stripeWorkers_.assign(n, -1);
+            return;
+        }
+        //output pages already placed by a previous decode win over the
+        //compressed data, which is only read once
+        std::vector< int > nodes(n);
+        for(size_t i = 0; i != n; ++i) {
+            nodes[i] = PageNode(outPtrs_[i]);
+            if(nodes[i] < 0) nodes[i] = PageNode(inPtrs_[i]);
+        }
+        stripeWorkers_ = workers_.Assign(nodes);
+    }
+    //f(handle) runs with the handle of the worker thread: a handle per
+    //worker, not per stripe
+    template < typename F >
+    void Launch(size_t i, F f) {
+        int* node = &stripeNodes_[i];
+        WorkerPool* workers = &workers_;
+        TJHandle* handles = handles_.data();
+        auto task = [f, node, workers, handles]() {
+            *node = CurrentNode();
+            f(&handles[workers->CurrentWorker()]);
         };
-
-        for(int i = 0; i != jpgImgs.size(); ++i) {
-            const int offset =
-                NumComponents(TJPF(pixelFormat)) * i
-                    * globalWidth * jpgImgs[i].Height();
-            tasks_[i] = std::move(std::async(std::launch::async,
-                                             decompress,
-                                             handles_[i],
-                                             jpgImgs[i].DataPtr(),
-                                             jpgImgs[i].CompressedSize(),
-                                             img_.DataPtr() + offset,
-                                             int(globalWidth),
-                                             int(jpgImgs[i].Height()),
-                                             TJPF(pixelFormat),
-                                             flags));
-
+        tasks_[i] = stripeWorkers_[i] < 0
+                        ? workers_.Submit(task)
+                        : workers_.SubmitTo(stripeWorkers_[i], task);
+    }
+    //wait for all the tasks before rethrowing: they reference members
+    void Wait(size_t n) {
+        std::exception_ptr error;
+        for(size_t i = 0; i != n; ++i) {
+            try {
+                tasks_[i].get();
+            } catch(...) {
+                if(!error) error = std::current_exception();
+            }
         }
-        for(auto& f: tasks_) f.get();
-        return std::move(img_);
+        if(error) std::rethrow_exception(error);
     }
-    //reuse data
-    Image DeCompress(Image&& recycled,
-                     const std::vector< JPEGImage >& jpgImgs,
-                     int flags = TJFLAG_FASTDCT) {
-        img_ = std::move(recycled);
-        return DeCompress(jpgImgs, flags);
+    static void DeCompressStripe(TJHandle* handle,
+                                 const unsigned char* jpgImg,
+                                 size_t size,
+                                 unsigned char* out,
+                                 int w, int h, int pitch, TJPF pf,
+                                 int flags) {
+#ifdef TIMING__
+        const Time begin = Tick();
+#endif
+        TJDecompress(*handle, jpgImg, size, out, w, pitch, h, pf, flags);
+#ifdef TIMING__
+        Metrics::Record(Metrics::DECOMPRESS_NS, Tick() - begin);
+        Metrics::Add(Metrics::DECOMPRESS_BYTES_IN, size);
+        Metrics::Add(Metrics::DECOMPRESS_BYTES_OUT,
+                     uint64_t(pitch ? pitch : w * NumComponents(pf)) * h);
+#endif
     }
-    ~TJParallelDeCompressor() {
-        for(auto& h: handles_) tjDestroy(h);
+    void DeCompressBands(const unsigned char* jpgImg,
+                         size_t size,
+                         const JPEGLayout& l,
+                         const MutableImageView& out,
+                         int flags) {
+        if(l.width > out.Width() || l.height > out.Height())
+            throw std::logic_error("Output view smaller than image");
+        const std::vector< Band > bands = Bands(jpgImg, size, l);
+        if(bands.size() < 2) {
+            stripeNodes_.assign(1, CurrentNode());
+            DeCompressStripe(&handles_.front(), jpgImg, size, out.DataPtr(),
+                             l.width, l.height, out.Pitch(),
+                             out.PixelFormat(), flags);
+            return;
+        }
+        bandStreams_.resize(bands.size());
+        bandContext_.resize(bands.size());
+        outPtrs_.clear();
+        inPtrs_.clear();
+        for(size_t b = 0; b != bands.size(); ++b) {
+            BandStream(jpgImg, l, bands[b], bandStreams_[b]);
+            outPtrs_.push_back(out.Row(bands[b].y));
+            inPtrs_.push_back(bandStreams_[b].data());
+        }
+        Schedule();
+        for(size_t b = 0; b != bands.size(); ++b) {
+            const Band& band = bands[b];
+            if(band.decodeHeight == band.height) {
+                Launch(b, std::bind(DeCompressStripe,
+                                    std::placeholders::_1,
+                                    bandStreams_[b].data(),
+                                    bandStreams_[b].size(),
+                                    out.Row(band.y),
+                                    l.width,
+                                    band.height,
+                                    out.Pitch(),
+                                    out.PixelFormat(),
+                                    flags));
+                continue;
+            }
+            //rows of context are decoded into a separate buffer and
+            //discarded, they belong to the neighbouring bands
+            const std::vector< unsigned char >* in = &bandStreams_[b];
+            std::vector< unsigned char >* tmp = &bandContext_[b];
+            const MutableImageView o = out;
+            const int width = l.width;
+            Launch(b, [in, tmp, o, band, width, flags](TJHandle* h) {
+                const size_t rowSize =
+                    size_t(width) * NumComponents(o.PixelFormat());
+                tmp->resize(rowSize * band.decodeHeight);
+                DeCompressStripe(h, in->data(), in->size(), tmp->data(),
+                                 width, band.decodeHeight, int(rowSize),
+                                 o.PixelFormat(), flags);
+                for(int r = 0; r != band.height; ++r)
+                    std::memcpy(o.Row(band.y + r),
+                                tmp->data() + (band.top + r) * rowSize,
+                                rowSize);
+            });
+        }
+        Wait(bands.size());
+    }
+    //horizontal band made of whole MCU rows: [first, last) indices of
+    //entropy coded segments, segment i begins after restart marker i - 1.
+    //The decoded stream, segments [decodeFirst, decodeLast), includes top
+    //rows of context above the band and extends below it when chroma is
+    //subsampled vertically: upsampling at the band edges then uses the
+    //chroma rows of the adjacent MCU rows as in a serial decode
+    struct Band {
+        size_t first;
+        size_t last;
+        int y;
+        int height;
+        size_t decodeFirst;
+        size_t decodeLast;
+        int top;
+        int decodeHeight;
+    };
+    //MCU row at which entropy coded segment i begins
+    struct Boundary {
+        size_t row;
+        size_t segment;
+    };
+    //segment boundaries and bands; no bands if the stream cannot be split
+    std::vector< Band > Bands(const unsigned char* jpgImg,
+                              size_t size,
+                              const JPEGLayout& l) {
+        std::vector< Band > bands;
+        if(handles_.size() < 2 || !l.Baseline() || l.restartInterval == 0)
+            return bands;
+        //single scan only: entropy coded data must be followed by EOI
+        if(l.scanEnd + 1 >= size || jpgImg[l.scanEnd + 1] != JPEG_EOI)
+            return bands;
+        const std::vector< size_t > rst =
+            FindRestartMarkers(jpgImg, l.scanBegin, l.scanEnd);
+        segments_.clear();
+        segments_.push_back(l.scanBegin);
+        for(auto r: rst) {
+            segments_.push_back(r);
+            segments_.push_back(r + 2);
+        }
+        segments_.push_back(l.scanEnd);
+        const size_t numSegments = rst.size() + 1;
+        const size_t mcusPerRow = l.MCUsPerRow();
+        const size_t mcuRows = l.MCURows();
+        const size_t interval = l.restartInterval;
+        const size_t rowsPerBand =
+            (mcuRows + handles_.size() - 1) / handles_.size();
+        //bands begin and end where a segment begins at the start of an
+        //MCU row
+        std::vector< Boundary > bounds(1, Boundary{0, 0});
+        for(size_t i = 1; i != numSegments; ++i)
+            if((i * interval) % mcusPerRow == 0)
+                bounds.push_back(Boundary{i * interval / mcusPerRow, i});
+        bounds.push_back(Boundary{mcuRows, numSegments});
+        //with vertical chroma subsampling one MCU row of context is needed
+        //on each side of a band edge: edges only where segments begin one
+        //row above and one row below, serial decode if there are none
+        bool context = false;
+        for(auto& c: l.components)
+            if(c.v * 8 < l.MCUHeight()) context = true;
+        size_t first = 0;
+        for(size_t k = 1; k + 1 < bounds.size(); ++k) {
+            if(bounds[k].row - bounds[first].row < rowsPerBand
+               || bands.size() == handles_.size() - 1)
+                continue;
+            if(context && (bounds[k - 1].row + 1 != bounds[k].row
+                           || bounds[k + 1].row != bounds[k].row + 1))
+                continue;
+            bands.push_back(MakeBand(l, bounds, first, k, context));
+            first = k;
+        }
+        if(bands.empty()) return bands;
+        bands.push_back(MakeBand(l, bounds, first, bounds.size() - 1,
+                                 context));
+        return bands;
+    }
+    //band between bounds[a] and bounds[b], with the adjacent MCU rows as
+    //context if required
+    static Band MakeBand(const JPEGLayout& l,
+                         const std::vector< Boundary >& bounds,
+                         size_t a,
+                         size_t b,
+                         bool context) {
+        auto y = [&l, &bounds](size_t k) {
+            return std::min(int(bounds[k].row) * l.MCUHeight(), l.height);
+        };
+        const size_t da = context && a > 0 ? a - 1 : a;
+        const size_t db = context && b + 1 < bounds.size() ? b + 1 : b;
+        return Band{bounds[a].segment, bounds[b].segment, y(a), y(b) - y(a),
+                    bounds[da].segment, bounds[db].segment, y(a) - y(da),
+                    y(db) - y(da)};
+    }
+    //stand-alone stream for one band: headers with the band height,
+    //band segments with restart markers renumbered from zero, EOI
+    void BandStream(const unsigned char* jpgImg,
+                    const JPEGLayout& l,
+                    const Band& b,
+                    std::vector< unsigned char >& out) const {
+        out.clear();
+        out.push_back(0xFF);
+        out.push_back(JPEG_SOI);
+        for(auto& s: l.segments) {
+            //application segments other than Adobe (color transform) and
+            //comments are not needed to decode
+            if((s.marker >= 0xE0 && s.marker <= 0xEF && s.marker != 0xEE)
+               || s.marker == 0xFE) continue;
+            const size_t o = out.size();
+            out.insert(out.end(), jpgImg + s.offset,
+                       jpgImg + s.offset + s.size);
+            if(s.marker == l.sofMarker)
+                WriteU16(&out[o + 5], b.decodeHeight);
+        }
+        for(size_t i = b.decodeFirst; i != b.decodeLast; ++i) {
+            out.insert(out.end(), jpgImg + segments_[2 * i],
+                       jpgImg + segments_[2 * i + 1]);
+            out.push_back(0xFF);
+            out.push_back(i == b.decodeLast - 1
+                          ? int(JPEG_EOI)
+                          : JPEG_RST0 + int((i - b.decodeFirst) % 8));
+        }
     }
 private:
     Image img_;
-    std::vector< tjhandle > handles_;
+    YUVImage yuv_;
+    std::vector< YUVImage > yuvStripes_;
+    std::vector< TJHandle > handles_;
     std::vector< std::future< void > > tasks_;
+    std::vector< size_t > segments_;
+    std::vector< std::vector< unsigned char > > bandStreams_;
+    std::vector< std::vector< unsigned char > > bandContext_;
+    std::vector< std::vector< unsigned char > > spliced_; //stripes + tables
+    std::vector< JPEGImage > containerStripes_; //non-owning
+    std::vector< const void* > outPtrs_;  //first output row of each stripe
+    std::vector< const void* > inPtrs_;   //compressed data of each stripe
+    std::vector< int > stripeWorkers_;
+    std::vector< int > stripeNodes_;
+    Placement placement_;
+    WorkerPool workers_;
 };
 }
\ No newline at end of file
@@ -0,0 +1,88 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Multi-resolution pyramid: each level is decoded from the source JPEG
+//directly at its size through DCT-domain scaling and then re-encoded;
+//levels are processed in parallel, each by its own decompressor and
+//compressor pair.
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <turbojpeg.h>
+
+#include "Image.h"
+#include "JPEGImage.h"
+#include "TJCompressor.h"
+#include "TJDeCompressor.h"
+#include "WorkerPool.h"
+
+namespace tjpp {
+class TJPyramid {
+public:
+    //numThreads <= 0: one thread per hardware thread
+    TJPyramid(int numThreads = 0, bool pinThreads = false)
+        : workers_(numThreads, pinThreads) {
+        for(int i = 0; i != workers_.NumThreads(); ++i) {
+            decompressors_.push_back(
+                std::unique_ptr< TJDeCompressor >(new TJDeCompressor));
+            compressors_.push_back(
+                std::unique_ptr< TJCompressor >(new TJCompressor));
+        }
+    }
+    TJPyramid(const TJPyramid&) = delete;
+    TJPyramid& operator=(const TJPyramid&) = delete;
+    //element i of returned vector is the source image scaled by scales[i];
+    //pf: pixel format used for the decoded levels
+    std::vector< JPEGImage > Generate(const unsigned char* jpgImg,
+                                      size_t size,
+                                      const std::vector< tjscalingfactor >&
+                                          scales,
+                                      TJSAMP ss,
+                                      int quality,
+                                      int flags = TJFLAG_FASTDCT,
+                                      TJPF pf = TJPF_BGRX) {
+        std::vector< JPEGImage > levels(scales.size());
+        images_.resize(std::max(images_.size(), scales.size()));
+        //one level per task: levels differ in size by up to 64x, small
+        //levels are stolen by idle workers
+        workers_.ParallelFor(scales.size(), 1, [&](size_t i, int w) {
+            images_[i] = decompressors_[w]->DeCompress(std::move(images_[i]),
+                                                       jpgImg, size, pf,
+                                                       scales[i], flags);
+            levels[i] = compressors_[w]->Compress(images_[i].View(), ss,
+                                                  quality, flags);
+        });
+        return levels;
+    }
+    //1, 1/2, ... 1/2^(numLevels - 1); DCT scaling stops at 1/8
+    static std::vector< tjscalingfactor > Octaves(int numLevels) {
+        if(numLevels < 1 || numLevels > 4)
+            throw std::logic_error("Number of levels must be in [1, 4]");
+        std::vector< tjscalingfactor > scales;
+        for(int i = 0; i != numLevels; ++i)
+            scales.push_back(tjscalingfactor{1, 1 << i});
+        return scales;
+    }
+    int NumThreads() const { return workers_.NumThreads(); }
+private:
+    std::vector< std::unique_ptr< TJDeCompressor > > decompressors_;
+    std::vector< std::unique_ptr< TJCompressor > > compressors_;
+    std::vector< Image > images_;
+    WorkerPool workers_; //destroyed first: no task uses members afterwards
+};
+}
@@ -0,0 +1,106 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Rate controlled compression: each frame is compressed with the highest
+//quality which fits a byte budget. Qualities are searched in rounds, the
+//candidates of a round are compressed in parallel by a pool of
+//compressors, one per worker thread; the quality selected for a frame is
+//the starting guess for the next one.
+
+#include <algorithm>
+#include <vector>
+#include <turbojpeg.h>
+
+#include "ImageView.h"
+#include "JPEGImage.h"
+#include "QualitySearch.h"
+#include "TJCompressor.h"
+#include "WorkerPool.h"
+
+namespace tjpp {
+class TJRateCompressor {
+public:
+    //numThreads <= 0: one thread per hardware thread, i.e. qualities tried
+    //in each round
+    TJRateCompressor(int numThreads = 0,
+                     bool pinThreads = false,
+                     int minQuality = 1,
+                     int maxQuality = 100)
+        : minQuality_(minQuality), maxQuality_(maxQuality),
+          quality_((minQuality + maxQuality) / 2), rounds_(0),
+          workers_(numThreads, pinThreads) {
+        compressors_.resize(workers_.NumThreads());
+        results_.resize(workers_.NumThreads());
+    }
+    TJRateCompressor(const TJRateCompressor&) = delete;
+    TJRateCompressor& operator=(const TJRateCompressor&) = delete;
+    //image compressed with the highest quality whose size is <= budget
+    //bytes; when even the minimum quality exceeds the budget the image
+    //compressed at the minimum quality is returned. JPEGImage::Quality()
+    //is the selected quality
+    JPEGImage Compress(const ImageView& view,
+                       TJSAMP ss,
+                       size_t budget,
+                       int flags = TJFLAG_FASTDCT) {
+        QualitySearch search(budget, minQuality_, maxQuality_);
+        JPEGImage fitting;
+        JPEGImage exceeding; //lowest quality above budget
+        int exceedingQuality = maxQuality_ + 1;
+        while(!search.Done()) {
+            const std::vector< int >& c =
+                search.Candidates(NumThreads(), quality_);
+            workers_.ParallelFor(c.size(), 1, [&](size_t i, int w) {
+                results_[i] = compressors_[w].Compress(std::move(results_[i]),
+                                                       view, ss, c[i], flags);
+            });
+            for(size_t i = 0; i != c.size(); ++i) {
+                //replaced images go back to the result slots for reuse
+                if(search.Report(c[i], results_[i].CompressedSize())) {
+                    if(search.Fitting() == c[i])
+                        std::swap(fitting, results_[i]);
+                } else if(c[i] < exceedingQuality) {
+                    exceedingQuality = c[i];
+                    std::swap(exceeding, results_[i]);
+                }
+            }
+        }
+        rounds_ = search.Rounds();
+        if(search.Fitting() < 0) {
+            quality_ = minQuality_;
+            return exceeding;
+        }
+        quality_ = search.Fitting();
+        return fitting;
+    }
+    //quality selected for the last frame, first guess for the next one
+    int Quality() const { return quality_; }
+    void SetQuality(int q) {
+        quality_ = std::max(minQuality_, std::min(q, maxQuality_));
+    }
+    //search rounds used for the last frame
+    int Rounds() const { return rounds_; }
+    int NumThreads() const { return workers_.NumThreads(); }
+private:
+    int minQuality_;
+    int maxQuality_;
+    int quality_;
+    int rounds_;
+    std::vector< TJCompressor > compressors_; //indexed by worker
+    std::vector< JPEGImage > results_;        //indexed by candidate
+    WorkerPool workers_;
+};
+}
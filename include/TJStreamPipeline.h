@@ -0,0 +1,228 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Streaming decode -> process -> encode pipeline: each stage runs in its own
+//thread and stages are connected through SyncQueues, frame N + 1 is decoded
+//while frame N is processed or encoded.
+//The number of frames in flight is bounded by the pipeline depth: Push
+//blocks when depth frames have been pushed and not yet popped. Decoded
+//images circulate between the stages and are reused for the next frames
+//through the recycling overloads of the (de)compressors, encoded images
+//can be handed back with Recycle.
+//Frames are delivered in input order; Push and Close are meant to be called
+//from a single producer thread, Pop and Recycle from a single consumer.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <turbojpeg.h>
+
+#include "SyncQueue.h"
+#include "Image.h"
+#include "JPEGImage.h"
+#include "TJCompressor.h"
+#include "TJDeCompressor.h"
+#include "timing.h"
+
+namespace tjpp {
+
+struct StageStats {
+    size_t frames;
+    double busySeconds;
+    //throughput of the stage if it never had to wait for the other stages
+    double FramesPerSecond() const {
+        return busySeconds > 0 ? frames / busySeconds : 0;
+    }
+};
+
+struct PipelineStats {
+    StageStats decode;
+    StageStats process;
+    StageStats encode;
+    double elapsedSeconds; //since construction
+};
+
+class TJStreamPipeline {
+public:
+    //user stage, applied in place to each decoded image
+    using Stage = std::function< void (Image&) >;
+    //depth: max number of frames in flight
+    //pf: pixel format of decoded images passed to the user stage
+    //ss, quality, flags: encoding parameters
+    TJStreamPipeline(Stage process,
+                     int depth,
+                     TJPF pf,
+                     TJSAMP ss,
+                     int quality,
+                     int flags = TJFLAG_FASTDCT)
+        : process_(process), pf_(pf), ss_(ss), quality_(quality),
+          flags_(flags), closed_(false), ended_(false), inFlight_(0),
+          start_(Tick()) {
+        for(int i = 0; i < std::max(depth, 1); ++i)
+            freeImages_.Push(Image());
+        for(auto& s: stats_) {
+            s.frames = 0;
+            s.busy = 0;
+        }
+        decodeThread_ = std::thread(&TJStreamPipeline::Decode, this);
+        processThread_ = std::thread(&TJStreamPipeline::Process, this);
+        encodeThread_ = std::thread(&TJStreamPipeline::Encode, this);
+    }
+    TJStreamPipeline(const TJStreamPipeline&) = delete;
+    TJStreamPipeline& operator=(const TJStreamPipeline&) = delete;
+    //add compressed frame, blocks if depth frames are in flight
+    void Push(std::vector< unsigned char >&& jpeg) {
+        Frame f;
+        f.image = freeImages_.Pop();
+        f.jpeg = std::move(jpeg);
+        const int depth = ++inFlight_;
+        decodeQueue_.Push(std::move(f));
+#ifdef TIMING__
+        Metrics::Record(Metrics::PIPELINE_DEPTH, uint64_t(depth));
+#else
+        (void) depth;
+#endif
+    }
+    //end of stream
+    void Close() {
+        if(closed_) return;
+        closed_ = true;
+        Frame f;
+        f.end = true;
+        decodeQueue_.Push(std::move(f));
+    }
+    //next encoded frame, in input order; returns an empty image
+    //(DataPtr() == nullptr) after the last frame once the pipeline is closed.
+    //Exceptions thrown while processing the frame are rethrown here
+    JPEGImage Pop() {
+        if(ended_) return JPEGImage();
+        Frame f = outputQueue_.Pop();
+        if(f.end) {
+            ended_ = true;
+            return JPEGImage();
+        }
+        freeImages_.Push(std::move(f.image));
+        --inFlight_;
+        if(f.error) std::rethrow_exception(f.error);
+        return std::move(f.encoded);
+    }
+    //give back encoded image for reuse
+    void Recycle(JPEGImage&& i) {
+        freeJPEGImages_.Push(std::move(i));
+    }
+    PipelineStats Stats() const {
+        auto stage = [this](int s) {
+            return StageStats{stats_[s].frames,
+                              stats_[s].busy.load() / 1E9};
+        };
+        return PipelineStats{stage(DECODE), stage(PROCESS), stage(ENCODE),
+                             std::chrono::duration< double >(
+                                 Tick() - start_).count()};
+    }
+    ~TJStreamPipeline() {
+        Close();
+        decodeThread_.join();
+        processThread_.join();
+        encodeThread_.join();
+    }
+private:
+    struct Frame {
+        Frame() : end(false) {}
+        std::vector< unsigned char > jpeg;
+        Image image;
+        JPEGImage encoded;
+        std::exception_ptr error;
+        bool end;
+    };
+    enum {DECODE = 0, PROCESS, ENCODE, NUM_STAGES};
+    struct Counters {
+        std::atomic< size_t > frames;
+        std::atomic< long long > busy; //ns
+    };
+    using Queue = SyncQueue< Frame >;
+private:
+    //pop frame from input queue, apply f if no error, push to output queue;
+    //stops after forwarding the end of stream frame
+    template < typename F >
+    void Run(Queue& in, Queue& out, int stage, F f) {
+        while(true) {
+            Frame frame = in.Pop();
+            if(frame.end) {
+                out.Push(std::move(frame));
+                break;
+            }
+            if(!frame.error) {
+                const Time begin = Tick();
+                try {
+                    f(frame);
+                } catch(...) {
+                    frame.error = std::current_exception();
+                }
+                stats_[stage].busy += std::chrono::duration_cast<
+                    std::chrono::nanoseconds >(Tick() - begin).count();
+                ++stats_[stage].frames;
+            }
+            out.Push(std::move(frame));
+        }
+    }
+    void Decode() {
+        TJDeCompressor d;
+        Run(decodeQueue_, processQueue_, DECODE, [this, &d](Frame& f) {
+            f.image = d.DeCompress(std::move(f.image), f.jpeg.data(),
+                                   f.jpeg.size(), pf_, flags_);
+        });
+    }
+    void Process() {
+        Run(processQueue_, encodeQueue_, PROCESS, [this](Frame& f) {
+            if(process_) process_(f.image);
+        });
+    }
+    void Encode() {
+        TJCompressor c;
+        Run(encodeQueue_, outputQueue_, ENCODE, [this, &c](Frame& f) {
+            JPEGImage recycled;
+            if(!freeJPEGImages_.Empty()) recycled = freeJPEGImages_.Pop();
+            f.encoded = c.Compress(std::move(recycled), f.image.View(),
+                                   ss_, quality_, flags_);
+        });
+    }
+private:
+    Stage process_;
+    TJPF pf_;
+    TJSAMP ss_;
+    int quality_;
+    int flags_;
+    bool closed_;
+    bool ended_;
+    std::atomic< int > inFlight_;
+    Time start_;
+    Counters stats_[NUM_STAGES];
+    SyncQueue< Image > freeImages_;
+    SyncQueue< JPEGImage > freeJPEGImages_;
+    Queue decodeQueue_;
+    Queue processQueue_;
+    Queue encodeQueue_;
+    Queue outputQueue_;
+    std::thread decodeThread_;
+    std::thread processThread_;
+    std::thread encodeThread_;
+};
+}
@@ -0,0 +1,189 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Tile based encoding of frame sequences with few changes between frames,
+//e.g. remote desktop and visualization streams.
+//Frames are divided into a grid of fixed size tiles; each tile is hashed
+//and compared with the hash of the same tile in the previous frame, only
+//changed tiles are compressed, as independent JPEG images. Hashing and
+//compression are fused: the worker which finds a changed tile compresses
+//it while it is still in cache.
+//TJTileCompositor decompresses tile updates in place into a framebuffer.
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <turbojpeg.h>
+
+#include "ImageView.h"
+#include "JPEGBufferPool.h"
+#include "JPEGImage.h"
+#include "TJApi.h"
+#include "TJHandlePool.h"
+#include "TileHash.h"
+#include "WorkerPool.h"
+#include "timing.h"
+
+namespace tjpp {
+
+//compressed tile with its top left corner in the frame; tile size is
+//the JPEG image size
+struct TileUpdate {
+    int x;
+    int y;
+    PooledJPEGImage jpeg;
+};
+
+class TJTileEncoder {
+public:
+    //tileSize: multiple of 16 (largest MCU size) so that tiles do not need
+    //padding; edge tiles are smaller when the frame size is not a multiple
+    //numThreads <= 0: one thread per hardware thread
+    TJTileEncoder(int tileSize = 64,
+                  int numThreads = 0,
+                  bool pinThreads = false,
+                  std::shared_ptr< JPEGBufferPool > pool
+                      = std::shared_ptr< JPEGBufferPool >())
+        : tileSize_(tileSize),
+          pool_(pool ? pool : std::make_shared< JPEGBufferPool >()),
+          width_(0), height_(0), pf_(TJPF_RGB),
+          workers_(numThreads, pinThreads) {
+        if(tileSize <= 0 || tileSize % 16)
+            throw std::logic_error("Tile size must be a multiple of 16");
+        handles_.resize(workers_.NumThreads());
+        for(auto& h: handles_) h = TJHandle(TJ_COMPRESS);
+    }
+    TJTileEncoder(const TJTileEncoder&) = delete;
+    TJTileEncoder& operator=(const TJTileEncoder&) = delete;
+    //compressed tiles which changed since the previous frame, in row major
+    //tile order; all tiles are returned for the first frame, after Reset
+    //and when the frame size or pixel format changes
+    std::vector< TileUpdate > Encode(const ImageView& frame,
+                                     TJSAMP ss,
+                                     int quality,
+                                     int flags = TJFLAG_FASTDCT) {
+        if(frame.Width() != width_ || frame.Height() != height_
+           || frame.PixelFormat() != pf_) {
+            width_ = frame.Width();
+            height_ = frame.Height();
+            pf_ = frame.PixelFormat();
+            Reset();
+        }
+        const int n = NumTiles();
+        tiles_.resize(n);
+        try {
+            workers_.ParallelFor(n, 0, [&](size_t i, int w) {
+                const ImageView t = Tile(frame, int(i));
+                const uint64_t h = TileHash::Hash(t);
+                if(valid_[i] && h == hashes_[i]) return;
+                tiles_[i] = CompressPooled(pool_, handles_[w], t, ss,
+                                           quality, flags);
+                hashes_[i] = h;
+                valid_[i] = 1;
+            });
+        } catch(...) {
+            //some tiles may have been updated: start again from a full frame
+            Reset();
+            tiles_.clear();
+            throw;
+        }
+        std::vector< TileUpdate > updates;
+        for(int i = 0; i != n; ++i) {
+            if(tiles_[i].Image().Empty()) continue;
+            updates.push_back(TileUpdate{(i % TilesX()) * tileSize_,
+                                         (i / TilesX()) * tileSize_,
+                                         std::move(tiles_[i])});
+        }
+        return updates;
+    }
+    //all tiles are sent with the next frame, e.g. when a new client joins
+    void Reset() {
+        hashes_.assign(NumTiles(), 0);
+        valid_.assign(NumTiles(), 0);
+    }
+    int TileSize() const { return tileSize_; }
+    int TilesX() const { return (width_ + tileSize_ - 1) / tileSize_; }
+    int TilesY() const { return (height_ + tileSize_ - 1) / tileSize_; }
+    int NumTiles() const { return TilesX() * TilesY(); }
+    int NumThreads() const { return workers_.NumThreads(); }
+private:
+    ImageView Tile(const ImageView& frame, int i) const {
+        const int x = (i % TilesX()) * tileSize_;
+        const int y = (i / TilesX()) * tileSize_;
+        return frame.SubView(x, y, std::min(tileSize_, width_ - x),
+                             std::min(tileSize_, height_ - y));
+    }
+private:
+    int tileSize_;
+    std::shared_ptr< JPEGBufferPool > pool_;
+    int width_;
+    int height_;
+    TJPF pf_;
+    std::vector< uint64_t > hashes_;
+    //hashes_[i] is set; not vector< bool >: written concurrently
+    std::vector< unsigned char > valid_;
+    std::vector< PooledJPEGImage > tiles_;
+    std::vector< TJHandle > handles_;
+    WorkerPool workers_; //destroyed first: no task uses handles afterwards
+};
+
+//applies tile updates to a framebuffer
+class TJTileCompositor {
+public:
+    //numThreads <= 0: one thread per hardware thread
+    TJTileCompositor(int numThreads = 0, bool pinThreads = false)
+        : workers_(numThreads, pinThreads) {
+        handles_.resize(workers_.NumThreads());
+        for(auto& h: handles_) h = TJHandle(TJ_DECOMPRESS);
+    }
+    TJTileCompositor(const TJTileCompositor&) = delete;
+    TJTileCompositor& operator=(const TJTileCompositor&) = delete;
+    //decompress tiles in place, in parallel; tiles must lie inside frame
+    void Apply(const TileUpdate* updates,
+               size_t n,
+               const MutableImageView& frame,
+               int flags = TJFLAG_FASTDCT) {
+        workers_.ParallelFor(n, 0, [&](size_t i, int w) {
+            const TileUpdate& u = updates[i];
+            const JPEGImage& j = u.jpeg;
+            const MutableImageView dst =
+                frame.SubView(u.x, u.y, j.Width(), j.Height());
+#ifdef TIMING__
+            const Time begin = Tick();
+#endif
+            TJDecompress(handles_[w], j.DataPtr(), j.CompressedSize(),
+                         dst.DataPtr(), dst.Width(), dst.Pitch(),
+                         dst.Height(), dst.PixelFormat(), flags);
+#ifdef TIMING__
+            Metrics::Record(Metrics::DECOMPRESS_NS, Tick() - begin);
+            Metrics::Add(Metrics::DECOMPRESS_BYTES_IN, j.CompressedSize());
+            Metrics::Add(Metrics::DECOMPRESS_BYTES_OUT,
+                         uint64_t(dst.Pitch()) * dst.Height());
+#endif
+        });
+    }
+    void Apply(const std::vector< TileUpdate >& updates,
+               const MutableImageView& frame,
+               int flags = TJFLAG_FASTDCT) {
+        Apply(updates.data(), updates.size(), frame, flags);
+    }
+private:
+    std::vector< TJHandle > handles_;
+    WorkerPool workers_; //destroyed first: no task uses handles afterwards
+};
+}
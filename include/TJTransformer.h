@@ -0,0 +1,180 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Lossless transforms (crop, flip, rotate, transpose) through tjTransform:
+//DCT coefficients are rearranged without decoding and re-encoding the image,
+//there is no quality loss.
+//Many transforms of the same source can be requested in a single call, they
+//are distributed over a set of worker threads each with its own transform
+//handle; outputs are written into buffers taken from a JPEGBufferPool.
+//Crop regions must start on MCU boundaries (see tjMCUWidth, tjMCUHeight),
+//they refer to the transformed image.
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <turbojpeg.h>
+
+#include "JPEGBufferPool.h"
+#include "JPEGImage.h"
+#include "TJApi.h"
+#include "TJHandlePool.h"
+#include "JPEGMarkers.h"
+#include "WorkerPool.h"
+#include "timing.h"
+
+namespace tjpp {
+class TJTransformer {
+public:
+    //numThreads <= 0: one thread per hardware thread
+    TJTransformer(int numThreads = 0,
+                  bool pinThreads = false,
+                  std::shared_ptr< JPEGBufferPool > pool
+                      = std::shared_ptr< JPEGBufferPool >())
+        : pool_(pool ? pool : std::make_shared< JPEGBufferPool >()),
+          workers_(numThreads, pinThreads) {
+        //last handle is used by the calling thread
+        handles_.resize(workers_.NumThreads() + 1);
+        for(auto& h: handles_) h = TJHandle(TJ_TRANSFORM);
+    }
+    TJTransformer(const TJTransformer&) = delete;
+    TJTransformer& operator=(const TJTransformer&) = delete;
+    //single transform, executed in the calling thread
+    PooledJPEGImage Transform(const unsigned char* jpgImg,
+                              size_t size,
+                              const tjtransform& t,
+                              int flags = 0) {
+        const Source src = ReadSource(handles_.back(), jpgImg, size);
+        return Transform(handles_.back(), src, jpgImg, size, t, flags);
+    }
+    //element i of returned vector is the result of transforms[i] applied to
+    //the source image; grain: transforms per task, 0 = automatic
+    std::vector< PooledJPEGImage > Transform(
+        const unsigned char* jpgImg,
+        size_t size,
+        const std::vector< tjtransform >& transforms,
+        int flags = 0,
+        size_t grain = 0) {
+        const Source src = ReadSource(handles_.back(), jpgImg, size);
+        std::vector< PooledJPEGImage > out(transforms.size());
+        workers_.ParallelFor(transforms.size(), grain, [&](size_t i, int w) {
+            out[i] = Transform(handles_[w], src, jpgImg, size,
+                               transforms[i], flags);
+        });
+        return out;
+    }
+    //w x h region with top left corner at (x, y) of the image transformed
+    //by op; w, h = 0: extend to right and bottom edge
+    static tjtransform Crop(int x, int y, int w, int h,
+                            TJXOP op = TJXOP_NONE, int options = 0) {
+        tjtransform t = Op(op, options | TJXOPT_CROP);
+        t.r.x = x;
+        t.r.y = y;
+        t.r.w = w;
+        t.r.h = h;
+        return t;
+    }
+    static tjtransform Op(TJXOP op, int options = 0) {
+        tjtransform t = tjtransform();
+        t.op = op;
+        t.options = options;
+        return t;
+    }
+    //size of image with chrominance subsampling ss transformed by t;
+    //TJXOPT_TRIM drops the partial MCUs at the edges which move, if the
+    //region extends to them
+    static void TransformedSize(int width, int height, TJSAMP ss,
+                                const tjtransform& t, int& w, int& h) {
+        const bool swap = t.op == TJXOP_TRANSPOSE || t.op == TJXOP_TRANSVERSE
+                          || t.op == TJXOP_ROT90 || t.op == TJXOP_ROT270;
+        const int fullW = swap ? height : width;
+        const int fullH = swap ? width : height;
+        const bool crop = t.options & TJXOPT_CROP;
+        w = crop && t.r.w ? t.r.w : fullW - (crop ? t.r.x : 0);
+        h = crop && t.r.h ? t.r.h : fullH - (crop ? t.r.y : 0);
+        if(!(t.options & TJXOPT_TRIM)) return;
+        //grayscale output: MCUs of the luminance plane only
+        const TJSAMP m = t.options & TJXOPT_GRAY ? TJSAMP_GRAY : ss;
+        const int mw = swap ? tjMCUHeight[m] : tjMCUWidth[m];
+        const int mh = swap ? tjMCUWidth[m] : tjMCUHeight[m];
+        auto trim = [](int& s, int offset, int full, int mcu) {
+            if(s / mcu > 0 && offset / mcu + s / mcu == full / mcu)
+                s -= s % mcu;
+        };
+        const bool both = t.op == TJXOP_ROT180 || t.op == TJXOP_TRANSVERSE;
+        if(both || t.op == TJXOP_HFLIP || t.op == TJXOP_ROT90)
+            trim(w, crop ? t.r.x : 0, fullW, mw);
+        if(both || t.op == TJXOP_VFLIP || t.op == TJXOP_ROT270)
+            trim(h, crop ? t.r.y : 0, fullH, mh);
+    }
+    int NumThreads() const { return workers_.NumThreads(); }
+    std::shared_ptr< JPEGBufferPool > Pool() const { return pool_; }
+private:
+    struct Source {
+        int width;
+        int height;
+        TJSAMP subSampling;
+        size_t headerSize; //markers copied to the output
+    };
+    static Source ReadSource(TJHandle& h, const unsigned char* jpgImg,
+                             size_t size) {
+        const TJHeader hd = TJDecompressHeader(h, jpgImg, size);
+        Source s;
+        s.width = hd.width;
+        s.height = hd.height;
+        s.subSampling = hd.subSampling;
+        s.headerSize = ParseJPEG(jpgImg, size).scanBegin;
+        return s;
+    }
+    PooledJPEGImage Transform(TJHandle& h,
+                              const Source& src,
+                              const unsigned char* jpgImg,
+                              size_t size,
+                              const tjtransform& t,
+                              int flags) {
+        int w = 0;
+        int ht = 0;
+        TransformedSize(src.width, src.height, src.subSampling, t, w, ht);
+        if(w <= 0 || ht <= 0)
+            throw std::logic_error("Empty transform region");
+        const TJSAMP ss = t.options & TJXOPT_GRAY ? TJSAMP_GRAY
+                                                  : src.subSampling;
+        //markers from the source (e.g. EXIF) are copied unless
+        //TJXOPT_COPYNONE is set: add their size to the worst case size
+        JPEGImage i = pool_->GetBuffer(tjBufSize(w, ht, src.subSampling)
+                                       + src.headerSize);
+#ifdef TIMING__
+        const Time begin = Tick();
+#endif
+        const size_t jpegSize = TJTransform(h, jpgImg, size, i.DataPtr(),
+                                            i.BufferSize(), t, flags);
+#ifdef TIMING__
+        Metrics::Record(Metrics::TRANSFORM_NS, Tick() - begin);
+        Metrics::Add(Metrics::TRANSFORM_BYTES_IN, size);
+        Metrics::Add(Metrics::TRANSFORM_BYTES_OUT, jpegSize);
+#endif
+        //no pixel format and quality for lossless transforms
+        i.SetParams(w, ht, TJPF(), ss, 0);
+        i.SetCompressedSize(jpegSize);
+        return PooledJPEGImage(std::move(i), pool_);
+    }
+private:
+    std::shared_ptr< JPEGBufferPool > pool_;
+    std::vector< TJHandle > handles_;
+    WorkerPool workers_; //destroyed first: no task uses handles afterwards
+};
+}
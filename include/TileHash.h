@@ -0,0 +1,227 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Fast non-cryptographic 64 bit hash of pixel data, used to detect changed
+//image regions.
+//Input is consumed in 32 byte blocks by four 64 bit lanes: each lane adds
+//the input word and the 32 x 32 -> 64 bit product of the two halves of
+//the word xored with a key which changes with the block index, so equal
+//blocks at different positions contribute differently. Lanes are mixed
+//at the end. The SSE2, AVX2 and NEON versions compute the same value as
+//the scalar one.
+
+#include <cstdint>
+#include <cstring>
+
+#include "ImageView.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) \
+    && (defined(__GNUC__) || defined(__clang__))
+#define TJPP_X86_SIMD
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define TJPP_NEON
+#include <arm_neon.h>
+#endif
+
+namespace tjpp {
+class TileHash {
+public:
+    static uint64_t Hash(const unsigned char* data,
+                         size_t size,
+                         uint64_t seed = 0) {
+        State s(seed);
+        const size_t blocks = size / BLOCK;
+        switch(HashIsa()) {
+#if defined(TJPP_X86_SIMD)
+        case AVX2:
+            BlocksAVX2(s, data, blocks);
+            break;
+        case SSE2:
+            BlocksSSE2(s, data, blocks);
+            break;
+#endif
+#if defined(TJPP_NEON)
+        case NEON:
+            BlocksNEON(s, data, blocks);
+            break;
+#endif
+        default:
+            BlocksScalar(s, data, blocks);
+            break;
+        }
+        return Finish(s, data + blocks * BLOCK, size % BLOCK, size);
+    }
+    //reference implementation
+    static uint64_t HashScalar(const unsigned char* data,
+                               size_t size,
+                               uint64_t seed = 0) {
+        State s(seed);
+        const size_t blocks = size / BLOCK;
+        BlocksScalar(s, data, blocks);
+        return Finish(s, data + blocks * BLOCK, size % BLOCK, size);
+    }
+    //rows of a strided view, padding bytes between rows are not read
+    static uint64_t Hash(const ImageView& v, uint64_t seed = 0) {
+        const size_t rowSize = size_t(v.Width()) * v.NumPlanes();
+        uint64_t h = seed;
+        for(int y = 0; y != v.Height(); ++y) h = Hash(v.Row(y), rowSize, h);
+        return h;
+    }
+    static const char* Isa() {
+        switch(HashIsa()) {
+        case AVX2: return "avx2";
+        case SSE2: return "sse2";
+        case NEON: return "neon";
+        default: return "scalar";
+        }
+    }
+private:
+    enum { BLOCK = 32, LANES = 4 };
+    enum Simd { SCALAR, SSE2, AVX2, NEON };
+    static const uint64_t P1 = 0x9E3779B185EBCA87ULL;
+    static const uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+    static const uint64_t P3 = 0x165667B19E3779F9ULL;
+    struct State {
+        explicit State(uint64_t seed) {
+            for(int l = 0; l != LANES; ++l) {
+                acc[l] = seed + P1 * (l + 1);
+                key[l] = seed ^ (P2 * (l + 1));
+            }
+        }
+        uint64_t acc[LANES];
+        uint64_t key[LANES];
+    };
+private:
+    static Simd HashIsa() {
+#if defined(TJPP_X86_SIMD)
+        static const Simd isa = __builtin_cpu_supports("avx2") ? AVX2
+                                : __builtin_cpu_supports("sse2") ? SSE2
+                                : SCALAR;
+        return isa;
+#elif defined(TJPP_NEON)
+        return NEON;
+#else
+        return SCALAR;
+#endif
+    }
+    static uint64_t Load64(const unsigned char* p) {
+        uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    static void BlocksScalar(State& s, const unsigned char* p,
+                             size_t blocks) {
+        for(size_t b = 0; b != blocks; ++b, p += BLOCK) {
+            for(int l = 0; l != LANES; ++l) {
+                const uint64_t v = Load64(p + 8 * l);
+                const uint64_t k = v ^ s.key[l];
+                s.acc[l] += v + (k & 0xFFFFFFFFULL) * (k >> 32);
+                s.key[l] += P3;
+            }
+        }
+    }
+#if defined(TJPP_X86_SIMD)
+    __attribute__((target("sse2")))
+    static void BlocksSSE2(State& s, const unsigned char* p, size_t blocks) {
+        __m128i acc0 = _mm_loadu_si128((const __m128i*) s.acc);
+        __m128i acc1 = _mm_loadu_si128((const __m128i*) (s.acc + 2));
+        __m128i key0 = _mm_loadu_si128((const __m128i*) s.key);
+        __m128i key1 = _mm_loadu_si128((const __m128i*) (s.key + 2));
+        const __m128i inc = _mm_set1_epi64x(P3);
+        for(size_t b = 0; b != blocks; ++b, p += BLOCK) {
+            const __m128i v0 = _mm_loadu_si128((const __m128i*) p);
+            const __m128i v1 = _mm_loadu_si128((const __m128i*) (p + 16));
+            const __m128i k0 = _mm_xor_si128(v0, key0);
+            const __m128i k1 = _mm_xor_si128(v1, key1);
+            acc0 = _mm_add_epi64(acc0, _mm_add_epi64(v0,
+                       _mm_mul_epu32(k0, _mm_srli_epi64(k0, 32))));
+            acc1 = _mm_add_epi64(acc1, _mm_add_epi64(v1,
+                       _mm_mul_epu32(k1, _mm_srli_epi64(k1, 32))));
+            key0 = _mm_add_epi64(key0, inc);
+            key1 = _mm_add_epi64(key1, inc);
+        }
+        _mm_storeu_si128((__m128i*) s.acc, acc0);
+        _mm_storeu_si128((__m128i*) (s.acc + 2), acc1);
+        _mm_storeu_si128((__m128i*) s.key, key0);
+        _mm_storeu_si128((__m128i*) (s.key + 2), key1);
+    }
+    __attribute__((target("avx2")))
+    static void BlocksAVX2(State& s, const unsigned char* p, size_t blocks) {
+        __m256i acc = _mm256_loadu_si256((const __m256i*) s.acc);
+        __m256i key = _mm256_loadu_si256((const __m256i*) s.key);
+        const __m256i inc = _mm256_set1_epi64x(P3);
+        for(size_t b = 0; b != blocks; ++b, p += BLOCK) {
+            const __m256i v = _mm256_loadu_si256((const __m256i*) p);
+            const __m256i k = _mm256_xor_si256(v, key);
+            acc = _mm256_add_epi64(acc, _mm256_add_epi64(v,
+                      _mm256_mul_epu32(k, _mm256_srli_epi64(k, 32))));
+            key = _mm256_add_epi64(key, inc);
+        }
+        _mm256_storeu_si256((__m256i*) s.acc, acc);
+        _mm256_storeu_si256((__m256i*) s.key, key);
+    }
+#endif
+#if defined(TJPP_NEON)
+    static void BlocksNEON(State& s, const unsigned char* p, size_t blocks) {
+        uint64x2_t acc0 = vld1q_u64(s.acc);
+        uint64x2_t acc1 = vld1q_u64(s.acc + 2);
+        uint64x2_t key0 = vld1q_u64(s.key);
+        uint64x2_t key1 = vld1q_u64(s.key + 2);
+        const uint64x2_t inc = vdupq_n_u64(P3);
+        for(size_t b = 0; b != blocks; ++b, p += BLOCK) {
+            const uint64x2_t v0 = vreinterpretq_u64_u8(vld1q_u8(p));
+            const uint64x2_t v1 = vreinterpretq_u64_u8(vld1q_u8(p + 16));
+            const uint64x2_t k0 = veorq_u64(v0, key0);
+            const uint64x2_t k1 = veorq_u64(v1, key1);
+            acc0 = vaddq_u64(acc0, vaddq_u64(v0,
+                       vmull_u32(vmovn_u64(k0), vshrn_n_u64(k0, 32))));
+            acc1 = vaddq_u64(acc1, vaddq_u64(v1,
+                       vmull_u32(vmovn_u64(k1), vshrn_n_u64(k1, 32))));
+            key0 = vaddq_u64(key0, inc);
+            key1 = vaddq_u64(key1, inc);
+        }
+        vst1q_u64(s.acc, acc0);
+        vst1q_u64(s.acc + 2, acc1);
+        vst1q_u64(s.key, key0);
+        vst1q_u64(s.key + 2, key1);
+    }
+#endif
+    //murmur3 finalizer
+    static uint64_t Mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+    //tail is zero padded to a full block, the size is mixed in
+    static uint64_t Finish(State& s, const unsigned char* tail, size_t n,
+                           size_t size) {
+        if(n) {
+            unsigned char last[BLOCK] = {0};
+            std::memcpy(last, tail, n);
+            BlocksScalar(s, last, 1);
+        }
+        uint64_t h = Mix(size * P1);
+        for(int l = 0; l != LANES; ++l) h = Mix(h ^ Mix(s.acc[l]));
+        return h;
+    }
+};
+}
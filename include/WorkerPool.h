@@ -0,0 +1,311 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Persistent pool of worker threads: threads are created once and wait for
+//work; each worker owns a task deque and steals from the other workers'
+//deques when its own is empty.
+//Tasks are submitted through Submit which returns a std::future, the same
+//way std::async does, exceptions thrown by tasks are rethrown by
+//future::get.
+//ParallelFor splits an index range into chunks, idle workers steal chunks
+//from busy ones.
+//Workers bound to cpus belong to the NUMA node of their cpu: they steal
+//from workers of the same node first, and tasks submitted with SubmitTo are
+//only stolen by workers of the target worker's node.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Numa.h"
+#include "timing.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace tjpp {
+class WorkerPool {
+    //type returned by f(); std::result_of is removed in C++20
+    template < typename F >
+    using Result = decltype(std::declval< F& >()());
+public:
+    //numThreads <= 0: one thread per hardware thread
+    //pinThreads: bind worker i to cpu (firstCPU + i) % number of cpus
+    WorkerPool(int numThreads = 0, bool pinThreads = false, int firstCPU = 0)
+        : stop_(false), pending_(0), next_(0), affinePending_(0) {
+        if(numThreads <= 0)
+            numThreads = std::max(1u, std::thread::hardware_concurrency());
+        const int ncpus = std::max(1u, std::thread::hardware_concurrency());
+        std::vector< int > cpus(numThreads, -1);
+        if(pinThreads)
+            for(int i = 0; i != numThreads; ++i)
+                cpus[i] = (firstCPU + i) % ncpus;
+        Start(cpus);
+    }
+    //one worker per element of cpus, worker i bound to cpus[i];
+    //cpus[i] < 0: worker i is not bound
+    explicit WorkerPool(const std::vector< int >& cpus)
+        : stop_(false), pending_(0), next_(0), affinePending_(0) {
+        Start(cpus.empty() ? std::vector< int >(1, -1) : cpus);
+    }
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    template < typename F >
+    std::future< Result< F > > Submit(F&& f) {
+        return Push(next_++ % workers_.size(), -1, std::forward< F >(f));
+    }
+    //queue f to worker; if the worker is bound to a cpu the task is only
+    //stolen by workers of the same NUMA node
+    template < typename F >
+    std::future< Result< F > > SubmitTo(int worker, F&& f) {
+        return Push(worker, nodes_[worker], std::forward< F >(f));
+    }
+    //call f(i, worker) for each i in [0, n), worker is the index of the
+    //worker thread running f, in [0, NumThreads()); indices are processed in
+    //chunks of grain elements, grain = 0: about eight chunks per worker.
+    //Blocks until all calls return, the first exception thrown by f is
+    //rethrown; must not be called from a worker thread of the same pool
+    template < typename F >
+    void ParallelFor(size_t n, size_t grain, F f) {
+        if(n == 0) return;
+        if(grain == 0)
+            grain = std::max(size_t(1), n / (8 * workers_.size()));
+        std::vector< std::future< void > > done;
+        done.reserve((n + grain - 1) / grain);
+        for(size_t b = 0; b < n; b += grain) {
+            const size_t e = std::min(n, b + grain);
+            done.push_back(Submit([this, &f, b, e]() {
+                const int w = CurrentWorker();
+                for(size_t i = b; i != e; ++i) f(i, w);
+            }));
+        }
+        std::exception_ptr error;
+        for(auto& d: done) {
+            try {
+                d.get();
+            } catch(...) {
+                if(!error) error = std::current_exception();
+            }
+        }
+        if(error) std::rethrow_exception(error);
+    }
+    int NumThreads() const { return int(threads_.size()); }
+    //NUMA node index of the cpu worker is bound to, -1 if not bound
+    int WorkerNode(int worker) const { return nodes_[worker]; }
+    //worker for each of nodes.size() tasks: task i goes to the least loaded
+    //worker of node nodes[i], unless all of them already have their share
+    //of the tasks; tasks without a node or with a full node go to the least
+    //loaded worker, lowest index first
+    std::vector< int > Assign(const std::vector< int >& nodes) const {
+        const size_t n = workers_.size();
+        const size_t share = (nodes.size() + n - 1) / n;
+        std::vector< size_t > load(n, 0);
+        std::vector< int > assigned(nodes.size());
+        for(size_t t = 0; t != nodes.size(); ++t) {
+            size_t best = n;
+            for(size_t w = 0; w != n; ++w) {
+                if(nodes[t] < 0 || nodes_[w] != nodes[t] || load[w] >= share)
+                    continue;
+                if(best == n || load[w] < load[best]) best = w;
+            }
+            if(best == n) {
+                best = 0;
+                for(size_t w = 1; w != n; ++w)
+                    if(load[w] < load[best]) best = w;
+            }
+            ++load[best];
+            assigned[t] = int(best);
+        }
+        return assigned;
+    }
+    //index of calling thread in this pool, -1 if not a worker of this pool
+    int CurrentWorker() const {
+        const Slot& s = CurrentSlot();
+        return s.pool == this ? s.id : -1;
+    }
+    ~WorkerPool() {
+        {
+            std::lock_guard< std::mutex > guard(sleepMutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for(auto& t: threads_) t.join();
+    }
+private:
+    struct Task {
+        Task() : node(-1) {}
+        virtual void Run() = 0;
+        virtual ~Task() {}
+        int node; //only stolen by workers of this node, -1: any worker
+    };
+    template < typename F >
+    struct TaskImpl : Task {
+        TaskImpl(F&& f) : f_(std::move(f)) {}
+        void Run() { f_(); }
+        F f_;
+    };
+    using TaskPtr = std::unique_ptr< Task >;
+    struct Slot {
+        const WorkerPool* pool;
+        int id;
+    };
+    struct Worker {
+        std::deque< TaskPtr > tasks;
+        std::mutex mutex;
+    };
+private:
+    void Start(const std::vector< int >& cpus) {
+        const int numThreads = int(cpus.size());
+        const NumaTopology& topology = NumaTopology::Get();
+        nodePending_.reset(new std::atomic< int >[topology.NumNodes()]);
+        for(int n = 0; n != topology.NumNodes(); ++n) nodePending_[n] = 0;
+        for(int i = 0; i != numThreads; ++i) {
+            workers_.push_back(std::unique_ptr< Worker >(new Worker));
+            nodes_.push_back(cpus[i] < 0 ? -1 : topology.NodeOfCpu(cpus[i]));
+        }
+        //steal order: own queue, same node, other nodes
+        victims_.resize(numThreads);
+        for(int i = 0; i != numThreads; ++i) {
+            for(int same = 1; same >= 0; --same)
+                for(int k = 0; k != numThreads; ++k) {
+                    const int v = (i + k) % numThreads;
+                    if((nodes_[v] == nodes_[i]) == bool(same))
+                        victims_[i].push_back(v);
+                }
+        }
+        for(int i = 0; i != numThreads; ++i) {
+            threads_.push_back(std::thread(&WorkerPool::Run, this, i));
+            if(cpus[i] >= 0) Pin(threads_.back(), cpus[i]);
+        }
+    }
+    template < typename F >
+    std::future< Result< F > > Push(size_t w, int node, F&& f) {
+        using R = Result< F >;
+        std::packaged_task< R () > task(std::forward< F >(f));
+        std::future< R > result = task.get_future();
+        TaskPtr t(new TaskImpl< std::packaged_task< R () > >(std::move(task)));
+        t->node = node;
+        {
+            std::lock_guard< std::mutex > guard(workers_[w]->mutex);
+            workers_[w]->tasks.push_back(std::move(t));
+        }
+        {
+            std::lock_guard< std::mutex > guard(sleepMutex_);
+            ++pending_;
+            if(node >= 0) {
+                ++nodePending_[node];
+                ++affinePending_;
+            }
+        }
+#ifdef TIMING__
+        Metrics::Record(Metrics::TASK_QUEUE_DEPTH, uint64_t(pending_));
+#endif
+        //a single woken thread might not be allowed to take the task
+        if(node >= 0) wake_.notify_all();
+        else wake_.notify_one();
+        return result;
+    }
+    //own queue: front, other queues: last task worker id may run, tasks
+    //bound to other nodes are skipped
+    TaskPtr Pop(size_t id) {
+        const std::vector< int >& victims = victims_[id];
+        for(size_t i = 0; i != victims.size(); ++i) {
+            Worker& w = *workers_[victims[i]];
+            std::lock_guard< std::mutex > guard(w.mutex);
+            if(w.tasks.empty()) continue;
+            TaskPtr t;
+            if(i == 0) {
+                t = std::move(w.tasks.front());
+                w.tasks.pop_front();
+            } else {
+                auto r = w.tasks.rbegin();
+                for(; r != w.tasks.rend(); ++r)
+                    if((*r)->node < 0 || (*r)->node == nodes_[id]) break;
+                if(r == w.tasks.rend()) continue;
+                t = std::move(*r);
+                w.tasks.erase(std::next(r).base());
+            }
+            if(t->node >= 0) {
+                --nodePending_[t->node];
+                --affinePending_;
+            }
+            --pending_;
+            return t;
+        }
+        return TaskPtr();
+    }
+    //tasks worker id is allowed to run may be queued; unbound workers only
+    //ever run tasks without a node
+    bool Runnable(size_t id) const {
+        const int node = nodes_[id];
+        return pending_ - affinePending_ > 0
+               || (node >= 0 && nodePending_[node] > 0);
+    }
+    static Slot& CurrentSlot() {
+        static thread_local Slot slot = {nullptr, -1};
+        return slot;
+    }
+    void Run(size_t id) {
+        CurrentSlot() = Slot{this, int(id)};
+        while(true) {
+            TaskPtr t = Pop(id);
+            if(t) {
+                t->Run();
+                continue;
+            }
+            std::unique_lock< std::mutex > lock(sleepMutex_);
+            wake_.wait(lock, [this, id]{ return stop_ || Runnable(id); });
+            if(stop_ && !Runnable(id)) break;
+        }
+    }
+    static void Pin(std::thread& t, int cpu) {
+#ifdef __linux__
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(cpu, &cpuset);
+        pthread_setaffinity_np(t.native_handle(), sizeof(cpu_set_t), &cpuset);
+#else
+        (void) t;
+        (void) cpu;
+#endif
+    }
+private:
+    std::vector< std::unique_ptr< Worker > > workers_;
+    std::vector< std::thread > threads_;
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    bool stop_;
+    std::atomic< int > pending_;
+    std::atomic< size_t > next_;
+    std::vector< int > nodes_;                 //node of each worker
+    std::vector< std::vector< int > > victims_; //steal order of each worker
+    std::unique_ptr< std::atomic< int >[] > nodePending_;
+    std::atomic< int > affinePending_;         //tasks with a node
+};
+}
@@ -0,0 +1,145 @@
+#pragma once
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Planar YUV (YCbCr) image: one luminance plane and, unless the subsampling
+//is TJSAMP_GRAY, two chrominance planes with the size given by the
+//subsampling. Planes are either owned by the image or wrap external memory
+//e.g. the buffers of a capture device.
+
+#include <stdexcept>
+#include <vector>
+#include <turbojpeg.h>
+
+namespace tjpp {
+class YUVImage {
+public:
+    YUVImage() : width_(0), height_(0), subSampling_(TJSAMP_420) {
+        Clear();
+    }
+    //allocate planes, rows are padded to a multiple of pad bytes
+    YUVImage(int width, int height, TJSAMP ss, int pad = 1) {
+        Allocate(width, height, ss, pad);
+    }
+    //wrap external planes, chrominance planes are ignored for TJSAMP_GRAY;
+    //stride = 0: plane width
+    YUVImage(unsigned char* y, unsigned char* u, unsigned char* v,
+             const int strides[3], int width, int height, TJSAMP ss) :
+        width_(width), height_(height), subSampling_(ss) {
+        Clear();
+        unsigned char* p[3] = {y, u, v};
+        for(int i = 0; i != NumPlanes(); ++i) {
+            planes_[i] = p[i];
+            strides_[i] = strides && strides[i] ? strides[i]
+                                                : PlaneWidth(i);
+        }
+    }
+    YUVImage(const YUVImage&) = delete;
+    YUVImage& operator=(const YUVImage&) = delete;
+    YUVImage(YUVImage&& i) {
+        Move(i);
+    }
+    YUVImage& operator=(YUVImage&& i) {
+        Move(i);
+        return *this;
+    }
+    void Allocate(int width, int height, TJSAMP ss, int pad = 1) {
+        width_ = width;
+        height_ = height;
+        subSampling_ = ss;
+        Clear();
+        size_t offsets[3] = {0, 0, 0};
+        size_t size = 0;
+        for(int i = 0; i != NumPlanes(); ++i) {
+            strides_[i] = (PlaneWidth(i) + pad - 1) / pad * pad;
+            offsets[i] = size;
+            size += tjPlaneSizeYUV(i, width, strides_[i], height, ss);
+        }
+        if(data_.size() < size) data_.resize(size);
+        for(int i = 0; i != NumPlanes(); ++i)
+            planes_[i] = data_.data() + offsets[i];
+    }
+    int Width() const { return width_; }
+    int Height() const { return height_; }
+    TJSAMP SubSampling() const { return subSampling_; }
+    int NumPlanes() const { return subSampling_ == TJSAMP_GRAY ? 1 : 3; }
+    int PlaneWidth(int i) const {
+        return tjPlaneWidth(i, width_, subSampling_);
+    }
+    int PlaneHeight(int i) const {
+        return tjPlaneHeight(i, height_, subSampling_);
+    }
+    unsigned char* Plane(int i) { return planes_[i]; }
+    const unsigned char* Plane(int i) const { return planes_[i]; }
+    int Stride(int i) const { return strides_[i]; }
+    //arrays in the format expected by the TurboJPEG YUV functions
+    unsigned char** Planes() { return planes_; }
+    const unsigned char** Planes() const {
+        return const_cast< const unsigned char** >(planes_);
+    }
+    int* Strides() { return strides_; }
+    const int* Strides() const { return strides_; }
+    bool Empty() const { return !planes_[0]; }
+    //bytes spanned by the planes, including row padding
+    size_t Size() const {
+        size_t s = 0;
+        for(int i = 0; i != NumPlanes(); ++i)
+            s += size_t(strides_[i]) * PlaneHeight(i);
+        return s;
+    }
+    //non-owning image made of luminance rows [y, y + h) and the matching
+    //chrominance rows; y must be a multiple of the MCU height
+    YUVImage Rows(int y, int h) const {
+        if(y % tjMCUHeight[subSampling_] != 0 || y + h > height_)
+            throw std::logic_error("Rows not aligned to MCU boundary");
+        const int chromaY = y * 8 / tjMCUHeight[subSampling_];
+        return YUVImage(planes_[0] + size_t(y) * strides_[0],
+                        planes_[1] ? planes_[1] + size_t(chromaY) * strides_[1]
+                                   : nullptr,
+                        planes_[2] ? planes_[2] + size_t(chromaY) * strides_[2]
+                                   : nullptr,
+                        strides_, width_, h, subSampling_);
+    }
+private:
+    void Clear() {
+        for(int i = 0; i != 3; ++i) {
+            planes_[i] = nullptr;
+            strides_[i] = 0;
+        }
+    }
+    //moving a vector does not move its buffer: plane pointers stay valid
+    void Move(YUVImage& i) {
+        width_ = i.width_;
+        height_ = i.height_;
+        subSampling_ = i.subSampling_;
+        data_ = std::move(i.data_);
+        for(int p = 0; p != 3; ++p) {
+            planes_[p] = i.planes_[p];
+            strides_[p] = i.strides_[p];
+        }
+        i.Clear();
+        i.width_ = 0;
+        i.height_ = 0;
+    }
+private:
+    int width_;
+    int height_;
+    TJSAMP subSampling_;
+    unsigned char* planes_[3];
+    int strides_[3];
+    std::vector< unsigned char > data_;
+};
+}
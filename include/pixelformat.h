@@ -30,6 +30,7 @@ inline int NumComponents(TJPF tjpgPixelFormat) {
         {TJPF_BGR, 3},
         {TJPF_RGBX, 4},
         {TJPF_BGRX, 4},
+        {TJPF_XBGR, 4},
         {TJPF_XRGB, 4},
         {TJPF_GRAY, 1},
         {TJPF_RGBA, 4},
@@ -15,7 +15,24 @@
 //You should have received a copy of the GNU General Public License
 //along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
 
+//Time helpers and hot path instrumentation.
+//Metrics are counters and histograms kept per thread: each thread updates
+//its own block with relaxed atomic loads and stores, no locks and no shared
+//cache lines in the hot path; a mutex is taken only when a thread records
+//its first metric, when it exits and when a snapshot is taken.
+//Histograms have four buckets per power of two: values are recorded with
+//a relative error below 25%.
+//The library records metrics only when compiled with TIMING__, recording
+//can also be switched off at run time with Metrics::Enable(false).
+
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
 namespace tjpp {
 using Timer = std::chrono::steady_clock;
 using Time = Timer::time_point;
@@ -26,4 +43,235 @@ inline std::chrono::milliseconds toms(Duration d) {
     return std::chrono::duration_cast< std::chrono::milliseconds >(d);
 }
 }
-}
\ No newline at end of file
+
+struct HistogramSnapshot {
+    enum { NUM_BUCKETS = 4 + 62 * 4 };
+    HistogramSnapshot() : count(0), sum(0), buckets(NUM_BUCKETS, 0) {}
+    uint64_t count;
+    uint64_t sum;
+    std::vector< uint64_t > buckets;
+    double Mean() const { return count ? double(sum) / count : 0; }
+    //upper bound of the bucket holding the q quantile, q in [0, 1]
+    uint64_t Percentile(double q) const {
+        if(!count) return 0;
+        const uint64_t rank = std::min(count - 1, uint64_t(q * count));
+        uint64_t n = 0;
+        for(int i = 0; i != NUM_BUCKETS; ++i) {
+            n += buckets[i];
+            if(n > rank) return UpperBound(i);
+        }
+        return UpperBound(NUM_BUCKETS - 1);
+    }
+    uint64_t Max() const { return Percentile(1); }
+    //values 0-3 have their own bucket, then four buckets per power of two
+    static int Bucket(uint64_t v) {
+        if(v < 4) return int(v);
+        int k = 63;
+        while(!(v >> k)) --k;
+        return 4 + (k - 2) * 4 + int((v >> (k - 2)) & 3);
+    }
+    static uint64_t LowerBound(int i) {
+        if(i < 4) return uint64_t(i);
+        const int k = (i - 4) / 4 + 2;
+        return uint64_t(4 + (i - 4) % 4) << (k - 2);
+    }
+    static uint64_t UpperBound(int i) {
+        return i == NUM_BUCKETS - 1 ? UINT64_MAX : LowerBound(i + 1) - 1;
+    }
+};
+
+class Metrics {
+public:
+    enum Counter {
+        COMPRESS_BYTES_IN,    //uncompressed bytes read by encoders
+        COMPRESS_BYTES_OUT,   //JPEG bytes written by encoders
+        DECOMPRESS_BYTES_IN,  //JPEG bytes read by decoders
+        DECOMPRESS_BYTES_OUT, //uncompressed bytes written by decoders
+        TRANSFORM_BYTES_IN,
+        TRANSFORM_BYTES_OUT,
+        POOL_HITS,            //JPEG buffers served from a JPEGBufferPool
+        POOL_MISSES,          //JPEG buffers allocated by a JPEGBufferPool
+        NUM_COUNTERS
+    };
+    enum Histogram {
+        COMPRESS_NS,          //duration of each encode call
+        DECOMPRESS_NS,        //duration of each decode call
+        TRANSFORM_NS,         //duration of each lossless transform
+        TASK_QUEUE_DEPTH,     //WorkerPool pending tasks, sampled on submit
+        PIPELINE_DEPTH,       //TJStreamPipeline frames in flight, on push
+        NUM_HISTOGRAMS
+    };
+    struct Snapshot {
+        Snapshot() {
+            std::fill(counters, counters + NUM_COUNTERS, 0);
+        }
+        uint64_t counters[NUM_COUNTERS];
+        HistogramSnapshot histograms[NUM_HISTOGRAMS];
+        uint64_t operator[](Counter c) const { return counters[c]; }
+        const HistogramSnapshot& operator[](Histogram h) const {
+            return histograms[h];
+        }
+    };
+    static bool Enabled() {
+        return Enabled_().load(std::memory_order_relaxed);
+    }
+    static void Enable(bool on) {
+        Enabled_().store(on, std::memory_order_relaxed);
+    }
+    static void Add(Counter c, uint64_t n = 1) {
+        if(!Enabled()) return;
+        Increment(Local().counters[c], n);
+    }
+    static void Record(Histogram h, uint64_t value) {
+        if(!Enabled()) return;
+        Block::Hist& b = Local().histograms[h];
+        Increment(b.buckets[HistogramSnapshot::Bucket(value)], 1);
+        Increment(b.count, 1);
+        Increment(b.sum, value);
+    }
+    //nanoseconds
+    static void Record(Histogram h, Duration d) {
+        Record(h, uint64_t(std::chrono::duration_cast<
+                               std::chrono::nanoseconds >(d).count()));
+    }
+    //sum over all threads, including exited ones, since the last Reset
+    static Snapshot Take() {
+        Registry& r = GetRegistry();
+        std::lock_guard< std::mutex > guard(r.mutex);
+        Snapshot s = r.retired;
+        for(auto b: r.live) Accumulate(s, *b);
+        Subtract(s, r.baseline);
+        return s;
+    }
+    //blocks are never written by other threads: resetting sets a baseline
+    //which is subtracted from later snapshots
+    static void Reset() {
+        Registry& r = GetRegistry();
+        std::lock_guard< std::mutex > guard(r.mutex);
+        Snapshot s = r.retired;
+        for(auto b: r.live) Accumulate(s, *b);
+        r.baseline = s;
+    }
+    static const char* Name(Counter c) {
+        static const char* names[NUM_COUNTERS] = {
+            "compress_bytes_in", "compress_bytes_out",
+            "decompress_bytes_in", "decompress_bytes_out",
+            "transform_bytes_in", "transform_bytes_out",
+            "pool_hits", "pool_misses"};
+        return names[c];
+    }
+    static const char* Name(Histogram h) {
+        static const char* names[NUM_HISTOGRAMS] = {
+            "compress_ns", "decompress_ns", "transform_ns",
+            "task_queue_depth", "pipeline_depth"};
+        return names[h];
+    }
+private:
+    using Value = std::atomic< uint64_t >;
+    struct Block {
+        Block() {
+            for(auto& c: counters) c.store(0, std::memory_order_relaxed);
+            for(auto& h: histograms) {
+                for(auto& b: h.buckets) b.store(0, std::memory_order_relaxed);
+                h.count.store(0, std::memory_order_relaxed);
+                h.sum.store(0, std::memory_order_relaxed);
+            }
+        }
+        Value counters[NUM_COUNTERS];
+        struct Hist {
+            Value buckets[HistogramSnapshot::NUM_BUCKETS];
+            Value count;
+            Value sum;
+        } histograms[NUM_HISTOGRAMS];
+    };
+    struct Registry {
+        std::mutex mutex;
+        std::vector< Block* > live;
+        Snapshot retired; //totals of exited threads
+        Snapshot baseline;
+    };
+    //registers the block of the current thread, on thread exit the block
+    //totals are moved to the registry
+    struct Holder {
+        Holder() : block(new Block) {
+            Registry& r = GetRegistry();
+            std::lock_guard< std::mutex > guard(r.mutex);
+            r.live.push_back(block);
+        }
+        ~Holder() {
+            Registry& r = GetRegistry();
+            std::lock_guard< std::mutex > guard(r.mutex);
+            Accumulate(r.retired, *block);
+            r.live.erase(std::find(r.live.begin(), r.live.end(), block));
+            delete block;
+        }
+        Block* block;
+    };
+private:
+    //single writer: no read-modify-write instruction needed
+    static void Increment(Value& v, uint64_t n) {
+        v.store(v.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+    }
+    static void Accumulate(Snapshot& s, const Block& b) {
+        for(int c = 0; c != NUM_COUNTERS; ++c)
+            s.counters[c] += b.counters[c].load(std::memory_order_relaxed);
+        for(int h = 0; h != NUM_HISTOGRAMS; ++h) {
+            HistogramSnapshot& d = s.histograms[h];
+            const Block::Hist& src = b.histograms[h];
+            for(int i = 0; i != HistogramSnapshot::NUM_BUCKETS; ++i)
+                d.buckets[i] += src.buckets[i].load(std::memory_order_relaxed);
+            d.count += src.count.load(std::memory_order_relaxed);
+            d.sum += src.sum.load(std::memory_order_relaxed);
+        }
+    }
+    static void Subtract(Snapshot& s, const Snapshot& b) {
+        for(int c = 0; c != NUM_COUNTERS; ++c)
+            s.counters[c] -= b.counters[c];
+        for(int h = 0; h != NUM_HISTOGRAMS; ++h) {
+            HistogramSnapshot& d = s.histograms[h];
+            const HistogramSnapshot& o = b.histograms[h];
+            for(int i = 0; i != HistogramSnapshot::NUM_BUCKETS; ++i)
+                d.buckets[i] -= o.buckets[i];
+            d.count -= o.count;
+            d.sum -= o.sum;
+        }
+    }
+    static Block& Local() {
+        static thread_local Holder holder;
+        return *holder.block;
+    }
+    //never destroyed: threads may exit after static destructors have run
+    static Registry& GetRegistry() {
+        static Registry* r = new Registry;
+        return *r;
+    }
+    static std::atomic< bool >& Enabled_() {
+        static std::atomic< bool > enabled(true);
+        return enabled;
+    }
+};
+
+//one line per non zero metric; durations in microseconds
+inline std::ostream& operator<<(std::ostream& os,
+                                const Metrics::Snapshot& s) {
+    for(int c = 0; c != Metrics::NUM_COUNTERS; ++c) {
+        if(!s.counters[c]) continue;
+        os << Metrics::Name(Metrics::Counter(c)) << ": " << s.counters[c]
+           << '\n';
+    }
+    for(int i = 0; i != Metrics::NUM_HISTOGRAMS; ++i) {
+        const Metrics::Histogram h = Metrics::Histogram(i);
+        const HistogramSnapshot& v = s[h];
+        if(!v.count) continue;
+        const bool ns = h <= Metrics::TRANSFORM_NS;
+        const double scale = ns ? 1E-3 : 1;
+        os << Metrics::Name(h) << ": count " << v.count
+           << " mean " << v.Mean() * scale
+           << " p50 " << v.Percentile(0.5) * scale
+           << " p99 " << v.Percentile(0.99) * scale
+           << " max " << v.Max() * scale << (ns ? " us" : "") << '\n';
+    }
+    return os;
+}
+}
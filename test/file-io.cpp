@@ -0,0 +1,135 @@
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Files per second when reading and decompressing a directory of JPEG files
+//and when writing them back: stream based I/O (previous test harness) vs
+//memory mapped reader and batched writer
+
+#include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "JPEGFileWriter.h"
+#include "MappedFile.h"
+#include "TJDeCompressor.h"
+#include "timing.h"
+
+using namespace std;
+using namespace tjpp;
+
+//previous test harness: read whole file to measure it, then copy it
+size_t FileSize(const string& fname) {
+    ifstream file(fname);
+    assert(file);
+    file.ignore( std::numeric_limits<std::streamsize>::max() );
+    std::streamsize length = file.gcount();
+    file.clear();   //  Since ignore will have set eof.
+    return length;
+}
+
+vector< unsigned char > StreamRead(const string& fname) {
+    vector< unsigned char > data(FileSize(fname));
+    ifstream is(fname, ios::binary);
+    is.read((char*) data.data(), data.size());
+    return data;
+}
+
+void ReadHeader(tjhandle h, const unsigned char* data, size_t size) {
+    int w = 0, ht = 0, ss = 0, cs = 0;
+    if(tjDecompressHeader3(h, data, size, &w, &ht, &ss, &cs))
+        throw runtime_error(tjGetErrorStr());
+}
+
+double Seconds(Duration d) {
+    return chrono::duration< double >(d).count();
+}
+
+void Report(const string& name, size_t files, Duration d) {
+    cout << name << ":\t" << files / Seconds(d) << " files/s" << endl;
+}
+
+int main(int argc, char** argv) {
+    if(argc < 3) {
+        cerr << "usage: " << argv[0]
+             << " <jpeg directory> <output directory> [direct I/O=0]"
+             << endl;
+        return EXIT_FAILURE;
+    }
+    const MappedDirectory dir(argv[1]);
+    const string out = argv[2];
+    const bool direct = argc > 3 && strtol(argv[3], nullptr, 10) != 0;
+    const size_t n = dir.Size();
+    if(n == 0) {
+        cerr << "no JPEG files in " << argv[1] << endl;
+        return EXIT_FAILURE;
+    }
+    TJDeCompressor d;
+    Image img;
+    tjhandle h = tjInitDecompress();
+    //header only: I/O bound
+    Time begin = Tick();
+    for(size_t i = 0; i != n; ++i) {
+        const vector< unsigned char > data = StreamRead(dir.Path(i));
+        ReadHeader(h, data.data(), data.size());
+    }
+    Report("stream read", n, Tick() - begin);
+    begin = Tick();
+    for(size_t i = 0; i != n; ++i) {
+        const MappedFile f = dir.Map(i);
+        ReadHeader(h, f.Data(), f.Size());
+    }
+    Report("mapped read", n, Tick() - begin);
+    //read and decompress
+    begin = Tick();
+    for(size_t i = 0; i != n; ++i) {
+        const vector< unsigned char > data = StreamRead(dir.Path(i));
+        img = d.DeCompress(move(img), data.data(), data.size(), TJPF_RGB);
+    }
+    Report("stream read + decompress", n, Tick() - begin);
+    begin = Tick();
+    for(size_t i = 0; i != n; ++i) {
+        const MappedFile f = dir.Map(i);
+        img = d.DeCompress(move(img), f.Data(), f.Size(), TJPF_RGB);
+    }
+    Report("mapped read + decompress", n, Tick() - begin);
+    //write
+    vector< MappedFile > files;
+    for(size_t i = 0; i != n; ++i) files.push_back(dir.Map(i));
+    begin = Tick();
+    for(size_t i = 0; i != n; ++i) {
+        ofstream os(out + "/" + to_string(i) + ".jpg", ios::binary);
+        assert(os);
+        os.write((const char*) files[i].Data(), files[i].Size());
+    }
+    Report("stream write", n, Tick() - begin);
+    begin = Tick();
+    {
+        JPEGFileWriter w(direct);
+        for(size_t i = 0; i != n; ++i)
+            w.Add(out + "/" + to_string(i) + ".jpg", files[i].Data(),
+                  files[i].Size());
+        w.Flush();
+    }
+    Report(direct ? "batched write (direct)" : "batched write", n,
+           Tick() - begin);
+    tjDestroy(h);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,262 @@
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+//NUMA placement benchmark for TJParallelDeCompressor: decodes the same
+//stripes with the output image placed in different ways and reports
+//latency together with the fraction of output pages written and input
+//pages read across nodes, as JSON.
+//Scenarios:
+//  single-touch       default placement, output allocated and touched by
+//                     the main thread: all pages on one node
+//  default            default placement, pages first touched by whichever
+//                     worker decodes them on the first call
+//  numa               NUMA_PLACEMENT, pages first touched by the worker
+//                     decoding them
+//  numa-single-touch  NUMA_PLACEMENT with an output touched by the main
+//                     thread: stripes follow the pages as far as the
+//                     workers of their node allow
+//On a single node machine all fractions are zero and the scenarios only
+//differ by the scheduling overhead.
+//usage: numa-bench [--name=value ...]
+//  --image=<file.jpg>     default: synthetic image
+//  --synthetic=<WxH>      default: 7680x4320
+//  --stacks=<n>           default: hardware threads
+//  --quality=<q>          default: 90
+//  --warmup=2 --reps=20
+//  --out=<file>           JSON output, default: stdout
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MappedFile.h"
+#include "Numa.h"
+#include "TJCompressor.h"
+#include "TJDeCompressor.h"
+#include "TJParallelCompressor.h"
+#include "TJParallelDeCompressor.h"
+#include "timing.h"
+
+using namespace std;
+using namespace tjpp;
+
+using Args = map< string, string >;
+
+struct Result {
+    string scenario;
+    vector< double > latencies; //seconds
+    vector< size_t > pagesPerNode;
+    double remoteWrites; //output pages not on the node of the decoding cpu
+    double remoteReads;  //input pages not on the node of the decoding cpu
+};
+
+string Get(const Args& a, const string& k, const string& def) {
+    auto i = a.find(k);
+    return i == a.end() ? def : i->second;
+}
+
+//smooth gradients plus noise, same as tjpp-bench
+Image Synthetic(int w, int h) {
+    Image img;
+    img.SetParameters(w, h, TJPF_RGB);
+    img.Allocate(img.Size());
+    unsigned char* p = img.DataPtr();
+    unsigned int seed = 12345;
+    for(int y = 0; y != h; ++y) {
+        for(int x = 0; x != w; ++x, p += 3) {
+            seed = seed * 1103515245 + 12345;
+            const int n = int((seed >> 16) & 15) - 8;
+            p[0] = (unsigned char)std::max(0, std::min(255, x * 255 / w + n));
+            p[1] = (unsigned char)std::max(0, std::min(255, y * 255 / h + n));
+            p[2] = (unsigned char)std::max(0, std::min(255,
+                (x + y) * 255 / (w + h) + n));
+        }
+    }
+    return img;
+}
+
+double Percentile(vector< double > l, double q) {
+    sort(l.begin(), l.end());
+    return l[min(l.size() - 1, size_t(q * l.size()))];
+}
+
+//fraction of the pages of each stripe not on the node stripe i was
+//decoded on; pages not present are not counted
+double RemoteFraction(const vector< const unsigned char* >& begin,
+                      const vector< size_t >& size,
+                      const vector< int >& stripeNodes) {
+    size_t pages = 0;
+    size_t remote = 0;
+    for(size_t s = 0; s != begin.size(); ++s) {
+        for(int n: PageNodes(begin[s], size[s])) {
+            if(n < 0) continue;
+            ++pages;
+            if(n != stripeNodes[s]) ++remote;
+        }
+    }
+    return pages ? double(remote) / pages : 0;
+}
+
+Result Run(const string& scenario,
+           TJParallelDeCompressor& d,
+           const vector< JPEGImage >& stripes,
+           bool touch,
+           int warmup,
+           int reps) {
+    Image img;
+    if(touch) {
+        img.SetParameters(stripes.front().Width(), 0, TJPF_RGB);
+        size_t size = 0;
+        for(auto& s: stripes)
+            size += size_t(s.Width()) * s.Height() * 3;
+        img.Allocate(size);
+        memset(img.DataPtr(), 0, size);
+    }
+    Result r;
+    r.scenario = scenario;
+    for(int i = 0; i != warmup + reps; ++i) {
+        const Time begin = Tick();
+        img = d.DeCompress(std::move(img), stripes);
+        if(i >= warmup)
+            r.latencies.push_back(
+                chrono::duration< double >(Tick() - begin).count());
+    }
+    const NumaTopology& t = NumaTopology::Get();
+    r.pagesPerNode.assign(t.NumNodes(), 0);
+    for(int n: PageNodes(img.DataPtr(), img.Size()))
+        if(n >= 0) ++r.pagesPerNode[n];
+    vector< const unsigned char* > out, in;
+    vector< size_t > outSize, inSize;
+    size_t y = 0;
+    for(auto& s: stripes) {
+        out.push_back(img.DataPtr() + y * img.Width() * 3);
+        outSize.push_back(size_t(s.Width()) * s.Height() * 3);
+        in.push_back(s.DataPtr());
+        inSize.push_back(s.CompressedSize());
+        y += s.Height();
+    }
+    r.remoteWrites = RemoteFraction(out, outSize, d.StripeNodes());
+    r.remoteReads = RemoteFraction(in, inSize, d.StripeNodes());
+    return r;
+}
+
+void WriteJSON(ostream& os, int width, int height, int stacks,
+               const vector< Result >& results) {
+    const NumaTopology& t = NumaTopology::Get();
+    os << "{\n  \"threads\": " << thread::hardware_concurrency()
+       << ",\n  \"nodes\": " << t.NumNodes()
+       << ",\n  \"width\": " << width
+       << ",\n  \"height\": " << height
+       << ",\n  \"stacks\": " << stacks
+       << ",\n  \"results\": [";
+    for(size_t i = 0; i != results.size(); ++i) {
+        const Result& r = results[i];
+        const double p50 = Percentile(r.latencies, 0.5);
+        os << (i ? "," : "") << "\n    {"
+           << "\"scenario\": \"" << r.scenario << "\", "
+           << "\"reps\": " << r.latencies.size() << ", "
+           << "\"mpixels_per_s\": " << double(width) * height / p50 / 1E6
+           << ", "
+           << "\"p50_ms\": " << p50 * 1E3 << ", "
+           << "\"p99_ms\": " << Percentile(r.latencies, 0.99) * 1E3 << ", "
+           << "\"remote_write_fraction\": " << r.remoteWrites << ", "
+           << "\"remote_read_fraction\": " << r.remoteReads << ", "
+           << "\"pages_per_node\": [";
+        for(size_t n = 0; n != r.pagesPerNode.size(); ++n)
+            os << (n ? ", " : "") << r.pagesPerNode[n];
+        os << "]}";
+    }
+    os << "\n  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+    Args args;
+    for(int i = 1; i < argc; ++i) {
+        const string a = argv[i];
+        const size_t eq = a.find('=');
+        if(a.compare(0, 2, "--") != 0 || eq == string::npos) {
+            cerr << "invalid argument " << a << ", see " << __FILE__
+                 << " for usage" << endl;
+            return EXIT_FAILURE;
+        }
+        args[a.substr(2, eq - 2)] = a.substr(eq + 1);
+    }
+    try {
+        Image img;
+        const string image = Get(args, "image", "");
+        if(!image.empty()) {
+            const MappedFile f(image);
+            TJDeCompressor d;
+            img = d.DeCompress(f.Data(), f.Size(), TJPF_RGB);
+        } else {
+            const string s = Get(args, "synthetic", "7680x4320");
+            const size_t x = s.find('x');
+            img = Synthetic(stoi(s.substr(0, x)), stoi(s.substr(x + 1)));
+        }
+        const int hw = max(1u, thread::hardware_concurrency());
+        const int stacks = max(1, stoi(Get(args, "stacks",
+                                           to_string(hw))));
+        const int quality = stoi(Get(args, "quality", "90"));
+        const int warmup = stoi(Get(args, "warmup", "2"));
+        const int reps = max(1, stoi(Get(args, "reps", "20")));
+        TJParallelCompressor< TJCompressor > c(stacks);
+        const vector< JPEGImage > stripes =
+            c.Compress(img.View(), stacks, TJSAMP_420, quality);
+
+        vector< Result > results;
+        {
+            TJParallelDeCompressor d(stacks, 0, true);
+            results.push_back(Run("single-touch", d, stripes, true,
+                                  warmup, reps));
+        }
+        {
+            TJParallelDeCompressor d(stacks, 0, true);
+            results.push_back(Run("default", d, stripes, false,
+                                  warmup, reps));
+        }
+        {
+            TJParallelDeCompressor d(stacks,
+                                     TJParallelDeCompressor::NUMA_PLACEMENT);
+            results.push_back(Run("numa", d, stripes, false, warmup, reps));
+        }
+        {
+            TJParallelDeCompressor d(stacks,
+                                     TJParallelDeCompressor::NUMA_PLACEMENT);
+            results.push_back(Run("numa-single-touch", d, stripes, true,
+                                  warmup, reps));
+        }
+        const string out = Get(args, "out", "");
+        if(out.empty()) {
+            WriteJSON(cout, int(img.Width()), int(img.Height()), stacks,
+                      results);
+        } else {
+            ofstream os(out);
+            if(!os) throw runtime_error("Cannot open " + out);
+            WriteJSON(os, int(img.Width()), int(img.Height()), stacks,
+                      results);
+        }
+    } catch(const exception& e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
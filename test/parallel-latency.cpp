@@ -0,0 +1,176 @@
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Per-frame latency of parallel compression and decompression:
+//std::async per stripe (previous implementation) vs persistent worker pool
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "TJCompressor.h"
+#include "TJDeCompressor.h"
+#include "TJParallelCompressor.h"
+#include "TJParallelDeCompressor.h"
+#include "timing.h"
+
+using namespace std;
+using namespace tjpp;
+
+using Latencies = vector< double >; //microseconds
+
+double ToUs(Duration d) {
+    return chrono::duration_cast< chrono::nanoseconds >(d).count() / 1000.0;
+}
+
+void Report(const string& name, Latencies l) {
+    sort(begin(l), end(l));
+    auto p = [&l](double q) {
+        return l[min(l.size() - 1, size_t(q * l.size()))];
+    };
+    cout << name << ":\tp50 " << p(0.5) << " us\tp90 " << p(0.9)
+         << " us\tp99 " << p(0.99) << " us\tmax " << l.back() << " us"
+         << endl;
+}
+
+//previous TJParallelCompressor implementation: one std::async per stripe
+Latencies AsyncCompress(const Image& img, int stacks, int frames,
+                        int quality) {
+    vector< TJCompressor > compressors(stacks);
+    vector< JPEGImage > images(stacks);
+    const int width = int(img.Width());
+    const int height = int(img.Height());
+    const TJPF pf = img.PixelFormat();
+    const int h = height / stacks;
+    const int nc = NumComponents(pf);
+    Latencies l;
+    for(int f = 0; f != frames; ++f) {
+        const Time begin = Tick();
+        vector< future< void > > tasks;
+        for(int s = 0; s != stacks; ++s) {
+            const int sh = s == stacks - 1 ? height - (stacks - 1) * h : h;
+            tasks.push_back(async(launch::async, [&, s, sh]() {
+                images[s] = compressors[s].Compress(img.DataPtr(), width, sh,
+                                                    pf, TJSAMP_420, quality,
+                                                    s * h * width * nc);
+            }));
+        }
+        for(auto& t: tasks) t.get();
+        l.push_back(ToUs(Tick() - begin));
+    }
+    return l;
+}
+
+Latencies PoolCompress(const Image& img, int stacks, int frames, int quality,
+                       bool pin, vector< JPEGImage >& out) {
+    TJParallelCompressor< TJCompressor > pc(stacks, pin);
+    Latencies l;
+    for(int f = 0; f != frames; ++f) {
+        const Time begin = Tick();
+        out = pc.Compress(img.DataPtr(), stacks, int(img.Width()),
+                          int(img.Height()), img.PixelFormat(), TJSAMP_420,
+                          quality);
+        l.push_back(ToUs(Tick() - begin));
+    }
+    return l;
+}
+
+//previous TJParallelDeCompressor implementation: one std::async per stripe
+Latencies AsyncDeCompress(const vector< JPEGImage >& stripes, int frames) {
+    vector< tjhandle > handles(stripes.size());
+    for(auto& h: handles) h = tjInitDecompress();
+    const int width = stripes.front().Width();
+    const TJPF pf = stripes.front().PixelFormat();
+    size_t height = 0;
+    for(auto& s: stripes) height += s.Height();
+    vector< unsigned char > out(width * height * NumComponents(pf));
+    Latencies l;
+    for(int f = 0; f != frames; ++f) {
+        const Time begin = Tick();
+        vector< future< void > > tasks;
+        size_t offset = 0;
+        for(size_t s = 0; s != stripes.size(); ++s) {
+            unsigned char* dest = out.data() + offset;
+            tasks.push_back(async(launch::async, [&, s, dest]() {
+                if(tjDecompress2(handles[s], stripes[s].DataPtr(),
+                                 stripes[s].CompressedSize(), dest,
+                                 width, 0, stripes[s].Height(), pf,
+                                 TJFLAG_FASTDCT))
+                    throw runtime_error(tjGetErrorStr());
+            }));
+            offset += width * stripes[s].Height() * NumComponents(pf);
+        }
+        for(auto& t: tasks) t.get();
+        l.push_back(ToUs(Tick() - begin));
+    }
+    for(auto& h: handles) tjDestroy(h);
+    return l;
+}
+
+Latencies PoolDeCompress(const vector< JPEGImage >& stripes, int frames,
+                         bool pin) {
+    size_t height = 0;
+    for(auto& s: stripes) height += s.Height();
+    TJParallelDeCompressor pd(int(stripes.size()),
+                              stripes.front().Width() * height
+                              * stripes.front().NumPlanes(), pin);
+    Image img;
+    Latencies l;
+    for(int f = 0; f != frames; ++f) {
+        const Time begin = Tick();
+        img = pd.DeCompress(move(img), stripes);
+        l.push_back(ToUs(Tick() - begin));
+    }
+    return l;
+}
+
+int main(int argc, char** argv) {
+    if(argc < 4) {
+        cerr << "usage: " << argv[0]
+             << " <jpeg file> <num frames> <num stripes> [quality=75]"
+             << endl;
+        return EXIT_FAILURE;
+    }
+    ifstream is(argv[1], ios::binary);
+    assert(is);
+    vector< unsigned char > input((istreambuf_iterator< char >(is)),
+                                  istreambuf_iterator< char >());
+    const int frames = strtol(argv[2], nullptr, 10);
+    const int stacks = strtol(argv[3], nullptr, 10);
+    const int quality = argc > 4 ? strtol(argv[4], nullptr, 10) : 75;
+    assert(frames > 0 && stacks > 0);
+    TJDeCompressor d;
+    const Image img = d.DeCompress(input.data(), input.size(), TJPF_RGBX);
+    cout << img.Width() << " x " << img.Height() << ", "
+         << frames << " frames, " << stacks << " stripes" << endl;
+
+    vector< JPEGImage > stripes;
+    Report("compress   async", AsyncCompress(img, stacks, frames, quality));
+    Report("compress   pool", PoolCompress(img, stacks, frames, quality,
+                                           false, stripes));
+    Report("compress   pinned pool", PoolCompress(img, stacks, frames,
+                                                  quality, true, stripes));
+    Report("decompress async", AsyncDeCompress(stripes, frames));
+    Report("decompress pool", PoolDeCompress(stripes, frames, false));
+    Report("decompress pinned pool", PoolDeCompress(stripes, frames, true));
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,415 @@
+//Author: Ugo Varetto
+//
+// This file is part of tjpp.
+//tjpp is free software: you can redistribute it and/or modify
+//it under the terms of the GNU General Public License as published by
+//the Free Software Foundation, either version 3 of the License, or
+//(at your option) any later version.
+//
+//tjpp is distributed in the hope that it will be useful,
+//but WITHOUT ANY WARRANTY; without even the implied warranty of
+//MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//GNU General Public License for more details.
+//
+//You should have received a copy of the GNU General Public License
+//along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
+
+//Benchmark suite: sweeps images, pixel formats, chrominance subsampling,
+//quality, flags and stack counts for every compressor class and the
+//decompressors; reports megapixels/s, bytes/pixel and p50/p99 latency as
+//JSON.
+//usage: tjpp-bench [--name=value ...], list values are comma separated
+//  --images=<dir or .jpg files>   corpus, default: test-images
+//  --synthetic=<WxH,...>          generated images, default: 7680x4320
+//  --formats=rgb,bgrx,...         default: rgb,bgrx
+//  --subsampling=420,422,444,gray default: 420,444
+//  --quality=75,95                default: 75,95
+//  --flags=fastdct,accuratedct,progressive,fastdct+progressive
+//                                 default: fastdct
+//  --stacks=1,2,4,auto            default: 1, 2, 4... up to hardware threads
+//                                 auto (reported as 0): stripe count
+//                                 selected by TJParallelCompressor
+//  --warmup=2 --reps=10
+//  --out=<file>                   JSON output, default: stdout
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "MappedFile.h"
+#include "PixelConversion.h"
+#include "TJBatchCompressor.h"
+#include "TJCompressor.h"
+#include "TJDeCompressor.h"
+#include "TJMemPoolCompressor.h"
+#include "TJParallelCompressor.h"
+#include "TJParallelDeCompressor.h"
+#include "timing.h"
+
+using namespace std;
+using namespace tjpp;
+
+using Args = map< string, string >;
+
+struct Input {
+    string name;
+    Image image; //RGB
+};
+
+struct Config {
+    TJPF pf;
+    TJSAMP ss;
+    int quality;
+    int flags;
+    string flagNames;
+    int stacks;
+};
+
+struct Result {
+    string op;
+    string cls;
+    string image;
+    int width;
+    int height;
+    Config config;
+    vector< double > latencies; //seconds
+    size_t pixels;              //per repetition
+    size_t bytes;               //compressed size, per repetition
+};
+
+vector< string > Split(const string& s, char sep = ',') {
+    vector< string > v;
+    stringstream ss(s);
+    string t;
+    while(getline(ss, t, sep)) if(!t.empty()) v.push_back(t);
+    return v;
+}
+
+const map< string, TJPF >& Formats() {
+    static const map< string, TJPF > f = {
+        {"rgb", TJPF_RGB}, {"bgr", TJPF_BGR}, {"rgbx", TJPF_RGBX},
+        {"bgrx", TJPF_BGRX}, {"xbgr", TJPF_XBGR}, {"xrgb", TJPF_XRGB},
+        {"gray", TJPF_GRAY}, {"rgba", TJPF_RGBA}, {"bgra", TJPF_BGRA},
+        {"abgr", TJPF_ABGR}, {"argb", TJPF_ARGB}};
+    return f;
+}
+
+const map< string, TJSAMP >& SubSamplings() {
+    static const map< string, TJSAMP > s = {
+        {"444", TJSAMP_444}, {"422", TJSAMP_422}, {"420", TJSAMP_420},
+        {"gray", TJSAMP_GRAY}, {"440", TJSAMP_440}, {"411", TJSAMP_411}};
+    return s;
+}
+
+const map< string, int >& Flags() {
+    static const map< string, int > f = {
+        {"fastdct", TJFLAG_FASTDCT}, {"accuratedct", TJFLAG_ACCURATEDCT},
+        {"progressive", TJFLAG_PROGRESSIVE},
+        {"fastupsample", TJFLAG_FASTUPSAMPLE}};
+    return f;
+}
+
+template < typename T >
+string Name(const map< string, T >& m, T v) {
+    for(auto& e: m) if(e.second == v) return e.first;
+    return to_string(int(v));
+}
+
+template < typename T >
+T Lookup(const map< string, T >& m, const string& k) {
+    auto i = m.find(k);
+    if(i == m.end()) throw invalid_argument("Unknown value " + k);
+    return i->second;
+}
+
+string Get(const Args& a, const string& k, const string& def) {
+    auto i = a.find(k);
+    return i == a.end() ? def : i->second;
+}
+
+bool IsDirectory(const string& p) {
+    struct stat st;
+    return stat(p.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+string BaseName(const string& p) {
+    const size_t s = p.find_last_of('/');
+    return s == string::npos ? p : p.substr(s + 1);
+}
+
+vector< Input > LoadCorpus(const string& spec) {
+    vector< string > paths;
+    for(auto& p: Split(spec)) {
+        if(IsDirectory(p)) {
+            MappedDirectory d(p);
+            for(size_t i = 0; i != d.Size(); ++i) paths.push_back(d.Path(i));
+        } else {
+            paths.push_back(p);
+        }
+    }
+    vector< Input > inputs;
+    TJDeCompressor d;
+    for(auto& p: paths) {
+        const MappedFile f(p);
+        inputs.push_back(Input{BaseName(p),
+                               d.DeCompress(f.Data(), f.Size(), TJPF_RGB)});
+    }
+    return inputs;
+}
+
+//smooth gradients plus noise: compresses like a photograph rather than a
+//flat or random image
+Image Synthetic(int w, int h) {
+    Image img;
+    img.SetParameters(w, h, TJPF_RGB);
+    img.Allocate(img.Size());
+    unsigned char* p = img.DataPtr();
+    unsigned int seed = 12345;
+    for(int y = 0; y != h; ++y) {
+        for(int x = 0; x != w; ++x, p += 3) {
+            seed = seed * 1103515245 + 12345;
+            const int n = int((seed >> 16) & 15) - 8;
+            p[0] = (unsigned char)std::max(0, std::min(255, x * 255 / w + n));
+            p[1] = (unsigned char)std::max(0, std::min(255, y * 255 / h + n));
+            p[2] = (unsigned char)std::max(0, std::min(255,
+                (x + y) * 255 / (w + h) + n));
+        }
+    }
+    return img;
+}
+
+template < typename F >
+vector< double > Measure(int warmup, int reps, F f) {
+    for(int i = 0; i != warmup; ++i) f();
+    vector< double > l;
+    for(int i = 0; i != reps; ++i) {
+        const Time begin = Tick();
+        f();
+        l.push_back(chrono::duration< double >(Tick() - begin).count());
+    }
+    return l;
+}
+
+double Percentile(vector< double > l, double q) {
+    sort(l.begin(), l.end());
+    return l[min(l.size() - 1, size_t(q * l.size()))];
+}
+
+size_t TotalSize(const vector< JPEGImage >& v) {
+    size_t s = 0;
+    for(auto& i: v) s += i.CompressedSize();
+    return s;
+}
+
+void WriteJSON(ostream& os, const vector< Result >& results) {
+    os << "{\n  \"threads\": " << thread::hardware_concurrency()
+       << ",\n  \"isa\": \"" << PixelConverter::Isa()
+       << "\",\n  \"results\": [";
+    for(size_t i = 0; i != results.size(); ++i) {
+        const Result& r = results[i];
+        const double p50 = Percentile(r.latencies, 0.5);
+        const double p99 = Percentile(r.latencies, 0.99);
+        os << (i ? "," : "") << "\n    {"
+           << "\"op\": \"" << r.op << "\", "
+           << "\"class\": \"" << r.cls << "\", "
+           << "\"image\": \"" << r.image << "\", "
+           << "\"width\": " << r.width << ", "
+           << "\"height\": " << r.height << ", "
+           << "\"format\": \"" << Name(Formats(), r.config.pf) << "\", "
+           << "\"subsampling\": \"" << Name(SubSamplings(), r.config.ss)
+           << "\", "
+           << "\"quality\": " << r.config.quality << ", "
+           << "\"flags\": \"" << r.config.flagNames << "\", "
+           << "\"stacks\": " << r.config.stacks << ", "
+           << "\"reps\": " << r.latencies.size() << ", "
+           << "\"mpixels_per_s\": " << r.pixels / p50 / 1E6 << ", "
+           << "\"bytes_per_pixel\": " << double(r.bytes) / r.pixels << ", "
+           << "\"p50_ms\": " << p50 * 1E3 << ", "
+           << "\"p99_ms\": " << p99 * 1E3 << "}";
+    }
+    os << "\n  ]\n}\n";
+}
+
+//all compressors and decompressors for one image and configuration
+void Run(const Input& in, const Image& img, const Config& c, int warmup,
+         int reps, vector< Result >& results) {
+    const int w = int(img.Width());
+    const int h = int(img.Height());
+    const size_t pixels = size_t(w) * h;
+    const ImageView view = img.View();
+    auto add = [&](const string& op, const string& cls, int stacks,
+                   const vector< double >& l, size_t px, size_t bytes) {
+        Config cfg = c;
+        cfg.stacks = stacks;
+        results.push_back(Result{op, cls, in.name, w, h, cfg, l, px, bytes});
+    };
+    {
+        TJCompressor comp;
+        JPEGImage j;
+        auto l = Measure(warmup, reps, [&]() {
+            j = comp.Compress(move(j), view, c.ss, c.quality, c.flags);
+        });
+        add("compress", "TJCompressor", 1, l, pixels, j.CompressedSize());
+        TJDeCompressor d;
+        Image out;
+        l = Measure(warmup, reps, [&]() {
+            out = d.DeCompress(move(out), j.DataPtr(), j.CompressedSize(),
+                               c.pf, c.flags);
+        });
+        add("decompress", "TJDeCompressor", 1, l, pixels,
+            j.CompressedSize());
+    }
+    {
+        TJMemPoolCompressor comp;
+        size_t bytes = 0;
+        auto l = Measure(warmup, reps, [&]() {
+            bytes = comp.Compress(view, c.ss, c.quality, c.flags)
+                        .Image().CompressedSize();
+        });
+        add("compress", "TJMemPoolCompressor", 1, l, pixels, bytes);
+    }
+    {
+        TJParallelCompressor< TJCompressor > comp(c.stacks);
+        vector< JPEGImage > stripes;
+        auto l = Measure(warmup, reps, [&]() {
+            stripes = comp.Compress(move(stripes), view.DataPtr(), c.stacks,
+                                    w, h, c.pf, c.ss, c.quality, 0, c.flags,
+                                    view.Pitch());
+        });
+        add("compress", "TJParallelCompressor", c.stacks, l, pixels,
+            TotalSize(stripes));
+        TJParallelDeCompressor d(int(stripes.size()));
+        Image out;
+        l = Measure(warmup, reps, [&]() {
+            out = d.DeCompress(move(out), stripes, c.flags);
+        });
+        add("decompress", "TJParallelDeCompressor", c.stacks, l, pixels,
+            TotalSize(stripes));
+    }
+    if(!(c.flags & TJFLAG_PROGRESSIVE)) {
+        TJParallelCompressor< TJCompressor > comp(c.stacks);
+        JPEGImage j;
+        auto l = Measure(warmup, reps, [&]() {
+            j = comp.CompressSingleStream(move(j), view.DataPtr(), c.stacks,
+                                          w, h, c.pf, c.ss, c.quality, 0,
+                                          c.flags, view.Pitch());
+        });
+        add("compress", "TJParallelCompressor::CompressSingleStream",
+            c.stacks, l, pixels, j.CompressedSize());
+        const int hw = int(max(1u, thread::hardware_concurrency()));
+        TJParallelDeCompressor d(c.stacks ? c.stacks : hw);
+        Image out;
+        l = Measure(warmup, reps, [&]() {
+            out = d.DeCompress(move(out), j.DataPtr(), j.CompressedSize(),
+                               c.pf, c.flags);
+        });
+        add("decompress", "TJParallelDeCompressor (restart)", c.stacks, l,
+            pixels, j.CompressedSize());
+    }
+    if(c.stacks > 0) {
+        //stacks independent copies of the image
+        TJBatchCompressor comp(c.stacks);
+        const vector< ImageView > views(c.stacks, view);
+        size_t bytes = 0;
+        auto l = Measure(warmup, reps, [&]() {
+            vector< PooledJPEGImage > out =
+                comp.CompressBatch(views, c.ss, c.quality, c.flags);
+            bytes = 0;
+            for(auto& o: out) bytes += o.Image().CompressedSize();
+        });
+        add("compress", "TJBatchCompressor", c.stacks, l,
+            pixels * c.stacks, bytes);
+    }
+}
+
+int main(int argc, char** argv) {
+    Args args;
+    for(int i = 1; i < argc; ++i) {
+        const string a = argv[i];
+        const size_t eq = a.find('=');
+        if(a.compare(0, 2, "--") != 0 || eq == string::npos) {
+            cerr << "invalid argument " << a << ", see " << __FILE__
+                 << " for usage" << endl;
+            return EXIT_FAILURE;
+        }
+        args[a.substr(2, eq - 2)] = a.substr(eq + 1);
+    }
+    const int hw = max(1u, thread::hardware_concurrency());
+    string defaultStacks = "1";
+    for(int s = 2; s <= hw; s *= 2) defaultStacks += "," + to_string(s);
+    try {
+        vector< Input > inputs = LoadCorpus(Get(args, "images",
+                                                "test-images"));
+        for(auto& s: Split(Get(args, "synthetic", "7680x4320"))) {
+            const size_t x = s.find('x');
+            const int w = stoi(s.substr(0, x));
+            const int h = stoi(s.substr(x + 1));
+            inputs.push_back(Input{"synthetic-" + s, Synthetic(w, h)});
+        }
+        vector< TJPF > formats;
+        for(auto& f: Split(Get(args, "formats", "rgb,bgrx")))
+            formats.push_back(Lookup(Formats(), f));
+        vector< TJSAMP > subsamplings;
+        for(auto& s: Split(Get(args, "subsampling", "420,444")))
+            subsamplings.push_back(Lookup(SubSamplings(), s));
+        vector< int > qualities;
+        for(auto& q: Split(Get(args, "quality", "75,95")))
+            qualities.push_back(stoi(q));
+        vector< pair< int, string > > flags;
+        for(auto& f: Split(Get(args, "flags", "fastdct"))) {
+            int v = 0;
+            for(auto& n: Split(f, '+')) v |= Lookup(Flags(), n);
+            flags.push_back(make_pair(v, f));
+        }
+        vector< int > stacks;
+        for(auto& s: Split(Get(args, "stacks", defaultStacks)))
+            stacks.push_back(s == "auto" ? 0 : stoi(s));
+        const int warmup = stoi(Get(args, "warmup", "2"));
+        const int reps = max(1, stoi(Get(args, "reps", "10")));
+
+        vector< Result > results;
+        for(auto& in: inputs) {
+            for(TJPF pf: formats) {
+                Image img;
+                img.SetParameters(in.image.Width(), in.image.Height(), pf);
+                img.Allocate(img.Size());
+                ConvertPixels(in.image.View(), img.View());
+                for(TJSAMP ss: subsamplings)
+                    for(int q: qualities)
+                        for(auto& f: flags)
+                            for(int s: stacks) {
+                                const Config c = {pf, ss, q, f.first,
+                                                  f.second, s};
+                                cerr << in.name << " "
+                                     << Name(Formats(), pf) << " "
+                                     << Name(SubSamplings(), ss) << " q" << q
+                                     << " " << f.second << " stacks " << s
+                                     << endl;
+                                Run(in, img, c, warmup, reps, results);
+                            }
+            }
+        }
+        const string out = Get(args, "out", "");
+        if(out.empty()) {
+            WriteJSON(cout, results);
+        } else {
+            ofstream os(out);
+            if(!os) throw runtime_error("Cannot open " + out);
+            WriteJSON(os, results);
+        }
+    } catch(const exception& e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -14,18 +14,39 @@
 //You should have received a copy of the GNU General Public License
 //along with tjpp.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
 #include <vector>
 #include <cstring>
 #include <cassert>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
 
+#include "JPEGFileWriter.h"
+#include "MappedFile.h"
+#include "Numa.h"
+#include "PixelConversion.h"
+#include "StripeContainer.h"
+#include "TJAsyncCodec.h"
+#include "TJBatchCompressor.h"
+#include "TJBatchDeCompressor.h"
 #include "TJCompressor.h"
 #include "TJMemPoolCompressor.h"
 #include "TJDeCompressor.h"
+#include "TJApi.h"
+#include "TJHandlePool.h"
 #include "TJParallelCompressor.h"
 #include "TJParallelDeCompressor.h"
+#include "TJPyramid.h"
+#include "TJRateCompressor.h"
+#include "TJStreamPipeline.h"
+#include "TJTileEncoder.h"
+#include "TJTransformer.h"
 
 #ifdef TIMING__
 #include "timing.h"
@@ -35,17 +56,6 @@
 using namespace std;
 using namespace tjpp;
 
-size_t FileSize(const string& fname) {
-    ifstream file(fname);
-    assert(file);
-    file.ignore( std::numeric_limits<std::streamsize>::max() );
-    std::streamsize length = file.gcount();
-    file.clear();   //  Since ignore will have set eof.
-    //file.seekg( 0, std::ios_base::beg );
-    return length;
-}
-
-
 std::vector< JPEGImage >
 TestJPGParallelCompressor(const unsigned char* uimg,
                           int width,
@@ -66,17 +76,34 @@ TestJPGParallelCompressor(const unsigned char* uimg,
     Time end = Tick();
     cout << "multi - compression time: " << toms(end - begin).count() << endl;
 #endif
+    JPEGFileWriter w;
     for(int i = 0; i != images.size(); ++i) {
-        const string fname = "mout" + to_string(i) + ".jpg";
-        ofstream os(fname, ios::binary);
-        assert(os);
         assert(images[i].DataPtr());
-        os.write((char*)images[i].DataPtr(), images[i].CompressedSize());
-        //assert(images[i].Empty()); //moved!
+        w.Add("mout" + to_string(i) + ".jpg", images[i]);
     }
+    w.Flush();
     return images;
 }
 
+//a failed write drops the files written and the failed one, later files
+//stay queued
+void TestFileWriterError() {
+    const unsigned char data[] = {1, 2, 3};
+    JPEGFileWriter w;
+    w.Add("mout-w0.bin", data, sizeof(data));
+    w.Add("no-such-dir/mout-w1.bin", data, sizeof(data));
+    w.Add("mout-w2.bin", data, sizeof(data));
+    bool thrown = false;
+    try {
+        w.Flush();
+    } catch(const runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown && w.Pending() == 1);
+    w.Flush();
+    assert(MappedFile("mout-w2.bin").Size() == sizeof(data));
+}
+
 //note: very important to pre-allocate memory, especially for 4k images
 void TestJPGParallelDeCompressor(const vector< JPEGImage >& imgs) {
     const size_t globalHeight
@@ -112,6 +139,962 @@ void TestJPGParallelDeCompressor(const vector< JPEGImage >& imgs) {
 
 }
 
+//parallel compression into a single JPEG with restart markers: the output
+//must be readable by any decoder
+JPEGImage TestJPGSingleStreamCompressor(const unsigned char* uimg,
+                                        int width,
+                                        int height,
+                                        TJPF pf,
+                                        TJSAMP ss,
+                                        int quality,
+                                        int numStacks) {
+    TJParallelCompressor< TJCompressor > mc(numStacks);
+#ifdef TIMING__
+    Time begin = Tick();
+#endif
+    JPEGImage jimg = mc.CompressSingleStream(uimg, numStacks, width, height,
+                                             pf, ss, quality);
+#ifdef TIMING__
+    Time end = Tick();
+    cout << "multi - single stream compression time: "
+         << toms(end - begin).count() << endl;
+#endif
+    const string fname = "mout-single.jpg";
+    ofstream os(fname, ios::binary);
+    assert(os);
+    os.write((char*)jimg.DataPtr(), jimg.CompressedSize());
+    TJDeCompressor d;
+    Image img = d.DeCompress(jimg.DataPtr(), jimg.CompressedSize(), pf);
+    assert(img.Width() == size_t(width));
+    assert(img.Height() == size_t(height));
+    return jimg;
+}
+
+//parallel decompression of a single JPEG with restart markers
+void TestJPGRestartDeCompressor(const JPEGImage& jimg, int numStacks) {
+    TJParallelDeCompressor mc(numStacks, UncompressedSize(jimg));
+#ifdef TIMING__
+    Time begin = Tick();
+#endif
+    Image img = mc.DeCompress(jimg.DataPtr(), jimg.CompressedSize(),
+                              jimg.PixelFormat());
+#ifdef TIMING__
+    Time end = Tick();
+    cout << "multi - restart decompression time: "
+         << toms(end - begin).count() << endl;
+#endif
+    assert(img.Width() == size_t(jimg.Width()));
+    assert(img.Height() == size_t(jimg.Height()));
+    TJCompressor c;
+    JPEGImage out = c.Compress(img.DataPtr(),
+                               int(img.Width()),
+                               int(img.Height()),
+                               img.PixelFormat(),
+                               TJSAMP_420,
+                               50);
+    ofstream os("mout-restart.jpg", ios::binary);
+    assert(os);
+    os.write((char*)out.DataPtr(), out.CompressedSize());
+}
+
+//banded decode of a single stream matches a serial decode; with one
+//stripe per MCU row there is a restart marker on every row and chroma
+//subsampled images are decoded in bands with one MCU row of context
+void TestBandedDeCompressor(const Image& img, int quality, int numThreads) {
+    TJParallelCompressor< TJCompressor > c(numThreads);
+    TJDeCompressor serial;
+    const TJSAMP samplings[] = {TJSAMP_444, TJSAMP_422, TJSAMP_420};
+    for(auto ss: samplings) {
+        const int rows =
+            (int(img.Height()) + tjMCUHeight[ss] - 1) / tjMCUHeight[ss];
+        for(int stacks: {numThreads, rows}) {
+            const JPEGImage j =
+                c.CompressSingleStream(img.View(), stacks, ss, quality);
+            const Image expected = serial.DeCompress(
+                j.DataPtr(), j.CompressedSize(), img.PixelFormat());
+            for(int bands: {2, 4, 7}) {
+                TJParallelDeCompressor d(bands);
+                const Image out = d.DeCompress(
+                    j.DataPtr(), j.CompressedSize(), img.PixelFormat());
+                assert(out.Size() == expected.Size());
+                assert(!memcmp(out.DataPtr(), expected.DataPtr(),
+                               out.Size()));
+            }
+        }
+    }
+}
+
+//compress a sub-rectangle in place and decompress it into a region of a
+//larger buffer with padded rows
+void TestImageView(const Image& img, int numStacks) {
+    const ImageView roi = img.View().SubView(int(img.Width()) / 4,
+                                             int(img.Height()) / 4,
+                                             int(img.Width()) / 2,
+                                             int(img.Height()) / 2);
+    TJCompressor c;
+    JPEGImage jimg = c.Compress(roi, TJSAMP_420, 75);
+    ofstream os("out-roi.jpg", ios::binary);
+    assert(os);
+    os.write((char*)jimg.DataPtr(), jimg.CompressedSize());
+    assert(jimg.Width() == roi.Width() && jimg.Height() == roi.Height());
+
+    const int pitch = (roi.Width() + 64) * roi.NumPlanes();
+    vector< unsigned char > frameBuffer(pitch * (roi.Height() + 32));
+    const MutableImageView fb(frameBuffer.data(), roi.Width() + 64,
+                              roi.Height() + 32, roi.PixelFormat(), pitch);
+    TJDeCompressor d;
+    d.DeCompress(jimg.DataPtr(), jimg.CompressedSize(),
+                 fb.SubView(32, 16, roi.Width(), roi.Height()));
+
+    TJParallelCompressor< TJCompressor > pc(numStacks);
+    vector< JPEGImage > stripes = pc.Compress(roi, numStacks, TJSAMP_420, 75);
+    TJParallelDeCompressor pd(numStacks);
+    pd.DeCompress(stripes, fb.SubView(32, 16, roi.Width(), roi.Height()));
+}
+
+//planar YUV round trip, no color conversion
+void TestYUV(const unsigned char* jpgImg, size_t size, int quality,
+             int numStacks) {
+    TJDeCompressor d;
+    YUVImage yuv = d.DeCompressToYUV(jpgImg, size);
+    TJCompressor c;
+    JPEGImage jimg = c.Compress(yuv, quality);
+    ofstream os("out-yuv.jpg", ios::binary);
+    assert(os);
+    os.write((char*)jimg.DataPtr(), jimg.CompressedSize());
+    assert(jimg.Width() == yuv.Width() && jimg.Height() == yuv.Height());
+
+    TJParallelCompressor< TJCompressor > pc(numStacks);
+    TJParallelDeCompressor pd(numStacks);
+    //stripe count independent of the number of decoding threads
+    for(int n: {numStacks, numStacks + 2}) {
+        vector< JPEGImage > stripes = pc.Compress(yuv, n, quality);
+        YUVImage out = pd.DeCompressToYUV(stripes);
+        assert(out.Width() == yuv.Width() && out.Height() == yuv.Height());
+        assert(out.SubSampling() == yuv.SubSampling());
+    }
+}
+
+#ifdef TJPP_COROUTINES
+//fire and forget coroutine: the test waits on the promise
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return Detached(); }
+        suspend_never initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+};
+
+Detached RoundTrip(TJAsyncCodec& codec, ImageView view, int quality,
+                   promise< Image >& result) {
+    const JPEGImage j = co_await codec.CompressAsync(view, TJSAMP_420,
+                                                     quality, TJFLAG_FASTDCT,
+                                                     UseAwaitable());
+    result.set_value(co_await codec.DeCompressAsync(j.DataPtr(),
+                                                    j.CompressedSize(),
+                                                    TJPF_RGB, TJFLAG_FASTDCT,
+                                                    UseAwaitable()));
+}
+#endif
+
+//many operations in flight from a single thread, on a shared executor
+void TestAsync(const Image& img, int quality, int numThreads) {
+    auto executor = make_shared< WorkerPool >(numThreads);
+    TJAsyncCodec codec(executor);
+    const int grid = 8;
+    const int tw = int(img.Width()) / grid;
+    const int th = int(img.Height()) / grid;
+    vector< ImageView > tiles;
+    for(int y = 0; y != grid; ++y)
+        for(int x = 0; x != grid; ++x)
+            tiles.push_back(img.View().SubView(x * tw, y * th, tw, th));
+    //futures
+    vector< future< JPEGImage > > futures;
+    for(auto& t: tiles)
+        futures.push_back(codec.CompressAsync(t, TJSAMP_420, quality));
+    vector< JPEGImage > jpegs;
+    for(auto& f: futures) jpegs.push_back(f.get());
+    //callbacks
+    mutex m;
+    condition_variable cv;
+    int done = 0;
+    for(auto& j: jpegs) {
+        codec.DeCompressAsync(j.DataPtr(), j.CompressedSize(), TJPF_RGB,
+                              TJFLAG_FASTDCT,
+                              [&, tw, th](Image&& i, exception_ptr e) {
+            assert(!e && int(i.Width()) == tw && int(i.Height()) == th);
+            lock_guard< mutex > guard(m);
+            ++done;
+            cv.notify_one();
+        });
+    }
+    {
+        unique_lock< mutex > lock(m);
+        cv.wait(lock, [&]{ return done == int(jpegs.size()); });
+    }
+    //errors are delivered through the future
+    const unsigned char garbage[16] = {0};
+    bool thrown = false;
+    try {
+        codec.DeCompressAsync(garbage, sizeof(garbage), TJPF_RGB).get();
+    } catch(const runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+#ifdef TJPP_COROUTINES
+    promise< Image > result;
+    future< Image > f = result.get_future();
+    RoundTrip(codec, img.View(), quality, result);
+    const Image out = f.get();
+    assert(out.Width() == img.Width() && out.Height() == img.Height());
+#endif
+}
+
+//only tiles which changed since the previous frame are sent
+void TestTiles(const Image& img, int quality, int numThreads) {
+    //SIMD and scalar hashes match, block order matters
+    vector< unsigned char > buf(300);
+    for(size_t i = 0; i != buf.size(); ++i) buf[i] = (unsigned char)(i * 7);
+    for(size_t n = 0; n < buf.size(); n += 13)
+        assert(TileHash::Hash(buf.data(), n, 1)
+               == TileHash::HashScalar(buf.data(), n, 1));
+    const uint64_t h = TileHash::Hash(buf.data(), 64);
+    swap_ranges(buf.begin(), buf.begin() + 32, buf.begin() + 32);
+    assert(TileHash::Hash(buf.data(), 64) != h);
+
+    Image frame = img;
+    const int w = int(frame.Width());
+    const int hgt = int(frame.Height());
+    TJTileEncoder enc(64, numThreads);
+    TJTileCompositor comp(numThreads);
+    Image fb;
+    fb.SetParameters(w, hgt, frame.PixelFormat());
+    fb.Allocate(fb.Size());
+    vector< TileUpdate > u = enc.Encode(frame.View(), TJSAMP_420, quality);
+    assert(int(u.size()) == enc.NumTiles());
+    comp.Apply(u, fb.View());
+    //unchanged frame
+    assert(enc.Encode(frame.View(), TJSAMP_420, quality).empty());
+    //change a 16x16 block across the corner of four tiles
+    const int nc = frame.NumPlanes();
+    for(int y = 56; y != 72; ++y)
+        for(int x = 56; x != 72; ++x)
+            for(int c = 0; c != nc; ++c)
+                frame.DataPtr()[(size_t(y) * w + x) * nc + c] ^= 0xFF;
+    u = enc.Encode(frame.View(), TJSAMP_420, quality);
+    assert(u.size() == 4);
+    for(auto& t: u)
+        assert(t.x % 64 == 0 && t.y % 64 == 0 && t.x <= 64 && t.y <= 64);
+    comp.Apply(u, fb.View());
+    //decoded framebuffer close to the last frame
+    size_t diff = 0;
+    for(size_t i = 0; i != frame.Size(); ++i)
+        diff += size_t(abs(int(frame.DataPtr()[i]) - int(fb.DataPtr()[i])));
+    assert(diff / frame.Size() < 10);
+    enc.Reset();
+    assert(int(enc.Encode(frame.View(), TJSAMP_420, quality).size())
+           == enc.NumTiles());
+    cout << "tiles - hash: " << TileHash::Isa() << ", tiles: "
+         << enc.NumTiles() << endl;
+}
+
+//short-lived (de)compressors lease handles from the process-wide pool
+//header through the API layer; TurboJPEG 3: optimized Huffman tables, 12-bit
+//lossy and 16-bit lossless samples; legacy API: TurboJPEG 3 only flags are
+//rejected
+void TestTJApi(const Image& img, int quality) {
+    TJCompressor c;
+    TJDeCompressor d;
+    JPEGImage j = c.Compress(img.View(), TJSAMP_420, quality);
+    const TJHeader h = d.Header(j.DataPtr(), j.CompressedSize());
+    assert(h.width == int(img.Width()) && h.height == int(img.Height()));
+    assert(h.subSampling == TJSAMP_420 && h.precision == 8 && !h.lossless);
+#ifdef TJPP_TJ3
+    const size_t size = j.CompressedSize();
+    j = c.Compress(std::move(j), img.View(), TJSAMP_420, quality,
+                   TJFLAG_FASTDCT | TJPP_FLAG_OPTIMIZE);
+    assert(j.CompressedSize() <= size);
+    const int width = int(img.Width());
+    const int height = int(img.Height());
+    const TJPF pf = img.PixelFormat();
+    const size_t rowSize = size_t(width) * NumComponents(pf);
+    vector< short > s12(rowSize * height);
+    vector< unsigned short > s16(s12.size());
+    for(int y = 0; y != height; ++y) {
+        const unsigned char* row = img.View().Row(y);
+        for(size_t x = 0; x != rowSize; ++x) {
+            s12[y * rowSize + x] = short(row[x] << 4);
+            s16[y * rowSize + x] = (unsigned short)(row[x] * 257);
+        }
+    }
+    const JPEGImage j12 = c.Compress12(s12.data(), width, height, pf,
+                                       TJSAMP_444, 95);
+    assert(d.Header(j12.DataPtr(), j12.CompressedSize()).precision == 12);
+    vector< short > o12(s12.size());
+    d.DeCompress12(j12.DataPtr(), j12.CompressedSize(), o12.data(), pf);
+    double err = 0;
+    for(size_t k = 0; k != s12.size(); ++k) err += abs(o12[k] - s12[k]);
+    assert(err / s12.size() < 64);
+    const JPEGImage j16 = c.Compress16(s16.data(), width, height, pf);
+    const TJHeader h16 = d.Header(j16.DataPtr(), j16.CompressedSize());
+    assert(h16.lossless && h16.precision == 16);
+    vector< unsigned short > o16(s16.size());
+    d.DeCompress16(j16.DataPtr(), j16.CompressedSize(), o16.data(), pf);
+    assert(o16 == s16);
+    cout << "tj3 - 12-bit: " << j12.CompressedSize() << " bytes, mean error "
+         << err / s12.size() << "; 16-bit lossless: "
+         << j16.CompressedSize() << " bytes" << endl;
+#else
+    bool thrown = false;
+    try {
+        c.Compress(img.View(), TJSAMP_420, quality,
+                   TJFLAG_FASTDCT | TJPP_FLAG_OPTIMIZE);
+    } catch(const logic_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    cout << "legacy TurboJPEG API" << endl;
+#endif
+}
+
+void TestHandlePool(const Image& img, int quality) {
+    TJHandlePool& pool = TJHandlePool::Instance();
+    {
+        TJCompressor c;
+        TJDeCompressor d;
+    }
+    const TJHandlePoolCounters before = pool.Counters();
+    for(int i = 0; i != 100; ++i) {
+        TJCompressor c;
+        TJDeCompressor d;
+        JPEGImage j = c.Compress(img.View(), TJSAMP_420, quality);
+        d.DeCompress(j.DataPtr(), j.CompressedSize(), img.PixelFormat());
+    }
+    assert(pool.Counters().created == before.created);
+    //handles cached by an exiting thread go to the shared pool
+    pool.Trim();
+    thread([]() {
+        TJHandle a(TJ_TRANSFORM), b(TJ_TRANSFORM), c(TJ_TRANSFORM);
+    }).join();
+    const TJHandlePoolCounters after = pool.Counters();
+    assert(after.pooled == 3);
+    {
+        TJHandle a(TJ_TRANSFORM), b(TJ_TRANSFORM), c(TJ_TRANSFORM),
+                 d(TJ_TRANSFORM);
+        TJHandle e = std::move(a);
+        assert(!a.Get() && e.Get() && e.Type() == TJ_TRANSFORM);
+    }
+    assert(pool.Counters().sharedHits > after.sharedHits);
+    //no pooling: released handles are destroyed
+    pool.SetMaxPooled(0);
+    pool.SetThreadCacheSize(0);
+    const size_t destroyed = pool.Counters().destroyed;
+    {
+        TJHandle h(TJ_COMPRESS);
+    }
+    assert(pool.Counters().destroyed == destroyed + 1);
+    pool.SetMaxPooled(TJHandlePool::DEFAULT_MAX_POOLED);
+    pool.SetThreadCacheSize(TJHandlePool::DEFAULT_THREAD_CACHE);
+    pool.Trim();
+    assert(pool.Counters().pooled == 0);
+    cout << "handle pool - created: " << pool.Counters().created << endl;
+}
+
+//stripes and tables written into one container file with a single
+//vectored write, read back in place
+void TestStripeContainer(const Image& img, int quality, int numThreads) {
+    TJParallelCompressor< TJCompressor > c(numThreads);
+    TJParallelDeCompressor d(numThreads);
+    const vector< JPEGImage > stripes =
+        c.Compress(img.View(), numThreads, TJSAMP_420, quality);
+    Image expected = d.DeCompress(stripes);
+    StripeContainerWriter cw;
+    JPEGFileWriter w;
+    for(auto& b: cw.Build(stripes))
+        w.Add("mout.tjps", (const unsigned char*) b.iov_base, b.iov_len);
+    w.Flush();
+    const MappedFile f("mout.tjps");
+    assert(f.Size() == cw.Size());
+    const StripeContainerView v(f.Data(), f.Size());
+    assert(v.NumStripes() == numThreads && !v.Abbreviated());
+    assert(v.Width() == int(img.Width()) && v.Height() == int(img.Height()));
+    Image out = d.DeCompress(v);
+    assert(!memcmp(out.DataPtr(), expected.DataPtr(), out.Size()));
+    //stripe count other than the number of decoding threads
+    for(int n: {1, numThreads + 3}) {
+        TJParallelDeCompressor od(n);
+        out = od.DeCompress(std::move(out), v);
+        assert(!memcmp(out.DataPtr(), expected.DataPtr(), out.Size()));
+    }
+    //random access: decode the stripe holding the last row on its own
+    const int s = v.StripeAt(v.Height() - 1);
+    assert(s == numThreads - 1 && v.StripeData(s) > f.Data());
+    TJDeCompressor sd;
+    Image stripe = sd.DeCompress(v.StripeData(s), v.StripeSize(s),
+                                 v.PixelFormat(), TJFLAG_FASTDCT);
+    assert(int(stripe.Height()) == v.StripeHeight(s));
+    assert(!memcmp(stripe.DataPtr(),
+                   expected.View().Row(v.StripeY(s)), stripe.Size()));
+    //abbreviated stripes through a pipe
+    JPEGImage tables;
+    const vector< JPEGImage > abbreviated =
+        c.CompressAbbreviated(img.View(), numThreads, TJSAMP_420, quality,
+                              tables);
+    int fds[2];
+    assert(pipe(fds) == 0);
+    vector< unsigned char > buf;
+    thread reader([&]() {
+        unsigned char chunk[4096];
+        ssize_t r;
+        while((r = read(fds[0], chunk, sizeof(chunk))) > 0)
+            buf.insert(buf.end(), chunk, chunk + r);
+    });
+    cw.Write(fds[1], abbreviated, &tables);
+    close(fds[1]);
+    reader.join();
+    close(fds[0]);
+    assert(buf.size() == cw.Size());
+    assert(StripeContainerFormat::Size(buf.data()) == buf.size());
+    const StripeContainerView a(buf.data(), buf.size());
+    assert(a.Abbreviated());
+    out = d.DeCompress(std::move(out), a);
+    assert(!memcmp(out.DataPtr(), expected.DataPtr(), out.Size()));
+    //truncated container
+    bool thrown = false;
+    try {
+        StripeContainerView t(buf.data(), buf.size() - 1);
+    } catch(const runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    cout << "container - stripes: " << a.NumStripes() << ", bytes: "
+         << a.Size() << endl;
+}
+
+//abbreviated stripes: one tables-only stream per frame, stripes without
+//tables decode to the same pixels as complete stripes
+void TestAbbreviated(const Image& img, int quality, int numThreads) {
+    TJParallelCompressor< TJCompressor > c(numThreads);
+    const vector< JPEGImage > full =
+        c.Compress(img.View(), numThreads, TJSAMP_420, quality);
+    JPEGImage tables;
+    vector< JPEGImage > stripes =
+        c.CompressAbbreviated(img.View(), numThreads, TJSAMP_420, quality,
+                              tables);
+    assert(stripes.size() == full.size());
+    ParseTablesOnly(tables.DataPtr(), tables.CompressedSize());
+    size_t fullSize = 0;
+    size_t abbreviatedSize = tables.CompressedSize();
+    for(size_t s = 0; s != stripes.size(); ++s) {
+        const JPEGLayout l =
+            ParseJPEG(stripes[s].DataPtr(), stripes[s].CompressedSize());
+        assert(!l.Find(JPEG_DQT) && !l.Find(JPEG_DHT));
+        assert(stripes[s].CompressedSize() + tables.CompressedSize() - 4
+               == full[s].CompressedSize());
+        fullSize += full[s].CompressedSize();
+        abbreviatedSize += stripes[s].CompressedSize();
+    }
+    TJParallelDeCompressor d(numThreads);
+    Image expected = d.DeCompress(full);
+    Image out = d.DeCompress(tables, stripes);
+    assert(out.Size() == expected.Size());
+    assert(!memcmp(out.DataPtr(), expected.DataPtr(), out.Size()));
+    //recycled tables and stripes, tables of progressive stripes differ
+    stripes = c.CompressAbbreviated(img.View(), numThreads, TJSAMP_420,
+                                    quality, tables,
+                                    TJFLAG_FASTDCT | TJFLAG_PROGRESSIVE);
+    out = d.DeCompress(std::move(out), tables, stripes);
+    const vector< JPEGImage > progressive =
+        c.Compress(img.View(), numThreads, TJSAMP_420, quality,
+                   TJFLAG_FASTDCT | TJFLAG_PROGRESSIVE);
+    expected = d.DeCompress(std::move(expected), progressive);
+    assert(out.Size() == expected.Size());
+    assert(!memcmp(out.DataPtr(), expected.DataPtr(), out.Size()));
+    cout << "abbreviated - saved bytes per frame: "
+         << long(fullSize) - long(abbreviatedSize) << endl;
+}
+
+//headers with segments too short for their content are rejected
+void TestMalformedHeaders(const JPEGImage& jimg) {
+    const JPEGLayout l = ParseJPEG(jimg.DataPtr(), jimg.CompressedSize());
+    auto rejected = [](const vector< unsigned char >& d) {
+        try {
+            ParseJPEG(d.data(), d.size());
+        } catch(const runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+    const vector< unsigned char > valid(
+        jimg.DataPtr(), jimg.DataPtr() + jimg.CompressedSize());
+    //one more component than the frame header holds
+    vector< unsigned char > d = valid;
+    d[l.Find(l.sofMarker)->offset + 9] =
+        (unsigned char)(l.components.size() + 1);
+    assert(rejected(d));
+    //restart interval segment without the interval; single stripe streams
+    //have no restart markers
+    if(const JPEGSegment* dri = l.Find(JPEG_DRI)) {
+        d = valid;
+        d[dri->offset + 3] = 2;
+        d.erase(d.begin() + dri->offset + 4, d.begin() + dri->offset + 6);
+        assert(rejected(d));
+    }
+}
+
+//NUMA placement: same pixels as the default placement, node affine
+//tasks run on the node of their worker
+void TestNumaPlacement(const vector< JPEGImage >& stripes,
+                       const JPEGImage& single, int numThreads) {
+    const NumaTopology& t = NumaTopology::Get();
+    assert(t.NumNodes() >= 1);
+    const vector< int > cpus = t.WorkerCpus(numThreads);
+    assert(int(cpus.size()) == numThreads);
+    WorkerPool pool(cpus);
+    for(int w = 0; w != pool.NumThreads(); ++w) {
+        assert(pool.WorkerNode(w) == t.NodeOfCpu(cpus[w]));
+        assert(pool.SubmitTo(w, []() { return CurrentNode(); }).get()
+               == pool.WorkerNode(w));
+    }
+    //tasks without a node are spread over the workers
+    const vector< int > a = pool.Assign(vector< int >(2 * numThreads, -1));
+    vector< int > load(numThreads, 0);
+    for(int w: a) ++load[w];
+    for(int l: load) assert(l == 2);
+
+    TJParallelDeCompressor ref(int(stripes.size()));
+    TJParallelDeCompressor numa(int(stripes.size()),
+                                TJParallelDeCompressor::NUMA_PLACEMENT);
+    Image expected = ref.DeCompress(stripes);
+    Image img = numa.DeCompress(stripes);
+    assert(img.Size() == expected.Size());
+    assert(!memcmp(img.DataPtr(), expected.DataPtr(), img.Size()));
+    assert(numa.StripeNodes().size() == stripes.size());
+    //decoded pages are placed, the recycled image is reused in place
+    for(int n: PageNodes(img.DataPtr(), img.Size()))
+        assert(n >= -1 && n < t.NumNodes());
+    const unsigned char* data = img.DataPtr();
+    img = numa.DeCompress(std::move(img), stripes);
+    assert(img.DataPtr() == data);
+    assert(!memcmp(img.DataPtr(), expected.DataPtr(), img.Size()));
+    //restart marker bands
+    expected = ref.DeCompress(single.DataPtr(), single.CompressedSize(),
+                              TJPF_RGB);
+    img = numa.DeCompress(std::move(img), single.DataPtr(),
+                          single.CompressedSize(), TJPF_RGB);
+    assert(!memcmp(img.DataPtr(), expected.DataPtr(), img.Size()));
+    //no restart markers: serial decode, a single node reported
+    const JPEGImage& s = stripes.front();
+    assert(ParseJPEG(s.DataPtr(), s.CompressedSize()).restartInterval == 0);
+    img = numa.DeCompress(std::move(img), s.DataPtr(), s.CompressedSize(),
+                          TJPF_RGB);
+    assert(numa.StripeNodes().size() == 1);
+    cout << "numa - nodes: " << t.NumNodes() << endl;
+}
+
+//an unbound worker steals a task queued in front of a node affine task
+//of a busy bound worker
+void TestWorkerStealing() {
+    const NumaTopology& t = NumaTopology::Get();
+    WorkerPool pool(vector< int >{t.WorkerCpus(1)[0], -1});
+    promise< void > started[2];
+    promise< void > gate;
+    promise< void > stolen;
+    shared_future< void > g = gate.get_future();
+    future< void > s = stolen.get_future();
+    future< bool > busy = pool.SubmitTo(0, [&started, &s]() {
+        started[0].set_value();
+        return s.wait_for(chrono::seconds(10)) == future_status::ready;
+    });
+    started[0].get_future().wait();
+    //keep the unbound worker away until both tasks are queued
+    future< void > held = pool.SubmitTo(1, [&started, g]() {
+        started[1].set_value();
+        g.wait();
+    });
+    started[1].get_future().wait();
+    future< void > free = pool.Submit([&stolen]() { stolen.set_value(); });
+    future< void > affine = pool.SubmitTo(0, []() {});
+    gate.set_value();
+    assert(busy.get());
+    held.get();
+    free.get();
+    affine.get();
+}
+
+//highest quality fitting a byte budget, whole image and per stripe
+void TestRateControl(const Image& img, int numThreads) {
+    //serial search with a starting guess
+    QualitySearch qs(1000);
+    while(!qs.Done()) {
+        for(int q: qs.Candidates(1, 50)) qs.Report(q, size_t(q) * 20);
+    }
+    assert(qs.Fitting() == 50 && qs.Rounds() == 2);
+
+    TJCompressor comp;
+    const size_t budget =
+        comp.Compress(img.View(), TJSAMP_420, 60).CompressedSize();
+    TJRateCompressor rc(numThreads);
+    JPEGImage j = rc.Compress(img.View(), TJSAMP_420, budget);
+    assert(j.CompressedSize() <= budget && j.Quality() >= 50);
+    assert(rc.Quality() == j.Quality());
+    //same frame: quality carried forward, the first round brackets it
+    j = rc.Compress(img.View(), TJSAMP_420, budget);
+    assert(j.CompressedSize() <= budget && j.Quality() == rc.Quality());
+    if(rc.NumThreads() > 1) assert(rc.Rounds() == 1);
+    cout << "rate control - budget: " << budget << " bytes, quality: "
+         << rc.Quality() << ", rounds: " << rc.Rounds() << endl;
+    //budget too small for any quality
+    j = rc.Compress(img.View(), TJSAMP_420, 100);
+    assert(j.Quality() == 1 && j.CompressedSize() > 100);
+
+    TJParallelCompressor< TJCompressor > pc(numThreads);
+    for(int f = 0; f != 2; ++f) {
+        const vector< JPEGImage > stripes =
+            pc.CompressToSize(img.View(), numThreads, TJSAMP_420, budget);
+        size_t total = 0;
+        for(auto& s: stripes) total += s.CompressedSize();
+        assert(total <= budget);
+    }
+}
+
+//stripe count and boundaries selected by TJParallelCompressor
+void TestAutoStripes(const Image& img, int quality, int numThreads) {
+    const vector< int > b = BalancedMCUStripes(100, 3, TJSAMP_420);
+    assert(b.size() == 3 && b[0] == 48 && b[1] == 32 && b[2] == 20);
+    //converges to the fastest count of a synthetic cost function with an
+    //optimum between 4 and 5 stripes
+    StripeTuner tuner(8, 1 << 18, 0);
+    assert(tuner.Model(7680, 4320, TJSAMP_420) == 8);
+    assert(tuner.Model(64, 64, TJSAMP_420) == 1);
+    for(int f = 0; f != 100; ++f) {
+        const int n = tuner.Stripes(7680, 4320, TJSAMP_420);
+        const double t = 1.0 / n + 0.05 * n;
+        tuner.Update(7680, 4320, TJSAMP_420, n,
+                     chrono::duration_cast< Duration >(
+                         chrono::duration< double >(t)));
+    }
+    const int best = tuner.Stripes(7680, 4320, TJSAMP_420);
+    assert(best == 4 || best == 5);
+    //10 MCU rows: 6 equal stripes cannot be made, MCUAlignedStripes
+    //returns 5; the tuner must not keep probing 6
+    StripeTuner shortTuner(8, 1 << 18, 0);
+    for(int f = 0; f != 100; ++f) {
+        const int n = shortTuner.Stripes(7680, 160, TJSAMP_420);
+        const int m = int(MCUAlignedStripes(160, n, TJSAMP_420).size());
+        const double t = 1.0 / m + 0.04 * m;
+        shortTuner.Update(7680, 160, TJSAMP_420, m,
+                          chrono::duration_cast< Duration >(
+                              chrono::duration< double >(t)));
+    }
+    assert(shortTuner.Stripes(7680, 160, TJSAMP_420) == 5);
+
+    using PC = TJParallelCompressor< TJCompressor >;
+    PC pc(numThreads);
+    //small image: single stripe
+    assert(pc.Compress(img.View().SubView(0, 0, 64, 64), PC::AUTO_STACKS,
+                       TJSAMP_420, quality).size() == 1);
+    //the stripe count varies between frames, one decompressor decodes all
+    TJParallelDeCompressor pd(numThreads);
+    TJDeCompressor sd;
+    vector< JPEGImage > stripes;
+    Image out;
+    for(int f = 0; f != 20; ++f) {
+        stripes = pc.Compress(move(stripes), img.DataPtr(), PC::AUTO_STACKS,
+                              img.Width(), img.Height(), img.PixelFormat(),
+                              TJSAMP_420, quality);
+        assert(int(stripes.size()) <= numThreads);
+        int h = 0;
+        for(size_t s = 0; s != stripes.size(); ++s) {
+            assert(s + 1 == stripes.size() || stripes[s].Height() % 16 == 0);
+            h += stripes[s].Height();
+        }
+        assert(h == int(img.Height()));
+        out = pd.DeCompress(move(out), stripes);
+        assert(out.Width() == img.Width() && out.Height() == img.Height());
+        const Image last = sd.DeCompress(stripes.back().DataPtr(),
+                                         stripes.back().CompressedSize(),
+                                         img.PixelFormat(), TJFLAG_FASTDCT);
+        assert(!memcmp(out.View().Row(int(img.Height() - last.Height())),
+                       last.DataPtr(), last.Size()));
+    }
+    JPEGImage single = pc.CompressSingleStream(img.View(), PC::AUTO_STACKS,
+                                               TJSAMP_420, quality);
+    assert(single.Width() == int(img.Width()));
+}
+
+//compress and decompress the tiles of a grid x grid subdivision of the image
+//as independent images
+void TestBatch(const Image& img, int grid, int numThreads) {
+    const int tw = int(img.Width()) / grid;
+    const int th = int(img.Height()) / grid;
+    vector< ImageView > tiles;
+    for(int y = 0; y != grid; ++y)
+        for(int x = 0; x != grid; ++x)
+            tiles.push_back(img.View().SubView(x * tw, y * th, tw, th));
+    TJBatchCompressor bc(numThreads);
+#ifdef TIMING__
+    Time begin = Tick();
+#endif
+    vector< PooledJPEGImage > jpegs = bc.CompressBatch(tiles, TJSAMP_420, 75);
+#ifdef TIMING__
+    Time end = Tick();
+#endif
+    TJBatchDeCompressor bd(numThreads);
+    vector< Image > out = bd.DeCompressBatch(jpegs, img.PixelFormat());
+#ifdef TIMING__
+    cout << "batch - compression: " << toms(end - begin).count() << " ms, "
+         << "decompression: " << toms(Tick() - end).count() << " ms ("
+         << tiles.size() << " images)" << endl;
+#endif
+    assert(out.size() == tiles.size());
+    for(size_t i = 0; i != out.size(); ++i)
+        assert(int(out[i].Width()) == tw && int(out[i].Height()) == th);
+    ofstream os("out-batch.jpg", ios::binary);
+    assert(os);
+    os.write((char*)jpegs.back().Image().DataPtr(),
+             jpegs.back().Image().CompressedSize());
+}
+
+//DCT-domain scaled decoding and pyramid generation
+void TestPyramid(const unsigned char* jpgImg, size_t size, int quality,
+                 int numThreads) {
+    TJDeCompressor d;
+    Image full = d.DeCompress(jpgImg, size, TJPF_RGB);
+    const tjscalingfactor half = {1, 2};
+    Image preview = d.DeCompress(jpgImg, size, TJPF_RGB, half);
+    assert(int(preview.Width()) == TJSCALED(int(full.Width()), half));
+    assert(int(preview.Height()) == TJSCALED(int(full.Height()), half));
+    const tjscalingfactor fit =
+        TJDeCompressor::ScalingFactorToFit(full.Width(), full.Height(),
+                                           full.Width() / 3,
+                                           full.Height() / 3);
+    assert(TJSCALED(int(full.Width()), fit) <= int(full.Width()) / 3);
+    TJPyramid p(numThreads);
+    const vector< tjscalingfactor > scales = TJPyramid::Octaves(4);
+    vector< JPEGImage > levels =
+        p.Generate(jpgImg, size, scales, TJSAMP_420, quality);
+    for(size_t i = 0; i != levels.size(); ++i) {
+        assert(levels[i].Width() == TJSCALED(int(full.Width()), scales[i]));
+        const string fname = "out-level" + to_string(i) + ".jpg";
+        ofstream os(fname, ios::binary);
+        assert(os);
+        os.write((char*)levels[i].DataPtr(), levels[i].CompressedSize());
+    }
+}
+
+//lossless rotation and MCU aligned crops of the same image
+void TestTransformer(const JPEGImage& jimg, int numThreads) {
+    TJTransformer t(numThreads);
+    const int mw = tjMCUWidth[jimg.ChrominanceSubSampling()];
+    const int mh = tjMCUHeight[jimg.ChrominanceSubSampling()];
+    vector< tjtransform > ops;
+    ops.push_back(TJTransformer::Op(TJXOP_ROT90));
+    for(int i = 0; i != 8; ++i)
+        ops.push_back(TJTransformer::Crop(i * mw, i * mh, 4 * mw, 4 * mh));
+    vector< PooledJPEGImage > out =
+        t.Transform(jimg.DataPtr(), jimg.CompressedSize(), ops);
+    assert(out.size() == ops.size());
+    assert(out[0].Image().Width() == jimg.Height());
+    assert(out[1].Image().Width() == 4 * mw);
+    TJDeCompressor d;
+    for(auto& o: out) {
+        Image img = d.DeCompress(o.Image().DataPtr(),
+                                 o.Image().CompressedSize(), TJPF_RGB);
+        assert(img.Width() > 0);
+    }
+    ofstream os("out-rot90.jpg", ios::binary);
+    assert(os);
+    os.write((char*)out[0].Image().DataPtr(), out[0].Image().CompressedSize());
+    //partial MCUs trimmed: size of the image not a multiple of the MCU size
+    const Image img = d.DeCompress(jimg.DataPtr(), jimg.CompressedSize(),
+                                   TJPF_RGB);
+    TJCompressor c;
+    const JPEGImage odd = c.Compress(img.View().SubView(0, 0, 3 * mw + 5,
+                                                        2 * mh + 3),
+                                     TJSAMP_420, 90);
+    ops.clear();
+    for(TJXOP op: {TJXOP_HFLIP, TJXOP_VFLIP, TJXOP_TRANSPOSE, TJXOP_TRANSVERSE,
+                   TJXOP_ROT90, TJXOP_ROT180, TJXOP_ROT270}) {
+        ops.push_back(TJTransformer::Op(op, TJXOPT_TRIM));
+        ops.push_back(TJTransformer::Op(op, TJXOPT_TRIM | TJXOPT_GRAY));
+    }
+    ops.push_back(TJTransformer::Crop(mw, mh, 0, 0, TJXOP_ROT180,
+                                      TJXOPT_TRIM));
+    out = t.Transform(odd.DataPtr(), odd.CompressedSize(), ops);
+    for(auto& o: out) {
+        const Image ti = d.DeCompress(o.Image().DataPtr(),
+                                      o.Image().CompressedSize(), TJPF_RGB);
+        assert(int(ti.Width()) == o.Image().Width()
+               && int(ti.Height()) == o.Image().Height());
+    }
+}
+
+//decode -> invert -> encode numFrames copies of the input, frames are pushed
+//from a separate thread since Push blocks when the pipeline is full
+void TestStreamPipeline(const unsigned char* jpg, size_t size, int quality,
+                        int numFrames) {
+    TJStreamPipeline p([](Image& img) {
+                           unsigned char* d = img.DataPtr();
+                           for(size_t i = 0; i != img.Size(); ++i)
+                               d[i] = 255 - d[i];
+                       }, 3, TJPF_BGR, TJSAMP_420, quality);
+    thread producer([&p, jpg, size, numFrames]() {
+        for(int i = 0; i != numFrames; ++i) {
+            vector< unsigned char > frame(jpg, jpg + size);
+            p.Push(move(frame));
+        }
+        p.Close();
+    });
+    int frames = 0;
+    JPEGImage last;
+    for(JPEGImage j = p.Pop(); j.DataPtr(); j = p.Pop()) {
+        ++frames;
+        last = move(j);
+    }
+    producer.join();
+    assert(frames == numFrames);
+    ofstream os("out-pipeline.jpg", ios::binary);
+    assert(os);
+    os.write((char*)last.DataPtr(), last.CompressedSize());
+    const PipelineStats s = p.Stats();
+    assert(s.decode.frames == size_t(numFrames));
+    assert(s.encode.frames == size_t(numFrames));
+    cout << "pipeline - decode: " << s.decode.FramesPerSecond()
+         << " process: " << s.process.FramesPerSecond()
+         << " encode: " << s.encode.FramesPerSecond()
+         << " total: " << numFrames / s.elapsedSeconds << " frames/s" << endl;
+}
+
+//returned images own their buffers; caller provided buffers are used as is
+void TestOwnership(const Image& img, int quality) {
+    TJCompressor c;
+    JPEGImage a = c.Compress(img.View(), TJSAMP_420, quality);
+    const vector< unsigned char > first(a.DataPtr(),
+                                        a.DataPtr() + a.CompressedSize());
+    JPEGImage b = c.Compress(img.View(), TJSAMP_444, quality);
+    assert(a.DataPtr() != b.DataPtr());
+    assert(equal(first.begin(), first.end(), a.DataPtr()));
+    //recycled buffer is reused
+    const unsigned char* p = b.DataPtr();
+    b = c.Compress(move(b), img.View(), TJSAMP_420, quality);
+    assert(b.DataPtr() == p);
+    //caller provided buffer e.g. network send buffer
+    vector< unsigned char > buffer(tjBufSize(int(img.Width()),
+                                             int(img.Height()), TJSAMP_420));
+    JPEGImage e = c.Compress(JPEGImage(buffer.data(), buffer.size()),
+                             img.View(), TJSAMP_420, quality);
+    assert(e.DataPtr() == buffer.data() && !e.OwnsBuffer());
+    assert(e.CompressedSize() == a.CompressedSize());
+    bool thrown = false;
+    try {
+        c.Compress(JPEGImage(buffer.data(), 16), img.View(), TJSAMP_420,
+                   quality);
+    } catch(const length_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+//aligned, huge page backed output buffer placed on NUMA node 0
+void TestImageBuffer(const unsigned char* jpgImg, size_t size,
+                     const Image& ref) {
+    TJDeCompressor d(0, BufferOptions(true, 0));
+    Image img = d.DeCompress(jpgImg, size, ref.PixelFormat());
+    assert(uintptr_t(img.DataPtr()) % AlignedBuffer::ALIGNMENT == 0);
+    assert(img.GetBufferOptions().hugePages);
+    assert(memcmp(img.DataPtr(), ref.DataPtr(), ref.Size()) == 0);
+    //buffer is reused
+    const unsigned char* p = img.DataPtr();
+    img = d.DeCompress(move(img), jpgImg, size, ref.PixelFormat());
+    assert(img.DataPtr() == p);
+    //deep copy
+    Image copy(img);
+    assert(copy.DataPtr() != img.DataPtr());
+    assert(memcmp(copy.DataPtr(), img.DataPtr(), img.Size()) == 0);
+}
+
+//pixel format conversion against a per-channel reference, all the widths
+//up to 70 to cover the SIMD loop tails
+void TestPixelConversion(const Image& img, int quality, int numThreads) {
+    const TJPF formats[] = {TJPF_RGB, TJPF_BGR, TJPF_RGBX, TJPF_BGRX,
+                            TJPF_XBGR, TJPF_XRGB, TJPF_GRAY, TJPF_RGBA,
+                            TJPF_BGRA, TJPF_ABGR, TJPF_ARGB};
+    const int h = 3;
+    for(TJPF from: formats) {
+        const int sn = NumComponents(from);
+        vector< unsigned char > src(70 * h * sn);
+        for(size_t i = 0; i != src.size(); ++i)
+            src[i] = (unsigned char)(i * 7 + 13);
+        for(TJPF to: formats) {
+            const int dn = NumComponents(to);
+            for(int w = 1; w <= 70; ++w) {
+                vector< unsigned char > dst(w * h * dn);
+                ConvertPixels(ImageView(src.data(), w, h, from, 70 * sn),
+                              MutableImageView(dst.data(), w, h, to));
+                for(int y = 0; y != h; ++y) {
+                    for(int x = 0; x != w; ++x) {
+                        const unsigned char* s = &src[(y * 70 + x) * sn];
+                        const unsigned char* d = &dst[(y * w + x) * dn];
+                        auto channel = [&](const int* offsets) {
+                            if(from == TJPF_GRAY) return int(s[0]);
+                            return offsets[from] < 0 ? 255
+                                                     : int(s[offsets[from]]);
+                        };
+                        if(to == TJPF_GRAY) {
+                            if(from == TJPF_GRAY) {
+                                assert(d[0] == s[0]);
+                                continue;
+                            }
+                            const int l = (19595 * channel(tjRedOffset)
+                                           + 38470 * channel(tjGreenOffset)
+                                           + 7471 * channel(tjBlueOffset)
+                                           + 32768) >> 16;
+                            assert(d[0] == l);
+                            continue;
+                        }
+                        assert(d[tjRedOffset[to]] == channel(tjRedOffset));
+                        assert(d[tjGreenOffset[to]]
+                               == channel(tjGreenOffset));
+                        assert(d[tjBlueOffset[to]] == channel(tjBlueOffset));
+                        if(tjAlphaOffset[to] >= 0) {
+                            const int a = from == TJPF_GRAY
+                                          || tjAlphaOffset[from] < 0
+                                          ? 255 : s[tjAlphaOffset[from]];
+                            assert(d[tjAlphaOffset[to]] == a);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    //parallel conversion and fused pre-pass
+    WorkerPool pool(numThreads);
+    Image rgbx;
+    rgbx.SetParameters(img.Width(), img.Height(), TJPF_RGBX);
+    rgbx.Allocate(rgbx.Size());
+#ifdef TIMING__
+    Time begin = Tick();
+#endif
+    ConvertPixels(img.View(), rgbx.View(), pool);
+#ifdef TIMING__
+    cout << "pixel conversion (" << PixelConverter::Isa() << "): "
+         << toms(Tick() - begin).count() << " ms" << endl;
+#endif
+    TJCompressor c;
+    const Image& crgbx = rgbx;
+    JPEGImage a = c.Compress(crgbx.View(), TJSAMP_420, quality);
+    JPEGImage b = c.Compress(img.View(), TJPF_RGBX, TJSAMP_420, quality);
+    assert(a.CompressedSize() == b.CompressedSize());
+    assert(memcmp(a.DataPtr(), b.DataPtr(), a.CompressedSize()) == 0);
+    TJParallelCompressor< TJCompressor > pc(numThreads);
+    vector< JPEGImage > stripes =
+        pc.Compress(img.View(), TJPF_RGBX, numThreads, TJSAMP_420, quality);
+    assert(int(stripes.size()) == numThreads);
+}
+
 void TestJPGMemPoolCompressor(const unsigned char* uimg,
                               int width,
                               int height,
@@ -121,24 +1104,64 @@ void TestJPGMemPoolCompressor(const unsigned char* uimg,
                               int numImages) {
     TJMemPoolCompressor tjc;
     for(int i = 0; i != numImages; ++i) {
-//        TJMemPoolCompressor::JPEGImageWrapper iw = tjc.Compress(uimg,
-//                                              width, height, pf, ss, quality);
-        //Compress returns a image wrapper which gets automatically converted
+        //Compress returns a image wrapper which puts the buffer back into
+        //the pool when destroyed and gets automatically converted
         //to an image const ref
-        JPEGImage img = tjc.Compress(uimg,
-                                     width, height, pf, ss, quality);
+        TJMemPoolCompressor::JPEGImageWrapper iw =
+            tjc.Compress(uimg, width, height, pf, ss, quality);
+        const JPEGImage& img = iw;
         const string fname = "out" + to_string(i) + ".jpg";
-
-        //JPEGImage img = iw.Image();
         ofstream os(fname, ios::binary);
         assert(os);
         assert(img.DataPtr());
         os.write((char*)img.DataPtr(), img.CompressedSize());
-        //tjc.PutBack(img);
-        assert(img.Empty()); //moved!
     }
+    //all buffers but the first one taken from the pool
+    const JPEGBufferPoolCounters c = tjc.Counters();
+    assert(c.misses == 1);
+    assert(c.hits == size_t(numImages - 1));
+    cout << "memory pool - hits: " << c.hits << " misses: " << c.misses
+         << " pooled bytes: " << c.pooledBytes << endl;
 }
 
+#ifdef TIMING__
+//per-thread metrics are summed over live and exited threads
+void TestMetrics(const Image& img, int quality, int numThreads) {
+    Metrics::Reset();
+    TJCompressor comp;
+    const JPEGImage j = comp.Compress(img.View(), TJSAMP_420, quality);
+    size_t batchBytes = 0;
+    {
+        TJBatchCompressor batch(numThreads);
+        const vector< ImageView > views(4, img.View());
+        for(auto& i: batch.CompressBatch(views, TJSAMP_420, quality))
+            batchBytes += i.Image().CompressedSize();
+    } //worker threads exit here
+    TJDeCompressor decomp;
+    const Image out = decomp.DeCompress(j.DataPtr(), j.CompressedSize(),
+                                        TJPF_RGB);
+    Metrics::Enable(false);
+    comp.Compress(img.View(), TJSAMP_420, quality);
+    Metrics::Enable(true);
+    const Metrics::Snapshot s = Metrics::Take();
+    assert(s[Metrics::COMPRESS_NS].count == 5);
+    assert(s[Metrics::COMPRESS_BYTES_OUT] == j.CompressedSize() + batchBytes);
+    assert(s[Metrics::COMPRESS_BYTES_IN] == 5 * img.Size());
+    assert(s[Metrics::DECOMPRESS_NS].count == 1);
+    assert(s[Metrics::DECOMPRESS_BYTES_IN] == j.CompressedSize());
+    assert(s[Metrics::DECOMPRESS_BYTES_OUT] == out.Size());
+    assert(s[Metrics::POOL_HITS] + s[Metrics::POOL_MISSES] == 4);
+    assert(s[Metrics::TASK_QUEUE_DEPTH].count == 4);
+    const HistogramSnapshot& h = s[Metrics::COMPRESS_NS];
+    assert(h.Percentile(0.5) <= h.Max() && h.Mean() <= h.Max());
+    for(uint64_t v: {0, 3, 4, 7, 1000, 123456789}) {
+        const int b = HistogramSnapshot::Bucket(v);
+        assert(HistogramSnapshot::LowerBound(b) <= v
+               && v <= HistogramSnapshot::UpperBound(b));
+    }
+    cout << "metrics:\n" << s;
+}
+#endif
 
 int TestCompressorAndDecompressor(int argc, char** argv) {
     //read
@@ -147,11 +1170,7 @@ int TestCompressorAndDecompressor(int argc, char** argv) {
              << " <jpeg file> <quality=[0,100]> <num threads>" << endl;
         return EXIT_FAILURE;
     }
-    const size_t length = FileSize(argv[1]);
-    using Byte = unsigned char;
-    vector< Byte > input(length);
-    ifstream is(argv[1], ios::binary);
-    is.read((char*) input.data(), input.size());
+    const MappedFile input(argv[1]);
     //Image img;
     //decompress
     TJDeCompressor decomp(1920 * 1080 * 4 * 4); //up to RGBX 4k support
@@ -160,7 +1179,7 @@ int TestCompressorAndDecompressor(int argc, char** argv) {
 #endif
     //move semantics for both constructor and assignment operator
     Image img;
-    img = decomp.DeCompress(input.data(), input.size(), TJPF_BGR);
+    img = decomp.DeCompress(input.Data(), input.Size(), TJPF_BGR);
 #ifdef TIMING__
     Time end = Tick();
 #endif
@@ -194,8 +1213,10 @@ int TestCompressorAndDecompressor(int argc, char** argv) {
          << "ms" << endl;
 #endif
 
-//    TestJPGMemPoolCompressor(img.DataPtr(), img.Width(), img.Height(),
-//                             FromCS(img.PixelFormat()), TJSAMP_420, 50, 10);
+    TestOwnership(img, quality);
+    TestImageBuffer(input.Data(), input.Size(), img);
+    TestJPGMemPoolCompressor(img.DataPtr(), img.Width(), img.Height(),
+                             img.PixelFormat(), TJSAMP_420, 50, 10);
 
     const int numThreads = strtol(argv[3], nullptr, 10);
     assert(numThreads > 0);
@@ -205,6 +1226,35 @@ int TestCompressorAndDecompressor(int argc, char** argv) {
                                   quality,
                                   numThreads);
     TestJPGParallelDeCompressor(stacks);
+    JPEGImage single =
+        TestJPGSingleStreamCompressor(img.DataPtr(), img.Width(), img.Height(),
+                                      img.PixelFormat(), TJSAMP_420,
+                                      quality,
+                                      numThreads);
+    TestJPGRestartDeCompressor(single, numThreads);
+    TestBandedDeCompressor(img, quality, numThreads);
+    TestFileWriterError();
+    TestImageView(img, numThreads);
+    TestYUV(input.Data(), input.Size(), quality, numThreads);
+    TestStreamPipeline(input.Data(), input.Size(), quality, 8);
+    TestBatch(img, 8, numThreads);
+    TestPyramid(input.Data(), input.Size(), quality, numThreads);
+    TestTransformer(jpegImage, numThreads);
+    TestPixelConversion(img, quality, numThreads);
+    TestAutoStripes(img, quality, numThreads);
+    TestAsync(img, quality, numThreads);
+    TestRateControl(img, numThreads);
+    TestTiles(img, quality, numThreads);
+    TestNumaPlacement(stacks, single, numThreads);
+    TestMalformedHeaders(single);
+    TestWorkerStealing();
+    TestAbbreviated(img, quality, numThreads);
+    TestStripeContainer(img, quality, numThreads);
+    TestHandlePool(img, quality);
+    TestTJApi(img, quality);
+#ifdef TIMING__
+    TestMetrics(img, quality, numThreads);
+#endif
     return EXIT_SUCCESS;
 }
 